@@ -0,0 +1,208 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file jedec_bench.c
+ * Benchmark and cross-check of the JEDEC parser.
+ * <p>
+ * For every part in XO2DevList a file is generated in four variants: LF and
+ * CRLF line ends, each with one L record per sector and with a single L
+ * record running from page 0 across the Cfg/UFM boundary.  Every variant is
+ * parsed and compared against what was generated before it is timed, so a
+ * parser change that breaks a layout fails here instead of on a board.
+ * Results go out as JSON, a summary table is printed to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "jedec.h"
+#include "jedec_gen.h"
+
+#define BENCH_CFG_PCT   90    // used share of the Cfg sector
+#define BENCH_UFM_PCT   30    // used share of the UFM
+#define BENCH_DENSITY   85    // non-zero pages within the used area
+#define BENCH_MIN_NS    200000000u  // time each variant at least this long by default
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int write_file(const char *dir, const char *name, const char *buf, size_t len)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	if (fwrite(buf, 1, len, f) != len || fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Check and time one variant, return 0 if it parsed as generated */
+static int bench_variant(FILE *out, const jedec_gen_t *pGen, unsigned int iterations,
+						 const char *corpusDir)
+{
+	static unsigned int runs;
+	jedec_gen_expect_t expect;
+	XO2_JEDEC_t *jed;
+	char name[64];
+	const char *ends = pGen->crlf ? "crlf" : "lf", *records = pGen->split ? "split" : "sectors";
+	uint64_t t0, ns, minNs = UINT64_MAX, totalNs = 0, fuses;
+	unsigned int n;
+	size_t len;
+	char *buf;
+	int ret;
+
+	buf = jedec_gen(pGen, &len, &expect);
+	if (!buf)
+		return -1;
+
+	snprintf(name, sizeof(name), "%s-%s-%s.jed", XO2DevList[pGen->dev].pName, ends, records);
+	if (corpusDir && write_file(corpusDir, name, buf, len) != 0) {
+		free(buf);
+		free(expect.fuses);
+		return -1;
+	}
+
+	jed = jedec_parse_mem(buf, len);
+	ret = jed ? jedec_gen_check(jed, &expect) : -1;
+	jedec_free(jed);
+
+	fuses = 8ull * (expect.jedec.CfgDataSize + expect.jedec.UFMDataSize);
+	for (n = 0;ret == 0 && (iterations ? n < iterations : totalNs < BENCH_MIN_NS || n < 3);++n) {
+		t0 = now_ns();
+		jed = jedec_parse_mem(buf, len);
+		ns = now_ns() - t0;
+		if (!jed) {
+			ret = -1;
+			break;
+		}
+		jedec_free(jed);
+		totalNs += ns;
+		if (ns < minNs)
+			minNs = ns;
+	}
+
+	fprintf(out, "%s\n    {\"device\": \"%s\", \"line_ends\": \"%s\", \"records\": \"%s\", "
+			"\"bytes\": %zu, \"fuses\": %llu, \"check\": \"%s\"", runs++ ? "," : "",
+			XO2DevList[pGen->dev].pName, ends, records, len, (unsigned long long)fuses,
+			ret == 0 ? "ok" : "FAIL");
+	if (ret == 0) {
+		fprintf(out, ",\n     \"iterations\": %u, \"min_ns\": %llu, \"mean_ns\": %llu, "
+				"\"mb_per_s\": %.1f, \"fuses_per_s\": %.0f}", n, (unsigned long long)minNs,
+				(unsigned long long)(totalNs / n), len * 1e3 / minNs, fuses * 1e9 / minNs);
+		fprintf(stderr, "  %-14s %-4s %-7s %8zu B %4s %9.1f us %8.1f MB/s %7.1f Mfuses/s\n",
+				XO2DevList[pGen->dev].pName, ends, records, len, "ok", minNs / 1e3,
+				len * 1e3 / minNs, fuses * 1e3 / minNs);
+	} else {
+		fprintf(out, "}");
+		fprintf(stderr, "  %-14s %-4s %-7s %8zu B %4s\n", XO2DevList[pGen->dev].pName, ends,
+				records, len, "FAIL");
+	}
+
+	free(buf);
+	free(expect.fuses);
+	return ret;
+}
+
+
+void usage(const char *arg0)
+{
+	fprintf(stderr, "Usage: %s [-d <part>] [-n <iterations>] [-w <dir>] [-o <results.json>]\n", arg0);
+	fprintf(stderr, "\t-d\tOnly this part, e.g. MachXO2-1200\n");
+	fprintf(stderr, "\t-n\tParse every file this often, default as often as fits in %u ms\n",
+			BENCH_MIN_NS / 1000000);
+	fprintf(stderr, "\t-w\tAlso write the generated files to this directory\n");
+	fprintf(stderr, "\t-o\tWrite the JSON results to a file instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *part = NULL, *outPath = NULL, *corpusDir = NULL;
+	unsigned int iterations = 0;
+	FILE *out = stdout;
+	int opt, i, first, last, err = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:w:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			part = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			corpusDir = optarg;
+			break;
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	first = 0;
+	last = LATTICE_XO2_NUM_DEVS - 1;
+	if (part) {
+		for (first = 0;first <= last;++first)
+			if (strcmp(XO2DevList[first].pName, part) == 0)
+				break;
+		if (first > last) {
+			fprintf(stderr, "Unknown part %s\n", part);
+			return 1;
+		}
+		last = first;
+	}
+
+	if (outPath) {
+		out = fopen(outPath, "w");
+		if (!out) {
+			perror(outPath);
+			return 1;
+		}
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"jedec_bench\",\n  \"version\": 1,\n  \"runs\": [");
+	for (i = first;i <= last;++i) {
+		for (int variant = 0;variant < 4;++variant) {
+			jedec_gen_t gen = {.dev = i, .seed = 0x12345678u + i, .cfgPct = BENCH_CFG_PCT,
+							   .ufmPct = BENCH_UFM_PCT, .density = BENCH_DENSITY,
+							   .crlf = variant & 1, .split = variant & 2};
+			if (bench_variant(out, &gen, iterations, corpusDir) != 0)
+				err = 1;
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+	if (err)
+		fprintf(stderr, "Parser check FAILED\n");
+	return err;
+}
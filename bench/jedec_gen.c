@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file jedec_gen.c
+ * Generator of Lattice style JEDEC files for the benchmarks.
+ * <p>
+ * The files carry correct fuse (C) and file (^C) checksums and are laid out
+ * like the ones written by Diamond: a NOTE with the part name, QF with the
+ * fuse count of Cfg plus UFM, one L record per sector (or one spanning both),
+ * 128 fuses per line, then the feature row (E) and the UserCode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "digest.h"
+#include "jedec_gen.h"
+
+static uint32_t xorshift32(uint32_t *st)
+{
+	uint32_t x = *st;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *st = x;
+}
+
+static uint8_t bitrev8(uint8_t b)
+{
+	return ((b * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32;
+}
+
+static void put_bits(FILE *f, const uint8_t *data, unsigned int len)
+{
+	for (unsigned int i = 0;i < len;++i)
+		for (int j = 7;j >= 0;--j)
+			fputc('0' + ((data[i] >> j) & 1), f);
+}
+
+/* Fill pages with design like data: about half the bytes of a used page are
+   0, pages are left all 0 as given by density.
+*/
+static void fill_pages(uint8_t *data, unsigned int pages, unsigned int density, bool sparse,
+					   uint32_t *seed)
+{
+	for (unsigned int pg = 0;pg < pages;++pg) {
+		uint8_t *p = data + XO2_FLASH_PAGES_LEN(pg);
+
+		if (density < 100 && xorshift32(seed) % 100 >= density)
+			continue;
+		for (unsigned int i = 0;i < XO2_FLASH_PAGE_SIZE;++i) {
+			uint32_t r = xorshift32(seed);
+			p[i] = (!sparse || (r & 0x100)) ? r : 0;
+		}
+	}
+}
+
+/**
+ * Generate a JEDEC file.
+ *
+ * @param pGen what to generate
+ * @param pLen set to the length of the file
+ * @param pExpect if not NULL, filled with what parsing the file must give,
+ * release pExpect->fuses with free()
+ * @return the file in a malloc'ed buffer, NULL if out of memory
+ */
+char *jedec_gen(const jedec_gen_t *pGen, size_t *pLen, jedec_gen_expect_t *pExpect)
+{
+	const XO2DevInfo_t *info = &XO2DevList[pGen->dev];
+	const char *nl = pGen->crlf ? "\r\n" : "\n";
+	unsigned int pages = info->Cfgpages + info->UFMpages;
+	unsigned int usedCfg = info->Cfgpages * pGen->cfgPct / 100;
+	unsigned int usedUfm = info->UFMpages * pGen->ufmPct / 100;
+	uint8_t *data, feature[8] = {0, 0, 0, 0, 0, 0x12, 0x34, 0x56}, feabits[2] = {0x04, 0x20};
+	uint16_t fuseCsum = 0, fileCsum = 0;
+	uint32_t seed = pGen->seed;
+	unsigned int i, first, last;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	data = calloc(pages, XO2_FLASH_PAGE_SIZE);
+	if (!data)
+		return NULL;
+	fill_pages(data, usedCfg, pGen->density, true, &seed);
+	fill_pages(data + XO2_FLASH_PAGES_LEN(info->Cfgpages), usedUfm, pGen->density, false, &seed);
+	for (i = 0;i < pages * XO2_FLASH_PAGE_SIZE;++i)
+		fuseCsum += bitrev8(data[i]);
+
+	f = open_memstream(&buf, &len);
+	if (!f) {
+		free(data);
+		return NULL;
+	}
+
+	// "MachXO2-1200U" is sold as LCMXO2-1200UHC
+	fprintf(f, "\x02*%sNOTE DEVICE NAME:\tLCMXO2-%sHC-4TG144*%s", nl, info->pName + 8, nl);
+	fprintf(f, "QF%u*%sG0*%sF0*%s", pages * 128, nl, nl, nl);
+	for (int rec = 0;rec < 2;++rec) {
+		if (pGen->split) {
+			// Cfg padded up to the UFM in the same record
+			if (rec == 1)
+				break;
+			first = 0;
+			last = info->Cfgpages + usedUfm;
+		} else if (rec == 0) {
+			first = 0;
+			last = usedCfg;
+		} else {
+			first = info->Cfgpages;
+			last = info->Cfgpages + usedUfm;
+			if (!usedUfm)
+				break;
+		}
+		fprintf(f, "L%06u%s", first * 128, nl);
+		for (i = first;i < last;++i) {
+			put_bits(f, data + XO2_FLASH_PAGES_LEN(i), XO2_FLASH_PAGE_SIZE);
+			fputs(nl, f);
+		}
+		fprintf(f, "*%s", nl);
+	}
+	fprintf(f, "C%04X*%sE", fuseCsum, nl);
+	put_bits(f, feature, sizeof(feature));
+	fputs(nl, f);
+	put_bits(f, feabits, sizeof(feabits));
+	fprintf(f, "*%sUH12345678*%s\x03", nl, nl);
+	fflush(f);
+
+	for (i = 0;i < len;++i)
+		fileCsum += (uint8_t)buf[i];
+	fprintf(f, "%04X%s", fileCsum, nl);
+	fclose(f);
+
+	if (pExpect) {
+		memset(pExpect, 0, sizeof(*pExpect));
+		pExpect->fuses = data;
+		pExpect->jedec.devID = pGen->dev;
+		pExpect->jedec.pageCnt = pages;
+		pExpect->jedec.CfgDataSize = XO2_FLASH_PAGES_LEN(pGen->split ? (unsigned int)info->Cfgpages : usedCfg);
+		pExpect->jedec.UFMDataSize = XO2_FLASH_PAGES_LEN(usedUfm);
+		pExpect->jedec.UserCode = 0x12345678;
+		pExpect->jedec.pCfgData = data;
+		pExpect->jedec.pUFMData = usedUfm ? data + XO2_FLASH_PAGES_LEN(info->Cfgpages) : NULL;
+		memcpy(pExpect->jedec.pFeatureRow.feature, feature, sizeof(feature));
+		memcpy(pExpect->jedec.pFeatureRow.feabits, feabits, sizeof(feabits));
+	} else {
+		free(data);
+	}
+
+	*pLen = len;
+	return buf;
+}
+
+/**
+ * Compare a parsed JEDEC with what the generator put into the file.
+ *
+ * @param pParsed result of the parser
+ * @param pExpect from jedec_gen()
+ * @return 0 if they match, else -1 after printing the first difference
+ */
+int jedec_gen_check(const XO2_JEDEC_t *pParsed, const jedec_gen_expect_t *pExpect)
+{
+	const XO2_JEDEC_t *e = &pExpect->jedec;
+	const char *what = NULL;
+
+	if (pParsed->devID != e->devID)
+		what = "devID";
+	else if (pParsed->pageCnt != e->pageCnt)
+		what = "pageCnt";
+	else if (pParsed->CfgDataSize != e->CfgDataSize)
+		what = "CfgDataSize";
+	else if (pParsed->UFMDataSize != e->UFMDataSize)
+		what = "UFMDataSize";
+	else if (pParsed->UserCode != e->UserCode)
+		what = "UserCode";
+	else if (memcmp(&pParsed->pFeatureRow, &e->pFeatureRow, sizeof(e->pFeatureRow)) != 0)
+		what = "Feature Row";
+	else if (!pParsed->pCfgData != !e->pCfgData ||
+			 (e->pCfgData && memcmp(pParsed->pCfgData, e->pCfgData, e->CfgDataSize) != 0))
+		what = "Cfg data";
+	else if (!pParsed->pUFMData != !e->pUFMData ||
+			 (e->pUFMData && memcmp(pParsed->pUFMData, e->pUFMData, e->UFMDataSize) != 0))
+		what = "UFM data";
+	else if (!pParsed->digestValid ||
+			 pParsed->CfgDigest != (e->pCfgData ? digest_crc32c(0, e->pCfgData, e->CfgDataSize) : 0) ||
+			 pParsed->UFMDigest != (e->pUFMData ? digest_crc32c(0, e->pUFMData, e->UFMDataSize) : 0))
+		what = "digest";
+
+	if (what) {
+		fprintf(stderr, "%s: parsed %s differs from generated\n", XO2DevList[e->devID].pName, what);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#ifndef JEDEC_GEN_H
+#define JEDEC_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "XO2_ECA/XO2_dev.h"
+
+/**
+ * What to generate.
+ */
+typedef struct {
+	XO2Devices_t dev;
+	uint32_t seed;
+	unsigned int cfgPct;    /**< Used share of the Cfg sector */
+	unsigned int ufmPct;    /**< Used share of the UFM */
+	unsigned int density;   /**< Share of non-zero pages within the used area, 100 = all */
+	bool crlf;              /**< CRLF line ends instead of LF */
+	bool split;             /**< One L record from page 0 across the Cfg/UFM boundary */
+} jedec_gen_t;
+
+/**
+ * The contents of a generated file, as the parser should see them.
+ */
+typedef struct {
+	XO2_JEDEC_t jedec;      /**< pCfgData/pUFMData point into fuses, or are NULL */
+	uint8_t *fuses;         /**< All pageCnt pages */
+} jedec_gen_expect_t;
+
+char *jedec_gen(const jedec_gen_t *pGen, size_t *pLen, jedec_gen_expect_t *pExpect);
+int jedec_gen_check(const XO2_JEDEC_t *pParsed, const jedec_gen_expect_t *pExpect);
+
+#endif
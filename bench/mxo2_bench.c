@@ -0,0 +1,512 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file mxo2_bench.c
+ * Benchmark of the flashing flow, phase by phase:
+ * parse, erase, program, verify, set-done and refresh.
+ * <p>
+ * Runs against the simulator for every part in XO2DevList with a generated
+ * JEDEC image, or against a real device with the image given by -j.  The
+ * link driver is wrapped by a counting shim, so per phase it reports the
+ * driver calls (one ioctl each on the real links), bytes on the wire, time
+ * spent in delays, busy polls and the latency of every command opcode.
+ * Results go out as JSON, a summary table is printed to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "XO2_ECA/XO2_cmds.h"
+#include "XO2_ECA/XO2_drvr.h"
+#include "XO2_ECA/XO2_sim.h"
+#include "XO2_ECA/XO2_stats.h"
+#include "jedec.h"
+#include "jedec_gen.h"
+
+#define BENCH_UFM_PCT  30   // used share of the UFM in generated images
+#define BENCH_CFG_PCT  60   // used share of the Cfg sector in generated images
+
+typedef enum {
+	PH_PARSE,
+	PH_ERASE,
+	PH_PROGRAM,
+	PH_VERIFY,
+	PH_DONE,
+	PH_REFRESH,
+	NUM_PHASES
+} phase_t;
+
+static const char *phaseNames[NUM_PHASES] = {
+	"parse", "erase", "program", "verify", "set-done", "refresh"
+};
+
+/* Latency samples of one opcode, in ns */
+typedef struct {
+	uint64_t *pNs;
+	unsigned int n, cap;
+} lat_t;
+
+typedef struct {
+	uint64_t wallNs;
+	unsigned int pages;
+	uint64_t calls;
+	uint64_t wireBytes;
+	uint64_t sleepNs;
+	uint64_t sleeps;
+	XO2Stats_t cmd;     /**< Command layer statistics, for the busy polling */
+	lat_t lat[256];
+} phaseStats_t;
+
+/* Counting shim around the real link driver */
+typedef struct {
+	ECADrvrCalls_t calls;
+	const ECADrvrCalls_t *pInner;
+	void *pInnerParams;
+	phaseStats_t *pCur;
+	bool noDelay;       /**< Only account delays, do not wait */
+} shim_t;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void lat_add(lat_t *l, uint64_t ns)
+{
+	if (l->n == l->cap) {
+		unsigned int cap = l->cap ? l->cap * 2 : 64;
+		uint64_t *p = realloc(l->pNs, cap * sizeof(*p));
+		if (!p)
+			return;
+		l->pNs = p;
+		l->cap = cap;
+	}
+	l->pNs[l->n++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t lat_pct(const lat_t *l, unsigned int pct)
+{
+	return l->n ? l->pNs[(uint64_t)(l->n - 1) * pct / 100] : 0;
+}
+
+static void stats_reset(phaseStats_t *ps)
+{
+	for (int i = 0;i < 256;++i)
+		free(ps->lat[i].pNs);
+	memset(ps, 0, sizeof(*ps));
+}
+
+
+//==============================================================================
+//                          C o u n t i n g   s h i m
+//==============================================================================
+static int shim_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					 uint8_t *pRd, unsigned int rlen)
+{
+	shim_t *s = pDrvrParams;
+	uint64_t t0 = now_ns();
+	int ret;
+
+	ret = s->pInner->xfer(s->pInnerParams, pWr, wlen, pRd, rlen);
+	if (s->pCur) {
+		lat_add(&s->pCur->lat[pWr[0]], now_ns() - t0);
+		s->pCur->calls++;
+		s->pCur->wireBytes += 1 + wlen + (rlen ? 1 + rlen : 0);
+	}
+	return ret;
+}
+
+/* A batch is one driver call, each frame is accounted the average latency */
+static int shim_writeFrames(void *pDrvrParams, const XO2Frame_t *pFrames, unsigned int nFrames)
+{
+	shim_t *s = pDrvrParams;
+	uint64_t t0 = now_ns(), dt;
+	unsigned int i;
+	int ret;
+
+	ret = s->pInner->writeFrames(s->pInnerParams, pFrames, nFrames);
+	dt = now_ns() - t0;
+	if (s->pCur && nFrames) {
+		s->pCur->calls++;
+		for (i = 0;i < nFrames;++i) {
+			lat_add(&s->pCur->lat[pFrames[i].pBuf[0]], dt / nFrames);
+			s->pCur->wireBytes += 1 + pFrames[i].len;
+		}
+	}
+	return ret;
+}
+
+static void shim_delay(void *pDrvrParams, unsigned int usec)
+{
+	shim_t *s = pDrvrParams;
+	uint64_t t0 = now_ns();
+
+	if (s->noDelay)
+		t0 -= (uint64_t)usec * 1000;
+	else if (s->pInner->delay)
+		s->pInner->delay(s->pInnerParams, usec);
+	else
+		usleep(usec);
+	if (s->pCur) {
+		s->pCur->sleepNs += now_ns() - t0;
+		s->pCur->sleeps++;
+	}
+}
+
+static void shim_attach(shim_t *s, XO2Handle_t *pXO2)
+{
+	memset(s, 0, sizeof(*s));
+	s->pInner = pXO2->pDrvrCalls;
+	s->pInnerParams = pXO2->pDrvrParams;
+	s->calls = *s->pInner;
+	s->calls.xfer = shim_xfer;
+	s->calls.writeFrames = s->pInner->writeFrames ? shim_writeFrames : NULL;
+	s->calls.delay = shim_delay;
+	s->calls.close = NULL;
+	pXO2->pDrvrCalls = &s->calls;
+	pXO2->pDrvrParams = s;
+}
+
+static void shim_detach(shim_t *s, XO2Handle_t *pXO2)
+{
+	pXO2->pDrvrCalls = s->pInner;
+	pXO2->pDrvrParams = s->pInnerParams;
+}
+
+
+//==============================================================================
+//                          J E D E C   i m a g e
+//==============================================================================
+static char *read_file(const char *path, size_t *pLen)
+{
+	char *buf = NULL;
+	long len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(len);
+		if (buf && fread(buf, 1, len, f) != (size_t)len) {
+			free(buf);
+			buf = NULL;
+		}
+		*pLen = len;
+	}
+	fclose(f);
+	return buf;
+}
+
+
+//==============================================================================
+//                          P h a s e s
+//==============================================================================
+static int verify_pages(XO2Handle_t *pXO2, bool ufm, const uint8_t *pData, unsigned int numPgs)
+{
+	uint8_t buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned int i, n;
+	int status;
+
+	status = ufm ? XO2ECAcmd_UFMResetAddr(pXO2) : XO2ECAcmd_CfgResetAddr(pXO2);
+	for (i = 0;status == OK && i < numPgs;i += n) {
+		n = numPgs - i > XO2ECA_CMD_READ_BURST ? XO2ECA_CMD_READ_BURST : numPgs - i;
+		status = ufm ? XO2ECAcmd_UFMReadPages(pXO2, n, buf) : XO2ECAcmd_CfgReadPages(pXO2, n, buf);
+		if (status == OK && memcmp(buf, pData + XO2_FLASH_PAGES_LEN(i), XO2_FLASH_PAGES_LEN(n)) != 0)
+			status = ERROR;
+	}
+	return status;
+}
+
+static int run_phase(XO2Handle_t *pXO2, XO2_JEDEC_t *jed, phase_t ph, unsigned int *pPages)
+{
+	unsigned int cfgPgs = jed->CfgDataSize / XO2_FLASH_PAGE_SIZE;
+	unsigned int ufmPgs = jed->pUFMData ? jed->UFMDataSize / XO2_FLASH_PAGE_SIZE : 0;
+	int status = OK;
+
+	switch (ph) {
+	case PH_ERASE:
+		status = XO2ECAcmd_openCfgIF(pXO2, OFFLINE_MODE);
+		if (status == OK)
+			status = XO2ECAcmd_EraseFlash(pXO2, XO2ECA_CMD_ERASE_CFG | XO2ECA_CMD_ERASE_UFM);
+		break;
+	case PH_PROGRAM:
+	case PH_VERIFY:
+		*pPages = cfgPgs + ufmPgs;
+		if (ph == PH_VERIFY) {
+			status = verify_pages(pXO2, false, jed->pCfgData, cfgPgs);
+			if (status == OK && ufmPgs)
+				status = verify_pages(pXO2, true, jed->pUFMData, ufmPgs);
+			break;
+		}
+		status = XO2ECAcmd_CfgResetAddr(pXO2);
+		if (status == OK)
+			status = XO2ECAcmd_CfgWritePages(pXO2, cfgPgs, jed->pCfgData);
+		if (status == OK && ufmPgs) {
+			status = XO2ECAcmd_UFMResetAddr(pXO2);
+			if (status == OK)
+				status = XO2ECAcmd_UFMWritePages(pXO2, ufmPgs, jed->pUFMData);
+		}
+		break;
+	case PH_DONE:
+		status = XO2ECAcmd_setDone(pXO2);
+		if (status == OK)
+			status = XO2ECAcmd_closeCfgIF(pXO2);
+		break;
+	case PH_REFRESH:
+		status = XO2ECAcmd_Refresh(pXO2);
+		break;
+	default:
+		break;
+	}
+	return status;
+}
+
+
+//==============================================================================
+//                          R e p o r t
+//==============================================================================
+static void report_phase(FILE *out, phase_t ph, int status, phaseStats_t *ps, bool last)
+{
+	double sec = ps->wallNs / 1e9;
+	bool first = true;
+
+	fprintf(out, "      {\"phase\": \"%s\", \"status\": %d, \"wall_us\": %llu, \"pages\": %u, "
+			"\"pages_per_s\": %.1f, \"ioctls\": %llu, \"wire_bytes\": %llu, "
+			"\"sleeps\": %llu, \"sleep_us\": %llu, \"busy_waits\": %llu, \"busy_polls\": %llu,\n        \"cmds\": [",
+			phaseNames[ph], status, (unsigned long long)(ps->wallNs / 1000), ps->pages,
+			sec > 0 ? ps->pages / sec : 0.0,
+			(unsigned long long)ps->calls, (unsigned long long)ps->wireBytes,
+			(unsigned long long)ps->sleeps, (unsigned long long)(ps->sleepNs / 1000),
+			(unsigned long long)ps->cmd.busyWaits, (unsigned long long)ps->cmd.busyPolls);
+
+	for (int op = 0;op < 256;++op) {
+		lat_t *l = &ps->lat[op];
+		if (!l->n)
+			continue;
+		qsort(l->pNs, l->n, sizeof(*l->pNs), cmp_u64);
+		fprintf(out, "%s\n          {\"op\": \"0x%02X\", \"count\": %u, \"p50_us\": %.1f, \"p99_us\": %.1f}",
+				first ? "" : ",", op, l->n, lat_pct(l, 50) / 1e3, lat_pct(l, 99) / 1e3);
+		first = false;
+	}
+	fprintf(out, "%s]}%s\n", first ? "" : "\n        ", last ? "" : ",");
+
+	fprintf(stderr, "  %-9s %4s %10.1f ms %9.1f pg/s %8llu ioctl %9llu B %10.1f ms sleep\n",
+			phaseNames[ph], status == OK ? "ok" : "FAIL", ps->wallNs / 1e6,
+			sec > 0 ? ps->pages / sec : 0.0, (unsigned long long)ps->calls,
+			(unsigned long long)ps->wireBytes, ps->sleepNs / 1e6);
+}
+
+/* Run all phases on one part, return OK if all phases passed */
+static int bench_device(FILE *out, XO2Handle_t *pXO2, const char *image, size_t imageLen,
+						const char *link, bool noDelay)
+{
+	static phaseStats_t ps;
+	static unsigned int runs;
+	shim_t shim;
+	XO2_JEDEC_t *jed;
+	uint64_t t0;
+	int status, ret = OK;
+
+	stats_reset(&ps);
+	t0 = now_ns();
+	jed = jedec_parse_mem(image, imageLen);
+	ps.wallNs = now_ns() - t0;
+	if (!jed) {
+		fprintf(stderr, "JEDEC parse failed\n");
+		return ERROR;
+	}
+	ps.pages = jed->pageCnt;
+
+	pXO2->devType = jed->devID;
+	fprintf(stderr, "%s (%s):\n", XO2DevList[jed->devID].pName, link);
+	fprintf(out, "%s\n    {\"device\": \"%s\", \"link\": \"%s\", \"cfg_pages\": %d, \"ufm_pages\": %d,\n"
+			"     \"phases\": [\n", runs++ ? "," : "", XO2DevList[jed->devID].pName, link,
+			XO2DevList[jed->devID].Cfgpages, XO2DevList[jed->devID].UFMpages);
+	report_phase(out, PH_PARSE, OK, &ps, false);
+
+	shim_attach(&shim, pXO2);
+	shim.noDelay = noDelay;
+	for (phase_t ph = PH_ERASE;ph < NUM_PHASES;++ph) {
+		stats_reset(&ps);
+		shim.pCur = &ps;
+		pXO2->pStats = &ps.cmd;
+		t0 = now_ns();
+		status = (ret == OK) ? run_phase(pXO2, jed, ph, &ps.pages) : ERROR;
+		ps.wallNs = now_ns() - t0;
+		shim.pCur = NULL;
+		pXO2->pStats = NULL;
+		report_phase(out, ph, status, &ps, ph == NUM_PHASES - 1);
+		if (status != OK)
+			ret = ERROR;
+	}
+	shim_detach(&shim, pXO2);
+	stats_reset(&ps);
+
+	fprintf(out, "    ]}");
+	jedec_free(jed);
+	return ret;
+}
+
+
+void usage(const char *arg0)
+{
+	fprintf(stderr, "Usage: %s [-t <link>] [-j <bitstream.jed>] [-d <part>] [-z] [-o <results.json>] [<i2c-bus> <i2c-addr>]\n", arg0);
+	fprintf(stderr, "\t-t\tLink to the device: sim (default), i2c, smbus or spi\n");
+	fprintf(stderr, "\t\tspi: <i2c-bus> is the spidev node, <i2c-addr> the SPI clock in Hz\n");
+	fprintf(stderr, "\t-j\tBitstream to flash, required on real links.  Without it every\n");
+	fprintf(stderr, "\t\tpart in the device list is simulated with a generated image\n");
+	fprintf(stderr, "\t-d\tOnly simulate this part, e.g. MachXO2-1200\n");
+	fprintf(stderr, "\t-z\tSimulate without erase/program/bus latencies and skip the waits\n");
+	fprintf(stderr, "\t\tof the command layer, their requested time is still reported\n");
+	fprintf(stderr, "\t-o\tWrite the JSON results to a file instead of stdout\n");
+	fprintf(stderr, "Note: on real links the device is erased, programmed and refreshed.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *link = "sim", *jedPath = NULL, *part = NULL, *outPath = NULL;
+	bool zeroLatency = false, sim;
+	XO2SimTiming_t simTiming;
+	XO2Handle_t xo2;
+	FILE *out = stdout;
+	char *image = NULL;
+	size_t imageLen = 0;
+	int opt, i, first, last, err = 0;
+
+	while ((opt = getopt(argc, argv, "t:j:d:zo:")) != -1) {
+		switch (opt) {
+		case 't':
+			link = optarg;
+			break;
+		case 'j':
+			jedPath = optarg;
+			break;
+		case 'd':
+			part = optarg;
+			break;
+		case 'z':
+			zeroLatency = true;
+			break;
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	sim = strcmp(link, "sim") == 0;
+	if (!sim && (argc - optind < 2 || !jedPath)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (jedPath) {
+		image = read_file(jedPath, &imageLen);
+		if (!image) {
+			perror(jedPath);
+			return 1;
+		}
+	}
+
+	first = 0;
+	last = LATTICE_XO2_NUM_DEVS - 1;
+	if (part) {
+		for (first = 0;first <= last;++first)
+			if (strcmp(XO2DevList[first].pName, part) == 0)
+				break;
+		if (first > last) {
+			fprintf(stderr, "Unknown part %s\n", part);
+			return 1;
+		}
+		last = first;
+	}
+	if (jedPath)
+		first = last = 0;  // one run with the given image
+
+	if (outPath) {
+		out = fopen(outPath, "w");
+		if (!out) {
+			perror(outPath);
+			return 1;
+		}
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"mxo2_bench\",\n  \"version\": 1,\n  \"runs\": [");
+	for (i = first;i <= last;++i) {
+		char *buf = image;
+		size_t len = imageLen;
+		XO2Devices_t dev = i;
+		int status;
+
+		if (!buf) {
+			jedec_gen_t gen = {.dev = dev, .seed = 0x12345678u + i, .cfgPct = BENCH_CFG_PCT,
+							   .ufmPct = BENCH_UFM_PCT, .density = 100};
+			buf = jedec_gen(&gen, &len, NULL);
+			if (!buf) {
+				err = 1;
+				break;
+			}
+		}
+
+		memset(&xo2, 0, sizeof(xo2));
+		if (sim) {
+			// The simulated part is the one the image is for, like on a real board
+			XO2_JEDEC_t *jed = jedec_parse_mem(buf, len);
+			if (jed) {
+				dev = jed->devID;
+				jedec_free(jed);
+			}
+			XO2sim_defaultTiming(dev, &simTiming);
+			status = XO2sim_open(&xo2, dev, zeroLatency ? NULL : &simTiming);
+		} else if (strcmp(link, "i2c") == 0) {
+			status = XO2drvr_openI2C(&xo2, strtoul(argv[optind], NULL, 0), strtoul(argv[optind+1], NULL, 0));
+		} else if (strcmp(link, "smbus") == 0) {
+			status = XO2drvr_openSMBus(&xo2, strtoul(argv[optind], NULL, 0), strtoul(argv[optind+1], NULL, 0));
+		} else if (strcmp(link, "spi") == 0) {
+			status = XO2drvr_openSPI(&xo2, argv[optind], strtoul(argv[optind+1], NULL, 0));
+		} else {
+			fprintf(stderr, "Unknown link %s\n", link);
+			status = ERROR;
+		}
+
+		if (status == OK) {
+			if (bench_device(out, &xo2, buf, len, link, sim && zeroLatency) != OK)
+				err = 1;
+			XO2drvr_close(&xo2);
+		} else {
+			err = 1;
+		}
+		if (buf != image)
+			free(buf);
+		if (status != OK)
+			break;
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+	free(image);
+	return err;
+}
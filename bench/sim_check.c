@@ -0,0 +1,524 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file sim_check.c
+ * Functional checks of the API layers against the configuration logic
+ * simulator, which erases flash to 0 and lets a page be programmed only once
+ * like the real part.  Every case runs on a fresh simulated device with no
+ * latencies and prints one line, the exit status is 1 if any case failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XO2_ECA/XO2_api.h"
+#include "XO2_ECA/XO2_cmds.h"
+#include "XO2_ECA/XO2_drvr.h"
+#include "XO2_ECA/XO2_sim.h"
+#include "XO2_ECA/XO2_ufmkv.h"
+#include "jedec.h"
+#include "jedec_gen.h"
+
+#define CHECK_DEV  MachXO2_1200
+#define CHECK_CFG_PCT   60   // used share of the Cfg sector in generated images
+#define CHECK_UFM_PCT   30   // used share of the UFM in generated images
+#define CHECK_DENSITY   70   // non-zero pages within the used area
+
+// Give up on the case at the first failed condition
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			goto out; \
+		} \
+	} while (0)
+
+
+static int open_dev(XO2Handle_t *pXO2)
+{
+	static const XO2Timing_t expect;   // nothing to wait for
+	XO2SimTiming_t timing;
+
+	memset(pXO2, 0, sizeof(*pXO2));
+	memset(&timing, 0, sizeof(timing));
+	pXO2->devType = CHECK_DEV;
+	pXO2->pTiming = &expect;
+	return XO2sim_open(pXO2, CHECK_DEV, &timing);
+}
+
+//==============================================================================
+//                          F a u l t   s h i m
+//==============================================================================
+typedef enum {
+	FAULT_LOST,     // the frame never reaches the part
+	FAULT_NO_ACK,   // the part programs the page, the host sees an error
+	FAULT_TORN      // the page is programmed with other data
+} fault_t;
+
+typedef struct {
+	const ECADrvrCalls_t *pInner;
+	void *pInnerParams;
+	ECADrvrCalls_t calls;
+	uint8_t faultOp;        // page program opcode to fail once, 0 = none
+	unsigned int faultAt;   // number of the faultOp frame to fail, from 0
+	fault_t fault;
+	unsigned int frames;    // faultOp frames seen
+	unsigned int page;      // page address register of the part
+	int faultPage;          // page the failed frame was for
+	uint8_t eraseFlags;     // sectors of the Erase commands seen
+	unsigned int frWrites;  // Feature Row program commands seen
+} shim_t;
+
+static int shim_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					 uint8_t *pRd, unsigned int rlen)
+{
+	shim_t *s = pDrvrParams;
+	uint8_t torn[4 + XO2_FLASH_PAGE_SIZE];
+	unsigned int i;
+	int ret;
+
+	if (pWr[0] == 0x0E && wlen == 4)
+		s->eraseFlags |= pWr[1] & 0x0f;
+	else if (pWr[0] == 0xE4)
+		s->frWrites++;
+	else if (pWr[0] == 0xB4 && wlen == 8)
+		s->page = pWr[6] << 8 | pWr[7];
+	else if (pWr[0] == 0x46 || pWr[0] == 0x47)
+		s->page = 0;
+
+	if (s->faultOp && pWr[0] == s->faultOp && s->frames++ == s->faultAt) {
+		s->faultOp = 0;
+		s->faultPage = s->page;
+		switch (s->fault) {
+		case FAULT_LOST:
+			return ERROR;
+		case FAULT_NO_ACK:
+			s->page++;
+			s->pInner->xfer(s->pInnerParams, pWr, wlen, pRd, rlen);
+			return ERROR;
+		case FAULT_TORN:
+			s->page++;
+			memcpy(torn, pWr, wlen < sizeof(torn) ? wlen : sizeof(torn));
+			for (i = 4;i < sizeof(torn) && torn[i] == 0xFF;++i)
+				;
+			if (i < sizeof(torn))
+				torn[i] = 0xFF;
+			s->pInner->xfer(s->pInnerParams, torn, wlen, pRd, rlen);
+			return ERROR;
+		}
+	}
+
+	ret = s->pInner->xfer(s->pInnerParams, pWr, wlen, pRd, rlen);
+	if (pWr[0] == 0x70 || pWr[0] == 0xC9)
+		s->page++;
+	return ret;
+}
+
+/* Route all transfers of pXO2 through the shim, frame by frame */
+static void shim_attach(shim_t *s, XO2Handle_t *pXO2)
+{
+	memset(s, 0, sizeof(*s));
+	s->pInner = pXO2->pDrvrCalls;
+	s->pInnerParams = pXO2->pDrvrParams;
+	s->calls = *s->pInner;
+	s->calls.xfer = shim_xfer;
+	s->calls.writeFrames = NULL;
+	s->calls.close = NULL;
+	s->faultPage = -1;
+	pXO2->pDrvrCalls = &s->calls;
+	pXO2->pDrvrParams = s;
+}
+
+static void shim_detach(shim_t *s, XO2Handle_t *pXO2)
+{
+	pXO2->pDrvrCalls = s->pInner;
+	pXO2->pDrvrParams = s->pInnerParams;
+}
+
+/* Parse a generated image, NULL if that failed */
+static XO2_JEDEC_t *gen_jedec(uint32_t seed)
+{
+	jedec_gen_t gen = {.dev = CHECK_DEV, .seed = seed, .cfgPct = CHECK_CFG_PCT,
+					   .ufmPct = CHECK_UFM_PCT, .density = CHECK_DENSITY};
+	jedec_gen_expect_t expect;
+	XO2_JEDEC_t *jed;
+	size_t len;
+	char *buf;
+
+	buf = jedec_gen(&gen, &len, &expect);
+	if (!buf)
+		return NULL;
+	jed = jedec_parse_mem(buf, len);
+	free(buf);
+	free(expect.fuses);
+	return jed;
+}
+
+
+//==============================================================================
+//                          U F M   k e y - v a l u e   s t o r e
+//==============================================================================
+/* Contents of a UFM page outside the store */
+static void fill_page(unsigned char *pPage, unsigned int pg)
+{
+	unsigned int i;
+
+	for (i = 0;i < XO2_FLASH_PAGE_SIZE;++i)
+		pPage[i] = pg * XO2_FLASH_PAGE_SIZE + i + 1;
+}
+
+/* Program or check the UFM pages around the store: the 4 before it and
+   the 4 after its end.  All other pages outside it must be erased.
+*/
+static int ufm_outside(XO2Handle_t *pXO2, unsigned int firstPg, unsigned int endPg, bool write)
+{
+	unsigned int ufmPgs = XO2DevList[CHECK_DEV].UFMpages, pg;
+	unsigned char *pExpect, *pUFM;
+	int status;
+
+	pExpect = calloc(ufmPgs, XO2_FLASH_PAGE_SIZE);
+	pUFM = calloc(ufmPgs, XO2_FLASH_PAGE_SIZE);
+	if (!pExpect || !pUFM) {
+		free(pExpect);
+		free(pUFM);
+		return ERROR;
+	}
+	for (pg = 0;pg < ufmPgs;++pg) {
+		if ((pg + 4 >= firstPg && pg < firstPg) || (pg >= endPg && pg < endPg + 4))
+			fill_page(pExpect + XO2_FLASH_PAGES_LEN(pg), pg);
+	}
+
+	status = XO2ECAcmd_openCfgIF(pXO2, TRANSPARENT_MODE);
+	if (status == OK)
+		status = XO2ECAcmd_SetPage(pXO2, UFM_SECTOR, 0);
+	if (status == OK && write)
+		status = XO2ECAcmd_UFMWritePages(pXO2, ufmPgs, pExpect);
+	else if (status == OK)
+		status = XO2ECAcmd_UFMReadPages(pXO2, ufmPgs, pUFM);
+	XO2ECAcmd_closeCfgIF(pXO2);
+	XO2ECAcmd_Bypass(pXO2);
+
+	for (pg = 0;status == OK && !write && pg < ufmPgs;++pg) {
+		if ((pg < firstPg || pg >= endPg) &&
+			memcmp(pUFM + XO2_FLASH_PAGES_LEN(pg), pExpect + XO2_FLASH_PAGES_LEN(pg),
+				   XO2_FLASH_PAGE_SIZE) != 0)
+			status = ERROR;
+	}
+	free(pExpect);
+	free(pUFM);
+	return status;
+}
+
+/* Value of key, as a string, "" if not found */
+static const char *kv_get(XO2ufmkv_t *pKV, const char *key)
+{
+	static char val[XO2UFMKV_VAL_MAX + 1];
+	int len;
+
+	len = XO2ufmkv_get(pKV, key, val, XO2UFMKV_VAL_MAX);
+	val[len < 0 ? 0 : len] = '\0';
+	return val;
+}
+
+/* UFM key-value store: put, overwrite, delete, reopen, failed writes and
+   compaction when the pages are full, with the UFM pages around the store
+   kept.
+*/
+static int check_ufmkv(void)
+{
+	const unsigned int firstPg = 16, numPgs = 24;
+	char key[16], val[64];
+	XO2Handle_t xo2;
+	XO2ufmkv_t kv;
+	shim_t shim;
+	unsigned int i, head, compactions = 0;
+	int status, ret = -1;
+
+	memset(&kv, 0, sizeof(kv));
+	if (open_dev(&xo2) != OK)
+		return -1;
+	shim_attach(&shim, &xo2);
+	CHECK(ufm_outside(&xo2, firstPg, firstPg + numPgs, true) == OK);
+
+	CHECK(XO2ufmkv_open(&kv, &xo2, XO2DevList[CHECK_DEV].UFMpages - 8, 9) == ERR_XO2UFMKV_RANGE);
+	CHECK(XO2ufmkv_open(&kv, &xo2, firstPg, numPgs) == OK);
+	CHECK(kv.headPg == 0 && kv.numKeys == 0);
+
+	// One page record, then one with continuation pages
+	CHECK(XO2ufmkv_put(&kv, "a", "1", 1) == OK);
+	memset(val, 'v', 40);
+	val[40] = '\0';
+	CHECK(XO2ufmkv_put(&kv, "long", val, 40) == OK);
+	CHECK(kv.headPg == 1 + 4);
+	CHECK(strcmp(kv_get(&kv, "a"), "1") == 0);
+	CHECK(strcmp(kv_get(&kv, "long"), val) == 0);
+
+	CHECK(XO2ufmkv_put(&kv, "a", "22", 2) == OK);
+	CHECK(strcmp(kv_get(&kv, "a"), "22") == 0);
+	head = kv.headPg;
+	CHECK(XO2ufmkv_put(&kv, "a", "22", 2) == OK);
+	CHECK(kv.headPg == head);
+
+	CHECK(XO2ufmkv_delete(&kv, "long") == OK);
+	CHECK(XO2ufmkv_get(&kv, "long", val, sizeof(val)) == ERR_XO2UFMKV_NOT_FOUND);
+	CHECK(XO2ufmkv_delete(&kv, "long") == ERR_XO2UFMKV_NOT_FOUND);
+
+	// The log is found again from the UFM alone
+	head = kv.headPg;
+	XO2ufmkv_close(&kv);
+	CHECK(XO2ufmkv_open(&kv, &xo2, firstPg, numPgs) == OK);
+	CHECK(kv.headPg == head && kv.numKeys == 1);
+	CHECK(strcmp(kv_get(&kv, "a"), "22") == 0);
+	CHECK(XO2ufmkv_get(&kv, "long", val, sizeof(val)) == ERR_XO2UFMKV_NOT_FOUND);
+
+	// A write that fails after its first page leaves no gap in the log
+	shim.faultOp = 0xC9;
+	shim.faultAt = 1;
+	shim.fault = FAULT_LOST;
+	memset(val, 'w', 40);
+	CHECK(XO2ufmkv_put(&kv, "torn", val, 40) == ERROR);
+	CHECK(kv.headPg == head + 4 && !kv.broken);
+	CHECK(XO2ufmkv_put(&kv, "after", "x", 1) == OK);
+	head = kv.headPg;
+	XO2ufmkv_close(&kv);
+	CHECK(XO2ufmkv_open(&kv, &xo2, firstPg, numPgs) == OK);
+	CHECK(kv.headPg == head && kv.numKeys == 2);
+	CHECK(XO2ufmkv_get(&kv, "torn", val, sizeof(val)) == ERR_XO2UFMKV_NOT_FOUND);
+	CHECK(strcmp(kv_get(&kv, "after"), "x") == 0);
+
+	// A write that went through without its ack counts
+	shim.faultAt = shim.frames;
+	shim.faultOp = 0xC9;
+	shim.fault = FAULT_NO_ACK;
+	CHECK(XO2ufmkv_put(&kv, "after", "y", 1) == OK);
+	CHECK(strcmp(kv_get(&kv, "after"), "y") == 0);
+	XO2ufmkv_close(&kv);
+	CHECK(XO2ufmkv_open(&kv, &xo2, firstPg, numPgs) == OK);
+	CHECK(strcmp(kv_get(&kv, "after"), "y") == 0);
+
+	// Overwrite until the pages ran full several times
+	for (i = 0;i < 100;++i) {
+		snprintf(key, sizeof(key), "k%u", i % 3);
+		snprintf(val, sizeof(val), "%u", i);
+		head = kv.headPg;
+		CHECK(XO2ufmkv_put(&kv, key, val, strlen(val)) == OK);
+		if (kv.headPg < head)
+			++compactions;
+	}
+	CHECK(compactions >= 3);
+	CHECK(kv.numKeys == 5);
+
+	XO2ufmkv_close(&kv);
+	CHECK(XO2ufmkv_open(&kv, &xo2, firstPg, numPgs) == OK);
+	CHECK(kv.numKeys == 5);
+	CHECK(strcmp(kv_get(&kv, "a"), "22") == 0);
+	CHECK(strcmp(kv_get(&kv, "k0"), "99") == 0);
+	CHECK(strcmp(kv_get(&kv, "after"), "y") == 0);
+	CHECK(strcmp(kv_get(&kv, "k1"), "97") == 0);
+	CHECK(strcmp(kv_get(&kv, "k2"), "98") == 0);
+
+	// More than the pages hold, even compacted
+	memset(val, 'x', sizeof(val));
+	for (i = 0, status = OK;status == OK && i < 6;++i) {
+		snprintf(key, sizeof(key), "big%u", i);
+		status = XO2ufmkv_put(&kv, key, val, sizeof(val));
+	}
+	CHECK(status == ERR_XO2UFMKV_FULL);
+	CHECK(strcmp(kv_get(&kv, "k0"), "99") == 0);
+
+	XO2ufmkv_close(&kv);
+	CHECK(ufm_outside(&xo2, firstPg, firstPg + numPgs, false) == OK);
+	ret = 0;
+out:
+	XO2ufmkv_close(&kv);
+	shim_detach(&shim, &xo2);
+	XO2drvr_close(&xo2);
+	return ret;
+}
+
+
+//==============================================================================
+//                          R e s u m e
+//==============================================================================
+static int journal_save(void *pCtx, const XO2Checkpoint_t *pDone)
+{
+	unsigned int *pSaves = pCtx;
+
+	(void)pDone;
+	++*pSaves;
+	return OK;
+}
+
+/* Program jed with the faultAt-th frame of faultOp failing, then resume from
+   the journal.  A torn page has to be found, else the resumed run has to pass
+   its digest verify and leave the part as jed.
+*/
+static int resume_case(XO2_JEDEC_t *jed, uint8_t faultOp, unsigned int faultAt, fault_t fault)
+{
+	const int mode = XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_UFM | XO2ECA_PROGRAM_NOLOAD |
+		XO2ECA_PROGRAM_VERIFY;
+	unsigned int cfgPgs = jed->CfgDataSize / XO2_FLASH_PAGE_SIZE;
+	unsigned int ufmPgs = jed->UFMDataSize / XO2_FLASH_PAGE_SIZE, saves = 0;
+	XO2Journal_t journal = {.pCtx = &saves, .save = journal_save};
+	XO2Checkpoint_t from;
+	XO2DiffReport_t report;
+	XO2Handle_t xo2;
+	shim_t shim;
+	int ret = -1, err;
+
+	if (open_dev(&xo2) != OK)
+		return -1;
+	shim_attach(&shim, &xo2);
+	xo2.pJournal = &journal;
+
+	shim.faultOp = faultOp;
+	shim.faultAt = faultAt;
+	shim.fault = fault;
+	CHECK(XO2ECA_apiProgram(&xo2, jed, mode) < -3);
+	CHECK(shim.faultPage >= 0 && saves > 0);
+	if (faultOp == 0x70)
+		CHECK(journal.done.cfgPgs <= (unsigned int)shim.faultPage && journal.done.ufmPgs == 0);
+	else
+		CHECK(journal.done.cfgPgs == cfgPgs && journal.done.ufmPgs <= (unsigned int)shim.faultPage);
+
+	from = journal.done;
+	err = XO2ECA_apiProgramResume(&xo2, jed, mode, &from);
+	if (fault == FAULT_TORN) {
+		CHECK(err == (faultOp == 0x70 ? -17 : -27));
+		CHECK(xo2.failPage == shim.faultPage);
+	} else {
+		CHECK(err == OK);
+		CHECK(journal.done.cfgPgs == cfgPgs && journal.done.ufmPgs == ufmPgs);
+		xo2.pJournal = NULL;
+		CHECK(XO2ECA_apiJEDECdiff(&xo2, jed, XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_UFM,
+								  &report) == OK);
+	}
+	ret = 0;
+out:
+	shim_detach(&shim, &xo2);
+	XO2drvr_close(&xo2);
+	return ret;
+}
+
+/* Programming interrupted in either sector and resumed from the journal */
+static int check_resume(void)
+{
+	static const struct {
+		uint8_t faultOp;
+		unsigned int faultAt;
+		fault_t fault;
+	} cases[] = {
+		{0x70, 300, FAULT_LOST},
+		{0x70, 300, FAULT_NO_ACK},
+		{0x70, 300, FAULT_TORN},
+		{0xC9, 40, FAULT_LOST},
+		{0xC9, 40, FAULT_NO_ACK},
+		{0xC9, 40, FAULT_TORN},
+	};
+	XO2_JEDEC_t *jed;
+	unsigned int i;
+	int ret = 0;
+
+	jed = gen_jedec(0x5eed0023u);
+	if (!jed)
+		return -1;
+	for (i = 0;ret == 0 && i < sizeof(cases) / sizeof(cases[0]);++i) {
+		ret = resume_case(jed, cases[i].faultOp, cases[i].faultAt, cases[i].fault);
+		if (ret != 0)
+			fprintf(stderr, "resume case %u failed\n", i);
+	}
+	jedec_free(jed);
+	return ret;
+}
+
+
+//==============================================================================
+//                          F e a t u r e   R o w
+//==============================================================================
+/* Program jed in mode, through XO2ECA_apiProgramStart() first if early, and
+   return what it erased and whether it wrote the Feature Row, -1 on error.
+*/
+static int featrow_program(XO2Handle_t *pXO2, shim_t *s, XO2_JEDEC_t *jed, int mode, bool early)
+{
+	s->eraseFlags = 0;
+	s->frWrites = 0;
+	if (early && XO2ECA_apiProgramStart(pXO2, mode) != OK)
+		return -1;
+	if (XO2ECA_apiProgram(pXO2, jed, mode) != OK)
+		return -1;
+	return s->eraseFlags | (s->frWrites ? 0x100 : 0);
+}
+
+/* The Feature Row is only erased and written when it differs from the device */
+static int check_featrow(void)
+{
+	const int mode = XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_FEATROW | XO2ECA_PROGRAM_OFFLINE |
+		XO2ECA_PROGRAM_VERIFY;
+	const int cfgOnly = XO2ECA_CMD_ERASE_CFG, withFR = XO2ECA_CMD_ERASE_CFG | XO2ECA_CMD_ERASE_FTROW;
+	XO2_JEDEC_t *jed, changed;
+	XO2Handle_t xo2;
+	shim_t shim;
+	int ret = -1;
+
+	jed = gen_jedec(0x5eed0024u);
+	if (!jed)
+		return -1;
+	if (open_dev(&xo2) != OK) {
+		jedec_free(jed);
+		return -1;
+	}
+	shim_attach(&shim, &xo2);
+
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &jed->pFeatureRow) == XO2ECA_DIFF_FOUND);
+	CHECK(featrow_program(&xo2, &shim, jed, mode, false) == (withFR | 0x100));
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &jed->pFeatureRow) == OK);
+
+	// Same row again: left out of the erase, not written
+	CHECK(featrow_program(&xo2, &shim, jed, mode, false) == cfgOnly);
+	CHECK(featrow_program(&xo2, &shim, jed, mode, true) == cfgOnly);
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &jed->pFeatureRow) == OK);
+
+	// A different row is rewritten, also when the erase started before it was known
+	changed = *jed;
+	changed.pFeatureRow.feature[3] ^= 0x40;
+	CHECK(featrow_program(&xo2, &shim, &changed, mode, false) == (withFR | 0x100));
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &changed.pFeatureRow) == OK);
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &jed->pFeatureRow) == XO2ECA_DIFF_FOUND);
+	CHECK(featrow_program(&xo2, &shim, jed, mode, true) == (withFR | 0x100));
+	CHECK(XO2ECA_apiFeatureRowCompare(&xo2, &jed->pFeatureRow) == OK);
+	ret = 0;
+out:
+	shim_detach(&shim, &xo2);
+	XO2drvr_close(&xo2);
+	jedec_free(jed);
+	return ret;
+}
+
+
+static const struct {
+	const char *pName;
+	int (*run)(void);
+} checks[] = {
+	{"ufmkv", check_ufmkv},
+	{"resume", check_resume},
+	{"featrow", check_featrow},
+};
+
+int main(void)
+{
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0;i < sizeof(checks) / sizeof(checks[0]);++i) {
+		int ret = checks[i].run();
+
+		printf("  %-12s %s\n", checks[i].pName, ret == 0 ? "ok" : "FAIL");
+		if (ret != 0)
+			err = 1;
+	}
+	return err;
+}
@@ -14,10 +14,669 @@
  * link to the XO2.
  */
 #include <stdio.h>
+#include <string.h>
 
 #include "XO2_cmds.h"
 #include "XO2_api.h"
+#include "digest.h"
 
+static int XO2_diffPages(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, const unsigned char *pData,
+						 unsigned int dataPgs, unsigned int numPgs, int mode, XO2DiffReport_t *pReport);
+
+
+
+/* Whether page pg of pData is all 0, looked up as bit mapPg+pg of pMap or,
+   without a page map, found from the data.
+*/
+static bool XO2_zeroPage(const uint8_t *pMap, unsigned int mapPg, const unsigned char *pData,
+						 unsigned int pg)
+{
+	static const unsigned char zero[XO2_FLASH_PAGE_SIZE];
+
+	if (pMap)
+		return !(pMap[(mapPg + pg) / 8] & (1 << ((mapPg + pg) % 8)));
+	return memcmp(pData + XO2_FLASH_PAGES_LEN(pg), zero, XO2_FLASH_PAGE_SIZE) == 0;
+}
+
+/* Find the next run of pages to access from *pPg on.  Runs of at least
+   XO2ECA_CMD_SKIP_PAGES all 0 pages end a run and are jumped over, as are the
+   all 0 pages at the end.  Shorter runs of 0 pages are taken along, accessing
+   them is cheaper than the SetPage to get past them.
+   Return the number of pages, starting at the updated *pPg, 0 if only all 0
+   pages are left.
+*/
+static unsigned int XO2_nextRun(const uint8_t *pMap, unsigned int mapPg, const unsigned char *pData,
+								unsigned int numPgs, unsigned int *pPg)
+{
+	unsigned int start = *pPg, end = *pPg, zeros;
+
+	while (end < numPgs)
+	{
+		for (zeros = 0; end + zeros < numPgs && XO2_zeroPage(pMap, mapPg, pData, end + zeros); ++zeros)
+			;
+		if (end + zeros == numPgs)
+			break;
+		if (zeros >= XO2ECA_CMD_SKIP_PAGES)
+		{
+			if (end > start)
+				break;
+			start = end + zeros;
+		}
+		end += zeros;
+		while (end < numPgs && !XO2_zeroPage(pMap, mapPg, pData, end))
+			++end;
+	}
+
+	*pPg = start;
+	return(end - start);
+}
+
+/* Record in pJournal that the pages of sector below donePgs are programmed.
+   Return OK, or ERROR if the journal could not be saved.
+*/
+static int XO2_checkpoint(XO2Journal_t *pJournal, XO2SectorMode_t sector, unsigned int donePgs)
+{
+	if (sector == CFG_SECTOR)
+		pJournal->done.cfgPgs = donePgs;
+	else if (sector == UFM_SECTOR)
+		pJournal->done.ufmPgs = donePgs;
+	else
+		pJournal->done.featRow = true;
+
+	if (pJournal->save(pJournal->pCtx, &pJournal->done) != OK)
+		return(ERROR);
+	return(OK);
+}
+
+/* Program numPgs pages of a sector from pData, the first being page startPg,
+   leaving runs of all 0 pages as erased, see XO2_nextRun().  The page address
+   has to be set for the sector already, it is moved with SetPage where pages
+   are skipped.  If pJournal is set, the progress is checkpointed about every
+   XO2ECA_CMD_STATUS_INTERVAL pages, the pages before startPg must be done.
+   Return OK or ERROR.
+*/
+static int XO2_writeSparse(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, unsigned int startPg,
+						   const unsigned char *pData, unsigned int numPgs,
+						   const uint8_t *pMap, unsigned int mapPg, XO2Journal_t *pJournal)
+{
+	unsigned int pg, n, saved;
+	int status;
+
+	saved = startPg;
+	for (pg = 0; (n = XO2_nextRun(pMap, mapPg, pData, numPgs, &pg)) > 0; pg += n)
+	{
+		// Each write checks status at its end, so a chunk is confirmed when it returns
+		if (pJournal && n > XO2ECA_CMD_STATUS_INTERVAL)
+			n = XO2ECA_CMD_STATUS_INTERVAL;
+
+		if (pXO2dev->curPage != startPg + pg)
+		{
+#ifdef DEBUG_ECA
+			printf("Skip to page %d\r\n", startPg + pg + 1);
+#endif
+			status = XO2ECAcmd_SetPage(pXO2dev, sector, startPg + pg);
+			if (status != OK)
+				return(ERROR);
+		}
+
+		if (sector == CFG_SECTOR)
+			status = XO2ECAcmd_CfgWritePages(pXO2dev, n, (unsigned char *)pData + XO2_FLASH_PAGES_LEN(pg));
+		else
+			status = XO2ECAcmd_UFMWritePages(pXO2dev, n, (unsigned char *)pData + XO2_FLASH_PAGES_LEN(pg));
+		if (status != OK)
+			return(ERROR);
+
+		if (pJournal && startPg + pg + n - saved >= XO2ECA_CMD_STATUS_INTERVAL)
+		{
+			saved = startPg + pg + n;
+			if (XO2_checkpoint(pJournal, sector, saved) != OK)
+				return(ERROR);
+		}
+	}
+
+	// The all 0 pages at the end are done as well
+	if (pJournal && XO2_checkpoint(pJournal, sector, startPg + numPgs) != OK)
+		return(ERROR);
+
+	return(OK);
+}
+
+/* Read back the pages XO2_writeSparse() programmed from page 0 on and compare
+   them with pData.  The page address has to be reset for the sector already.
+   Return OK, ERROR if reading failed or XO2ECA_DIFF_FOUND on a mismatch.
+*/
+static int XO2_verifySparse(XO2Handle_t *pXO2dev, XO2SectorMode_t sector,
+							const unsigned char *pData, unsigned int numPgs,
+							const uint8_t *pMap, unsigned int mapPg)
+{
+	unsigned char buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned int pg, end, n;
+	int status;
+
+	for (pg = 0; (end = XO2_nextRun(pMap, mapPg, pData, numPgs, &pg)) > 0; )
+	{
+		end += pg;
+		if (pXO2dev->curPage != pg)
+		{
+			status = XO2ECAcmd_SetPage(pXO2dev, sector, pg);
+			if (status != OK)
+				return(ERROR);
+		}
+
+		for (; pg < end; pg += n)
+		{
+			n = end - pg;
+			if (n > XO2ECA_CMD_READ_BURST)
+				n = XO2ECA_CMD_READ_BURST;
+
+#ifdef DEBUG_ECA
+			printf("Verify %sPage: %d-%d\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM", pg + 1, pg + n);
+#endif
+
+			// Read back the programmed pages in one burst
+			if (sector == CFG_SECTOR)
+				status = XO2ECAcmd_CfgReadPages(pXO2dev, n, buf);
+			else
+				status = XO2ECAcmd_UFMReadPages(pXO2dev, n, buf);
+			if (status != OK)
+				return(ERROR);
+
+			if (memcmp(buf, pData + XO2_FLASH_PAGES_LEN(pg), XO2_FLASH_PAGES_LEN(n)) != 0)
+				return(XO2ECA_DIFF_FOUND);
+		}
+	}
+
+	return(OK);
+}
+
+/* Feed numPgs erased pages into a CRC32C */
+static uint32_t XO2_digestErased(uint32_t crc, unsigned int numPgs)
+{
+	static const unsigned char zero[XO2_FLASH_PAGES_LEN(16)];
+	unsigned int n;
+
+	for (; numPgs > 0; numPgs -= n)
+	{
+		n = (numPgs > 16) ? 16 : numPgs;
+		crc = digest_crc32c(crc, zero, XO2_FLASH_PAGES_LEN(n));
+	}
+	return(crc);
+}
+
+/* Read back pages 0 to numPgs of a sector in bursts and compare their CRC32C
+   with digest, without keeping them.  If pMap or pData are set, the runs of 0
+   pages XO2_writeSparse() left as erased are not read but digested as 0, else
+   all pages are read.  The page address has to be reset for the sector already.
+   Return OK, ERROR if reading failed or XO2ECA_DIFF_FOUND on a mismatch.
+*/
+static int XO2_verifyDigest(XO2Handle_t *pXO2dev, XO2SectorMode_t sector,
+							const unsigned char *pData, unsigned int numPgs,
+							const uint8_t *pMap, unsigned int mapPg, uint32_t digest)
+{
+	unsigned char buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned int pg, start, end, n;
+	uint32_t crc = 0;
+	int status;
+
+	for (pg = 0; ; pg = end)
+	{
+		start = pg;
+		if (pMap || pData)
+			end = XO2_nextRun(pMap, mapPg, pData, numPgs, &pg);
+		else
+			end = numPgs - pg;
+		crc = XO2_digestErased(crc, pg - start);
+		if (end == 0)
+			break;
+		end += pg;
+
+		if (pXO2dev->curPage != pg)
+		{
+			status = XO2ECAcmd_SetPage(pXO2dev, sector, pg);
+			if (status != OK)
+				return(ERROR);
+		}
+
+		for (; pg < end; pg += n)
+		{
+			n = end - pg;
+			if (n > XO2ECA_CMD_READ_BURST)
+				n = XO2ECA_CMD_READ_BURST;
+
+			if (sector == CFG_SECTOR)
+				status = XO2ECAcmd_CfgReadPages(pXO2dev, n, buf);
+			else
+				status = XO2ECAcmd_UFMReadPages(pXO2dev, n, buf);
+			if (status != OK)
+				return(ERROR);
+			crc = digest_crc32c(crc, buf, XO2_FLASH_PAGES_LEN(n));
+		}
+	}
+	crc = XO2_digestErased(crc, numPgs - pg);
+
+#ifdef DEBUG_ECA
+	printf("Verify %s digest: 0x%08x, expected 0x%08x\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM",
+		   crc, digest);
+#endif
+	return((crc == digest) ? OK : XO2ECA_DIFF_FOUND);
+}
+
+/* Verify a programmed sector: by digest if pProgJED has them, by comparing the
+   pages else.  On a digest mismatch the sector is diffed page by page to set
+   XO2Handle_t.failPage to the first page that differs.
+   Return as XO2_verifyDigest().
+*/
+static int XO2_verifySector(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, XO2_JEDEC_t *pProgJED,
+							const unsigned char *pData, unsigned int numPgs, unsigned int mapPg)
+{
+	XO2DiffReport_t report;
+	int status;
+
+	pXO2dev->failPage = -1;
+	if (!pProgJED->digestValid)
+		return(XO2_verifySparse(pXO2dev, sector, pData, numPgs, pProgJED->pPageMap, mapPg));
+
+	status = XO2_verifyDigest(pXO2dev, sector, pData, numPgs, pProgJED->pPageMap, mapPg,
+							  (sector == CFG_SECTOR) ? pProgJED->CfgDigest : pProgJED->UFMDigest);
+	if (status != XO2ECA_DIFF_FOUND || !pData)
+		return(status);
+
+	memset(&report, 0, sizeof(report));
+	if (XO2_diffPages(pXO2dev, sector, pData, numPgs, numPgs, XO2ECA_DIFF_FIRST, &report) > 0)
+		pXO2dev->failPage = report.ranges[0].startPg;
+#ifdef DEBUG_ECA
+	printf("Verify %s ERR, first differing page %d\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM",
+		   pXO2dev->failPage);
+#endif
+	return(XO2ECA_DIFF_FOUND);
+}
+
+/* Compare the Feature Row of the device with pFeatureRow.
+   Return OK if they match, XO2ECA_DIFF_FOUND if not or ERROR if reading failed.
+*/
+static int XO2_diffFeatureRow(XO2Handle_t *pXO2dev, const XO2FeatureRow_t *pFeatureRow)
+{
+	XO2FeatureRow_t featRow;
+
+	if (XO2ECAcmd_FeatureRowRead(pXO2dev, &featRow) != OK)
+		return(ERROR);
+
+	if (memcmp(featRow.feature, pFeatureRow->feature, sizeof(featRow.feature)) != 0 ||
+		memcmp(featRow.feabits, pFeatureRow->feabits, sizeof(featRow.feabits)) != 0)
+		return(XO2ECA_DIFF_FOUND);
+	return(OK);
+}
+
+/* Program the Feature Row and, if mode has XO2ECA_PROGRAM_VERIFY, read it back.
+   Return OK or the XO2ECA_apiProgram() error code.
+*/
+static int XO2_programFeatureRow(XO2Handle_t *pXO2dev, XO2FeatureRow_t *pFeatureRow, int mode)
+{
+	XO2FeatureRow_t featRow;
+	unsigned int i;
+	int status;
+
+#ifdef DEBUG_ECA
+	printf("Feature Row Program/Verify\r\n");
+#endif
+
+	status = XO2ECAcmd_FeatureRowWrite(pXO2dev, pFeatureRow);
+	if (status != OK)
+		return(-31);
+
+
+	if (mode &  XO2ECA_PROGRAM_VERIFY)
+	{
+
+		status = XO2ECAcmd_FeatureRowRead(pXO2dev, &featRow);
+
+#ifdef DEBUG_ECA
+		printf("Feature Contents: %x %x %x %x %x %x %x %x\r\n", featRow.feature[0],
+		featRow.feature[1],featRow.feature[2],featRow.feature[3],featRow.feature[4],featRow.feature[5],
+		featRow.feature[6],featRow.feature[7]);
+		printf("FEABITS: %x %x\r\n", featRow.feabits[0], featRow.feabits[1]);
+#endif
+
+		for (i = 0; i < 8; i++)
+		{
+			if (featRow.feature[i] != pFeatureRow->feature[i])
+			{
+#ifdef DEBUG_ECA
+				printf("FeatureRow Verify ERR @ feature[%d]\r\n", i);
+#endif
+				return(-32);
+			}
+		}
+		for (i = 0; i < 2; i++)
+		{
+			if (featRow.feabits[i] != pFeatureRow->feabits[i])
+			{
+#ifdef DEBUG_ECA
+				printf("FeatureRow Verify ERR @ feabits[%d]\r\n", i);
+#endif
+				return(-33);
+			}
+		}
+
+	}
+
+	return(OK);
+}
+
+
+/* Bring the Feature Row to pFeatureRow.  If the erase of the sectors did not
+   include it, i.e. it was not known yet, it is compared first and only erased
+   and programmed if it differs.
+   Return OK or the XO2ECA_apiProgram() error code.
+*/
+static int XO2_updateFeatureRow(XO2Handle_t *pXO2dev, XO2FeatureRow_t *pFeatureRow, int mode, bool erased)
+{
+	int status;
+
+	if (!erased)
+	{
+		status = XO2_diffFeatureRow(pXO2dev, pFeatureRow);
+		if (status == OK)
+			return(OK);  // unchanged
+		if (status != XO2ECA_DIFF_FOUND)
+			return(-34);
+		if (XO2ECAcmd_FeatureRowErase(pXO2dev) != OK)
+			return(-30);
+	}
+
+	return(XO2_programFeatureRow(pXO2dev, pFeatureRow, mode));
+}
+
+
+/* Open the configuration interface for mode and start the erase, unless
+   XO2ECA_apiProgramStart() already did.  Clears the Feature Row bit of *pMode
+   in Transparent mode.  With the Feature Row to program at hand in
+   pFeatureRow, the device's is read first and if it matches the bit is
+   cleared as well, nothing is erased or programmed for it.  Without, it is
+   left out of the erase for XO2_updateFeatureRow() to decide once known.
+   Return OK, -1 if the interface could not be opened or -2 if the Feature
+   Row could not be read or the erase could not be started, the interface is
+   closed again then.
+*/
+static int XO2_startProgram(XO2Handle_t *pXO2dev, int *pMode, const XO2FeatureRow_t *pFeatureRow)
+{
+	int status, erase;
+
+	if (*pMode & XO2ECA_PROGRAM_TRANSPARENT)
+	{
+		// Prevent erasing the Feature Row in Transparent mode.  The user logic is running and
+		// operating per the settings of the current Feature Row.  Erasing it can lead to
+		// instability in the running design.  Use Offline mode (design halted) when re-
+		// programming Feature Row (changing device behavior).
+		*pMode = *pMode &  ~XO2ECA_ERASE_PROG_FEATROW;
+	}
+
+	if (pXO2dev->eraseMode)
+		return(OK);  // started by XO2ECA_apiProgramStart()
+
+	if (*pMode & XO2ECA_PROGRAM_TRANSPARENT)
+		status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+	else
+		status = XO2ECAcmd_openCfgIF(pXO2dev, OFFLINE_MODE);
+
+	if (status != OK)
+		return(-1);	// Error. Could not open XO2 configuration
+
+	erase = *pMode & (XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_UFM | XO2ECA_ERASE_PROG_FEATROW | XO2ECA_ERASE_SRAM);
+	status = OK;
+	if ((erase & XO2ECA_ERASE_PROG_FEATROW) && pFeatureRow)
+	{
+		// Mostly unchanged from one design version to the next, spare it the erase
+		status = XO2_diffFeatureRow(pXO2dev, pFeatureRow);
+		if (status == OK)
+		{
+#ifdef DEBUG_ECA
+			printf("Feature Row unchanged\r\n");
+#endif
+			*pMode = *pMode &  ~XO2ECA_ERASE_PROG_FEATROW;
+			erase = erase &  ~XO2ECA_ERASE_PROG_FEATROW;
+		}
+		else if (status == XO2ECA_DIFF_FOUND)
+		{
+			status = OK;
+		}
+	}
+	else if (erase & XO2ECA_ERASE_PROG_FEATROW)
+	{
+		erase = erase &  ~XO2ECA_ERASE_PROG_FEATROW;
+	}
+
+	if (status == OK && erase)
+		status = XO2ECAcmd_EraseFlashStart(pXO2dev, erase);
+	if (status != OK)
+	{
+		XO2ECAcmd_closeCfgIF(pXO2dev);
+		XO2ECAcmd_Bypass(pXO2dev);
+		return(-2);
+	}
+
+	return(OK);
+}
+
+
+/* Program the pages of a sector of pProgJED from startPg on, leaving all 0
+   pages as erased, and with XO2ECA_PROGRAM_VERIFY verify the whole sector.
+   The pages before startPg have to be programmed already.  Progress goes to
+   XO2Handle_t.pJournal if set.
+   Return OK or the XO2ECA_apiProgram() error code of the sector.
+*/
+static int XO2_programSector(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, XO2_JEDEC_t *pProgJED,
+							 int mode, unsigned int startPg)
+{
+	unsigned char *pData;
+	unsigned int numPgs, mapPg;
+	int status, err;
+
+	err = (sector == CFG_SECTOR) ? -10 : -20;  // -1x Cfg, -2x UFM
+	if (sector == CFG_SECTOR)
+	{
+		pData = pProgJED->pCfgData;
+		numPgs = pProgJED->CfgDataSize / XO2_FLASH_PAGE_SIZE;
+		mapPg = 0;
+	}
+	else
+	{
+		pData = pProgJED->pUFMData;
+		numPgs = pProgJED->UFMDataSize / XO2_FLASH_PAGE_SIZE;
+		mapPg = pProgJED->pCfgData ? pProgJED->CfgDataSize / XO2_FLASH_PAGE_SIZE : 0;  // UFM bits of pPageMap follow
+	}
+	if (startPg > numPgs)
+		startPg = numPgs;
+
+#ifdef DEBUG_ECA
+	printf("%s Sector Program/Verify from page %d\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM", startPg + 1);
+#endif
+
+	status = (sector == CFG_SECTOR) ? XO2ECAcmd_CfgResetAddr(pXO2dev) : XO2ECAcmd_UFMResetAddr(pXO2dev);
+	if (status != OK)
+		return(err - 1);
+
+	// All 0 pages are left as erased
+	status = XO2_writeSparse(pXO2dev, sector, startPg, pData + XO2_FLASH_PAGES_LEN(startPg), numPgs - startPg,
+							 pProgJED->pPageMap, mapPg + startPg, pXO2dev->pJournal);
+	if (status != OK)
+	{
+#ifdef DEBUG_ECA
+		printf("WritePages ERR, page %d\r\n", pXO2dev->failPage);
+#endif
+		return(err - 2);
+	}
+
+
+	if (mode &  XO2ECA_PROGRAM_VERIFY)
+	{
+		// If verify then read back and make sure each page read back matches what is in JEDEC data struct
+		status = (sector == CFG_SECTOR) ? XO2ECAcmd_CfgResetAddr(pXO2dev) : XO2ECAcmd_UFMResetAddr(pXO2dev);
+		if (status != OK)
+			return(err - 3);
+
+		// Skip the same pages, they have just been erased
+		status = XO2_verifySector(pXO2dev, sector, pProgJED, pData, numPgs, mapPg);
+		if (status != OK)
+		{
+#ifdef DEBUG_ECA
+			printf("Verify Pages ERR\r\n");
+#endif
+			return((status == XO2ECA_DIFF_FOUND) ? err - 5 : err - 4);
+		}
+	}
+
+	return(OK);
+}
+
+/* Find where to resume programming a sector whose pages below fromPg are
+   known to be programmed.  Pages from there on that already read as in pData
+   are taken as programmed too, from the first one that does not on all pages
+   have to read as erased.
+   Return OK with *pStartPg set, ERROR if reading failed or XO2ECA_DIFF_FOUND
+   if a page is neither erased nor as in pData, it is left in failPage.
+*/
+static int XO2_resumePoint(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, const unsigned char *pData,
+						   unsigned int numPgs, unsigned int fromPg, unsigned int *pStartPg)
+{
+	static const unsigned char zero[XO2_FLASH_PAGE_SIZE];
+	unsigned char buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned int pg, i, n;
+	bool programmed = true;
+	int status;
+
+	*pStartPg = numPgs;
+	if (fromPg >= numPgs)
+		return(OK);
+
+	if (fromPg == 0)
+		status = (sector == CFG_SECTOR) ? XO2ECAcmd_CfgResetAddr(pXO2dev) : XO2ECAcmd_UFMResetAddr(pXO2dev);
+	else
+		status = XO2ECAcmd_SetPage(pXO2dev, sector, fromPg);
+	if (status != OK)
+		return(ERROR);
+
+	for (pg = fromPg; pg < numPgs; pg += n)
+	{
+		n = numPgs - pg;
+		if (n > XO2ECA_CMD_READ_BURST)
+			n = XO2ECA_CMD_READ_BURST;
+
+		if (sector == CFG_SECTOR)
+			status = XO2ECAcmd_CfgReadPages(pXO2dev, n, buf);
+		else
+			status = XO2ECAcmd_UFMReadPages(pXO2dev, n, buf);
+		if (status != OK)
+			return(ERROR);
+
+		for (i = 0; i < n; ++i)
+		{
+			if (programmed && memcmp(buf + XO2_FLASH_PAGES_LEN(i), pData + XO2_FLASH_PAGES_LEN(pg + i),
+									 XO2_FLASH_PAGE_SIZE) == 0)
+				continue;
+			if (programmed)
+			{
+				programmed = false;
+				*pStartPg = pg + i;
+			}
+			if (memcmp(buf + XO2_FLASH_PAGES_LEN(i), zero, XO2_FLASH_PAGE_SIZE) != 0)
+			{
+#ifdef DEBUG_ECA
+				printf("Resume: %s page %d not erased\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM", pg + i + 1);
+#endif
+				pXO2dev->failPage = pg + i;
+				return(XO2ECA_DIFF_FOUND);
+			}
+		}
+	}
+
+	return(OK);
+}
+
+
+/* Set DONE, then close the configuration interface or refresh to boot the new
+   design, as selected by mode.
+   Return OK or the XO2ECA_apiProgram() error code.  On -40 the interface is
+   still open.
+*/
+static int XO2_finishProgram(XO2Handle_t *pXO2dev, int mode)
+{
+	unsigned int i;
+	int status;
+
+	// Set DONE bit indicating valid design loaded into flash
+	status = XO2ECAcmd_setDone(pXO2dev);
+	if (status != OK)
+		return(-40);
+
+	if ((mode & XO2ECA_PROGRAM_NOLOAD) == XO2ECA_PROGRAM_NOLOAD)
+	{
+		status = XO2ECAcmd_closeCfgIF(pXO2dev);
+		if (status != OK)
+		{
+			return -41;
+		}
+		return(OK);
+	}
+	else
+	{
+		// Boot design to user mode (i.e. like hitting PROGRAM pin)
+		// Refresh command will clear SRAM, load from Flash, set Done, exit config mode.
+		// Refresh polls until user mode, so it only fails on FAIL or a timeout.
+		// Sometimes the part needs another Refresh after that.
+		i = XO2ECA_REFRESH_TRIES;
+		while (i && (XO2ECAcmd_Refresh(pXO2dev) != OK))
+		{
+			--i;
+		}
+	}
+
+	if (i)
+		return(OK);  // Done got set before timeout
+	else
+		return(-42);  // failed exiting config mode and/or refreshing
+}
+
+
+
+/**
+ * Open the configuration interface and start erasing the sectors selected in
+ * mode, without waiting for the erase to finish.  The host can load and check
+ * the bitstream meanwhile.  XO2ECA_apiProgram() or XO2ECA_apiProgramStream()
+ * called next with the same mode skip opening and erasing and only wait for
+ * what is left of the erase time before the first page write, or
+ * XO2ECA_apiProgramAbort() gives up.  No other call may access the XO2 in
+ * between.  The Feature Row is not known yet and not erased here, it is
+ * compared and only if it differs updated after the sectors are programmed.
+ *
+ * @param pXO2dev reference to the XO2 device to access
+ * @param mode bitmap of what to erase/program, see XO2ECA_apiProgram()
+ * @return OK, -1 if the configuration interface could not be opened or -2 if
+ * the erase could not be started
+ */
+int XO2ECA_apiProgramStart(XO2Handle_t *pXO2dev, int mode)
+{
+	return(XO2_startProgram(pXO2dev, &mode, NULL));
+}
+
+
+/**
+ * Give up programming after XO2ECA_apiProgramStart(), e.g. because the bitstream
+ * turned out to be invalid.  Waits for the erase to finish and closes the
+ * configuration interface without setting DONE, the erased sectors stay blank.
+ *
+ * @param pXO2dev reference to the XO2 device to access
+ * @return OK, ERROR if the erase failed
+ */
+int XO2ECA_apiProgramAbort(XO2Handle_t *pXO2dev)
+{
+	int status;
+
+	status = XO2ECAcmd_EraseFlashWait(pXO2dev);
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+	return(status);
+}
 
 
 /**
@@ -41,43 +700,45 @@
  * <LI> Transparent - use to update UFM and/or Cfg sectors of a working design.
  *		Feature row should not be erased in Transparent mode.
  * </UL>
+ * The Feature Row is read before erasing and left alone if it already matches
+ * pProgJED->pFeatureRow, see XO2ECA_apiFeatureRowCompare().  If the erase was
+ * started by XO2ECA_apiProgramStart() it is compared after the sectors instead
+ * and only then erased (-30 if that fails) and programmed if it differs, -34
+ * if it could not be read.
+ * <p>
+ * Erased pages read as 0, so runs of all 0 pages are neither written nor read
+ * back, the page address is moved past them with SetPage.  They are taken from
+ * pProgJED->pPageMap if set, else found from the data.
+ * <p>
+ * With XO2ECA_PROGRAM_VERIFY the programmed pages are read back in bursts into
+ * a CRC32C that is compared with pProgJED->CfgDigest/UFMDigest.  Only if they
+ * differ the sector is compared page by page, XO2Handle_t.failPage is set to
+ * the first differing page.  Without digests the pages are compared directly.
+ * <p>
+ * With XO2Handle_t.pJournal set the progress is recorded as programming goes
+ * on, -3 is returned if it could not be saved.
+ *
  * @param pXO2dev reference to the XO2 device to access and program
  * @param pProgJED reference to the converted XO2 JEDEC file data
  * @param mode bitmap of what to erase/program and whether to verify or not
  *
  * @note If programming fails, an attempt is made to close confgiuration mode.
  * The user may wish to retry or erase the Cfg and UFM flash sectors
- * in an attempt to return the device to a blank state.
+ * in an attempt to return the device to a blank state, or with a journal
+ * continue with XO2ECA_apiProgramResume().
  * @see XO2ECA_apiClearXO2()
  *
  */
 int XO2ECA_apiProgram(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode)
 {
 	int status, ret;
-	unsigned int	i, j;
-	unsigned char *p;
-	unsigned char buf[XO2_FLASH_PAGE_SIZE];
-	int numPgs;
-	XO2FeatureRow_t featRow;
+	bool featErased;
 
 	ret = -99;  // initialize to unknown error value
-	if (mode & XO2ECA_PROGRAM_TRANSPARENT)
-	{
-		status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
-
-		// Prevent erasing the Feature Row in Transparent mode.  The user logic is running and
-		// operating per the settings of the current Feature Row.  Erasing it can lead to
-		// instability in the running design.  Use Offline mode (design halted) when re-
-		// programming Feature Row (changing device behavior).
-		mode = mode &  ~XO2ECA_ERASE_PROG_FEATROW;
-	}
-	else
-	{
-		status = XO2ECAcmd_openCfgIF(pXO2dev, OFFLINE_MODE);
-	}
-
+	status = XO2_startProgram(pXO2dev, &mode, &pProgJED->pFeatureRow);
 	if (status != OK)
-		return(-1);	// Error. Could not open XO2 configuration
+		return(status);
+	featErased = (pXO2dev->eraseMode & XO2ECA_ERASE_PROG_FEATROW) != 0;
 
 
 
@@ -88,14 +749,23 @@ int XO2ECA_apiProgram(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode)
 	//=======================================================================================
 	//=======================================================================================
 	//=======================================================================================
-	status = XO2ECAcmd_EraseFlash(pXO2dev, mode);
+	status = XO2ECAcmd_EraseFlashWait(pXO2dev);
 	if (status != OK)
 	{
 		ret = -2;
 		goto PROG_ABORT;
 	}
 
-
+	if (pXO2dev->pJournal)
+	{
+		// Erased, nothing programmed yet
+		memset(&pXO2dev->pJournal->done, 0, sizeof(pXO2dev->pJournal->done));
+		if (pXO2dev->pJournal->save(pXO2dev->pJournal->pCtx, &pXO2dev->pJournal->done) != OK)
+		{
+			ret = -3;
+			goto PROG_ABORT;
+		}
+	}
 
 
 	//=======================================================================================
@@ -107,281 +777,328 @@ int XO2ECA_apiProgram(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode)
 	//=======================================================================================
 	if (mode & XO2ECA_ERASE_PROG_CFG)
 	{
-#ifdef DEBUG_ECA
-		printf("Cfg Sector Program/Verify\r\n");
-#endif
-
-		status = XO2ECAcmd_CfgResetAddr(pXO2dev);
-		if (status != OK)
-		{
-			ret = -11;
+		ret = XO2_programSector(pXO2dev, CFG_SECTOR, pProgJED, mode, 0);
+		if (ret != OK)
 			goto PROG_ABORT;
-		}
-
-		numPgs = (pProgJED->CfgDataSize) / XO2_FLASH_PAGE_SIZE;
-
-		p = pProgJED->pCfgData;
-		for (j = 0; j < numPgs; ++j)
-		{
-#ifdef DEBUG_ECA
-			printf("Cfg page: %d\r\n", j+1);
-#endif
-			status = XO2ECAcmd_CfgWritePage(pXO2dev, p);
-
-			if (status != OK)
-			{
-				ret = -12;
-				goto PROG_ABORT;
-			}
-			p = p + XO2_FLASH_PAGE_SIZE; // next page
-		}
+	}
 
+	//=======================================================================================
+	//=======================================================================================
+	//=======================================================================================
+	//               PROGRAM/VERIFY      UFM SECTOR
+	//=======================================================================================
+	//=======================================================================================
+	//=======================================================================================
+	if (mode & XO2ECA_ERASE_PROG_UFM)
+	{
+		ret = XO2_programSector(pXO2dev, UFM_SECTOR, pProgJED, mode, 0);
+		if (ret != OK)
+			goto PROG_ABORT;
+	}
 
-		if (mode &  XO2ECA_PROGRAM_VERIFY)
-		{
-			// If verify then read back and make sure each page read back matches what is in JEDEC data struct
-			status = XO2ECAcmd_CfgResetAddr(pXO2dev);
-			if (status != OK)
-			{
-				ret = -13;
-				goto PROG_ABORT;
-			}
 
-			p = pProgJED->pCfgData;  // reset back to beginning of Cfg data
+	//=======================================================================================
+	//=======================================================================================
+	//=======================================================================================
+	//               PROGRAM/VERIFY      FEATURE ROW
+	//=======================================================================================
+	//=======================================================================================
+	//=======================================================================================
 
-			for (i = 0; i < numPgs; i++)
-			{
-#ifdef DEBUG_ECA
-				printf("Verify CfgPage: %d\r\n", i + 1);
-#endif
+	if (mode & XO2ECA_ERASE_PROG_FEATROW)
+	{
+		ret = XO2_updateFeatureRow(pXO2dev, &pProgJED->pFeatureRow, mode, featErased);
+		if (ret == OK && pXO2dev->pJournal && XO2_checkpoint(pXO2dev->pJournal, FEATURE_ROW, 1) != OK)
+			ret = -3;
+		if (ret != OK)
+			goto PROG_ABORT;
+	}
 
-				// Read back the programmed page
-				status = XO2ECAcmd_CfgReadPage(pXO2dev, buf);
-				if (status != OK)
-				{
-#ifdef DEBUG_ECA
-					printf("CfgReadPage(%d) ERR\r\n", i + 1);
-#endif
-					ret = -14;
-					goto PROG_ABORT;
-				}
-
-				for (j = 0; j < XO2_FLASH_PAGE_SIZE; j++)
-				{
-					if (buf[j] != p[j])
-					{
-#ifdef DEBUG_ECA
-						printf("Verify CfgPage(%d) ERR\r\n", i + 1);
-#endif
-						ret = -15;
-						goto PROG_ABORT;
-					}
-				}
-				p = p + XO2_FLASH_PAGE_SIZE;  // point to next page of cfg data for checking
-			}
-		}
 
-	}
 
 	//=======================================================================================
 	//=======================================================================================
 	//=======================================================================================
-	//               PROGRAM/VERIFY      UFM SECTOR
+	//               FINALIZE and CLOSE CONFIG INTERFACE
 	//=======================================================================================
 	//=======================================================================================
 	//=======================================================================================
-	if (mode & XO2ECA_ERASE_PROG_UFM)
-	{
-#ifdef DEBUG_ECA
-		printf("UFM Sector Program/Verify\r\n");
-#endif
 
-		status = XO2ECAcmd_UFMResetAddr(pXO2dev);
-		if (status != OK)
-		{
-			ret = -21;
-			goto PROG_ABORT;
-		}
+	ret = XO2_finishProgram(pXO2dev, mode);
+	if (ret == -40)
+		goto PROG_ABORT;
+	return(ret);
 
-		numPgs = (pProgJED->UFMDataSize) / XO2_FLASH_PAGE_SIZE;
 
-		p = pProgJED->pUFMData;
-		for (j = 0; j < numPgs; ++j)
-		{
-#ifdef DEBUG_ECA
-			printf("UFM page: %d\r\n", j+1);
-#endif
-			status = XO2ECAcmd_UFMWritePage(pXO2dev, p);
-			if (status != OK)
-			{
-				ret = -22;
-				goto PROG_ABORT;
-			}
 
-			p = p + XO2_FLASH_PAGE_SIZE; // next page
-		}
+	// This is clean-up from aborting.  Close, but don't set done or refresh
+	// User may wish to erase sectors they attempted to program and/or
+	// put part into a blank state.
+	// See XO2ECA_apiClearXO2() for clearing XO2 to a blank state.
+PROG_ABORT:
+	XO2ECAcmd_EraseFlashWait(pXO2dev);  // in case it is still running
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+	return(ret);
+}
 
 
-		if (mode &  XO2ECA_PROGRAM_VERIFY)
-		{
-			// If verify then read back and make sure each page read back matches what is in JEDEC data struct
-			status = XO2ECAcmd_UFMResetAddr(pXO2dev);
-			if (status != OK)
-			{
-				ret = -23;
-				goto PROG_ABORT;
-			}
+/**
+ * Continue an XO2ECA_apiProgram() run that was interrupted, e.g. by a glitch on
+ * the bus, without erasing again.  pFrom is the progress its journal recorded
+ * last, see XO2Handle_t.pJournal.  The pages after it in each sector are read:
+ * those already as in pProgJED are kept, from the first one that differs on
+ * all have to read as erased.  Programming picks up there, the verify and the
+ * Feature Row, unless done, follow as in XO2ECA_apiProgram().  The journal, if
+ * set, goes on recording.
+ *
+ * @param pXO2dev reference to the XO2 device to access and program
+ * @param pProgJED the same JEDEC data the interrupted run programmed
+ * @param mode the same mode the interrupted run was given
+ * @param pFrom progress of the interrupted run
+ * @return OK, an XO2ECA_apiProgram() error code, -16/-26 if the rest of the
+ * Cfg/UFM sector could not be read or -17/-27 if it holds pages neither erased
+ * nor as in pProgJED, failPage is set to the first, a full erase is needed then.
+ */
+int XO2ECA_apiProgramResume(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode,
+							const XO2Checkpoint_t *pFrom)
+{
+	unsigned int cfgPg, ufmPg;
+	int status, ret;
 
+	if (mode & XO2ECA_PROGRAM_TRANSPARENT)
+	{
+		status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+		mode = mode &  ~XO2ECA_ERASE_PROG_FEATROW;  // see XO2ECA_apiProgram()
+	}
+	else
+	{
+		status = XO2ECAcmd_openCfgIF(pXO2dev, OFFLINE_MODE);
+	}
 
-			p = pProgJED->pUFMData;  // reset back to beginning of UFM data
+	if (status != OK)
+		return(-1);	// Error. Could not open XO2 configuration
 
-			for (i = 0; i < numPgs; i++)
-			{
-#ifdef DEBUG_ECA
-				printf("Verify UFMPage: %d\r\n", i + 1);
-#endif
+	if (pXO2dev->pJournal)
+		pXO2dev->pJournal->done = *pFrom;
+
+	// Check all sectors before writing anything
+	pXO2dev->failPage = -1;
+	cfgPg = ufmPg = 0;
+	if (mode & XO2ECA_ERASE_PROG_CFG)
+	{
+		status = XO2_resumePoint(pXO2dev, CFG_SECTOR, pProgJED->pCfgData,
+								 pProgJED->CfgDataSize / XO2_FLASH_PAGE_SIZE, pFrom->cfgPgs, &cfgPg);
+		if (status != OK)
+		{
+			ret = (status == XO2ECA_DIFF_FOUND) ? -17 : -16;
+			goto RESUME_ABORT;
+		}
+	}
+	if (mode & XO2ECA_ERASE_PROG_UFM)
+	{
+		status = XO2_resumePoint(pXO2dev, UFM_SECTOR, pProgJED->pUFMData,
+								 pProgJED->UFMDataSize / XO2_FLASH_PAGE_SIZE, pFrom->ufmPgs, &ufmPg);
+		if (status != OK)
+		{
+			ret = (status == XO2ECA_DIFF_FOUND) ? -27 : -26;
+			goto RESUME_ABORT;
+		}
+	}
 
-				// Readback the programmed page
-				status = XO2ECAcmd_UFMReadPage(pXO2dev, buf);
-				if (status != OK)
-				{
-#ifdef DEBUG_ECA
-					printf("UFMReadPage(%d) ERR\r\n", i + 1);
-#endif
-					ret = -24;
-					goto PROG_ABORT;
-				}
-
-				for (j = 0; j < XO2_FLASH_PAGE_SIZE; j++)
-				{
-					if (buf[j] != p[j])
-					{
 #ifdef DEBUG_ECA
-						printf("Verify UFMPage(%d) ERR\r\n", i + 1);
+	printf("Resume at Cfg page %d, UFM page %d\r\n", cfgPg + 1, ufmPg + 1);
 #endif
-						ret = -25;
-						goto PROG_ABORT;
-					}
-				}
-				p = p + XO2_FLASH_PAGE_SIZE;  // point to next page of UFM data for checking
-			}
 
-		}
+	if (mode & XO2ECA_ERASE_PROG_CFG)
+	{
+		ret = XO2_programSector(pXO2dev, CFG_SECTOR, pProgJED, mode, cfgPg);
+		if (ret != OK)
+			goto RESUME_ABORT;
+	}
 
+	if (mode & XO2ECA_ERASE_PROG_UFM)
+	{
+		ret = XO2_programSector(pXO2dev, UFM_SECTOR, pProgJED, mode, ufmPg);
+		if (ret != OK)
+			goto RESUME_ABORT;
 	}
 
+	if ((mode & XO2ECA_ERASE_PROG_FEATROW) && !pFrom->featRow)
+	{
+		ret = XO2_updateFeatureRow(pXO2dev, &pProgJED->pFeatureRow, mode, false);
+		if (ret == OK && pXO2dev->pJournal && XO2_checkpoint(pXO2dev->pJournal, FEATURE_ROW, 1) != OK)
+			ret = -3;
+		if (ret != OK)
+			goto RESUME_ABORT;
+	}
 
-	//=======================================================================================
-	//=======================================================================================
-	//=======================================================================================
-	//               PROGRAM/VERIFY      FEATURE ROW
-	//=======================================================================================
-	//=======================================================================================
-	//=======================================================================================
+	ret = XO2_finishProgram(pXO2dev, mode);
+	if (ret == -40)
+		goto RESUME_ABORT;
+	return(ret);
 
-	if (mode & XO2ECA_ERASE_PROG_FEATROW)
-	{
-#ifdef DEBUG_ECA
-		printf("Feature Row Program/Verify\r\n");
-#endif
+RESUME_ABORT:
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+	return(ret);
+}
 
-		status = XO2ECAcmd_FeatureRowWrite(pXO2dev, &pProgJED->pFeatureRow);
-		if (status != OK)
-		{
-			ret = -31;
-			goto PROG_ABORT;
-		}
 
+/**
+ * Erase and Program the Config, UFM and/or FeatureRow sectors of the XO2 Flash with
+ * pages as they become available, e.g. while the JEDEC file is still being parsed.
+ * The erase is started first and only waited for before the first page write,
+ * so the source has the whole erase time to get ahead.
+ * The Feature Row is only known at the end, it is compared with the device's
+ * then and only erased and programmed if it differs.
+ * Pages of sectors not selected in mode are skipped, as are runs of all 0 pages.
+ * <p>
+ * DONE is only set if the source's finish() vouches for the complete file, a
+ * truncated or corrupt bitstream leaves the device unconfigured instead.
+ * Pages are not kept after writing, with XO2ECA_PROGRAM_VERIFY the Cfg and UFM
+ * sectors are read back in full once the file is complete and checked against
+ * the digests the source computed, before DONE is set.
+ *
+ * @param pXO2dev reference to the XO2 device to access and program
+ * @param pSrc source of the pages and the Feature Row
+ * @param mode bitmap of what to erase/program, see XO2ECA_apiProgram()
+ * @return OK, an XO2ECA_apiProgram() error code, -50 if the source failed
+ * while programming, -51 if it rejected the file at the end or -52 if verify
+ * was requested but the source has no digests
+ */
+int XO2ECA_apiProgramStream(XO2Handle_t *pXO2dev, const XO2PageSource_t *pSrc, int mode)
+{
+	XO2SectorMode_t sector, curSector;
+	const unsigned char *pData;
+	unsigned int startPg;
+	XO2_JEDEC_t summary;
+	int n, status, ret;
+
+	// The source gets ahead while the device erases, the erase is only
+	// waited for before the first page write
+	status = XO2_startProgram(pXO2dev, &mode, NULL);
+	if (status != OK)
+		return(status);
 
-		if (mode &  XO2ECA_PROGRAM_VERIFY)
+	curSector = SRAM;  // no page address set yet
+	for (;;)
+	{
+		n = pSrc->nextPages(pSrc->pCtx, &sector, &startPg, XO2ECA_CMD_STATUS_INTERVAL, &pData);
+		if (n < 0)
 		{
+			ret = -50;
+			goto STREAM_ABORT;
+		}
+		if (n == 0)
+			break;
 
-			status = XO2ECAcmd_FeatureRowRead(pXO2dev, &featRow);
+		if ((sector == CFG_SECTOR && !(mode & XO2ECA_ERASE_PROG_CFG)) ||
+			(sector == UFM_SECTOR && !(mode & XO2ECA_ERASE_PROG_UFM)))
+			continue;
 
 #ifdef DEBUG_ECA
-			printf("Feature Contents: %x %x %x %x %x %x %x %x\r\n", featRow.feature[0],
-			featRow.feature[1],featRow.feature[2],featRow.feature[3],featRow.feature[4],featRow.feature[5],
-			featRow.feature[6],featRow.feature[7]);
-			printf("FEABITS: %x %x\r\n", featRow.feabits[0], featRow.feabits[1]);
+		printf("Stream %s pages %d-%d\r\n", sector == CFG_SECTOR ? "Cfg" : "UFM",
+			   startPg + 1, startPg + n);
 #endif
 
-			for (i = 0; i < 8; i++)
+		status = XO2ECAcmd_EraseFlashWait(pXO2dev);  // returns at once after the first time
+		if (status != OK)
+		{
+			ret = -2;
+			goto STREAM_ABORT;
+		}
+
+		// Page address: reset on entering a sector, set when the file or the
+		// all 0 pages skip pages
+		if (sector != curSector)
+		{
+			if (sector == CFG_SECTOR)
+				status = XO2ECAcmd_CfgResetAddr(pXO2dev);
+			else
+				status = XO2ECAcmd_UFMResetAddr(pXO2dev);
+			curSector = sector;
+			if (status != OK)
 			{
-				if (featRow.feature[i] != pProgJED->pFeatureRow.feature[i])
-				{
-#ifdef DEBUG_ECA
-					printf("FeatureRow Verify ERR @ feature[%d]\r\n", i);
-#endif
-					ret = -32;
-					goto PROG_ABORT;
-				}
+				ret = (sector == CFG_SECTOR) ? -11 : -21;
+				goto STREAM_ABORT;
 			}
-			for (i = 0; i < 2; i++)
-			{
-				if (featRow.feabits[i] != pProgJED->pFeatureRow.feabits[i])
-				{
+		}
+
+		status = XO2_writeSparse(pXO2dev, sector, startPg, pData, n, NULL, 0, NULL);
+		if (status != OK)
+		{
 #ifdef DEBUG_ECA
-					printf("FeatureRow Verify ERR @ feabits[%d]\r\n", i);
+			printf("WritePages ERR, page %d\r\n", pXO2dev->failPage);
 #endif
-					ret = -33;
-					goto PROG_ABORT;
-				}
-			}
-
+			ret = (sector == CFG_SECTOR) ? -12 : -22;
+			goto STREAM_ABORT;
 		}
 	}
 
+	// Only a complete and valid file may be marked DONE
+	status = pSrc->finish(pSrc->pCtx, &summary);
+	if (status != OK)
+	{
+		ret = -51;
+		goto STREAM_ABORT;
+	}
 
-
-	//=======================================================================================
-	//=======================================================================================
-	//=======================================================================================
-	//               FINALIZE and CLOSE CONFIG INTERFACE
-	//=======================================================================================
-	//=======================================================================================
-	//=======================================================================================
-
-	// Set DONE bit indicating valid design loaded into flash
-	status = XO2ECAcmd_setDone(pXO2dev);
+	status = XO2ECAcmd_EraseFlashWait(pXO2dev);  // no pages written
 	if (status != OK)
 	{
-		ret = -40;
-		goto PROG_ABORT;
+		ret = -2;
+		goto STREAM_ABORT;
 	}
 
-	if ((mode & XO2ECA_PROGRAM_NOLOAD) == XO2ECA_PROGRAM_NOLOAD)
+	if ((mode & XO2ECA_PROGRAM_VERIFY) && (mode & (XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_UFM)))
 	{
-		XO2ECAcmd_closeCfgIF(pXO2dev);
-		if (status != OK)
+		if (!summary.digestValid)
 		{
-			return -41;
+			ret = -52;
+			goto STREAM_ABORT;
 		}
-	}
-	else
-	{
-		// Boot design to user mode (i.e. like hitting PROGRAM pin)
-		// Refresh command will clear SRAM, load from Flash, set Done, exit config mode.
-		// Sometimes it needs to be called more than once.
-		// But eventually it boots and Done goes high.
-		i = 10;
-		while (i && (XO2ECAcmd_Refresh(pXO2dev) != OK))
+		pXO2dev->failPage = -1;
+		if (mode & XO2ECA_ERASE_PROG_CFG)
 		{
-			--i;
+			status = XO2ECAcmd_CfgResetAddr(pXO2dev);
+			if (status == OK)
+				status = XO2_verifyDigest(pXO2dev, CFG_SECTOR, NULL, summary.CfgDataSize / XO2_FLASH_PAGE_SIZE,
+										  NULL, 0, summary.CfgDigest);
+			if (status != OK)
+			{
+				ret = (status == XO2ECA_DIFF_FOUND) ? -15 : -14;
+				goto STREAM_ABORT;
+			}
+		}
+		if (mode & XO2ECA_ERASE_PROG_UFM)
+		{
+			status = XO2ECAcmd_UFMResetAddr(pXO2dev);
+			if (status == OK)
+				status = XO2_verifyDigest(pXO2dev, UFM_SECTOR, NULL, summary.UFMDataSize / XO2_FLASH_PAGE_SIZE,
+										  NULL, 0, summary.UFMDigest);
+			if (status != OK)
+			{
+				ret = (status == XO2ECA_DIFF_FOUND) ? -25 : -24;
+				goto STREAM_ABORT;
+			}
 		}
 	}
 
-	if (i)
-		return(OK);  // Done got set before timeout
-	else
-		return(-42);  // failed exiting config mode and/or refreshing
-
+	if (mode & XO2ECA_ERASE_PROG_FEATROW)
+	{
+		ret = XO2_updateFeatureRow(pXO2dev, &summary.pFeatureRow, mode, false);
+		if (ret != OK)
+			goto STREAM_ABORT;
+	}
 
+	ret = XO2_finishProgram(pXO2dev, mode);
+	if (ret == -40)
+		goto STREAM_ABORT;
+	return(ret);
 
-	// This is clean-up from aborting.  Close, but don't set done or refresh
-	// User may wish to erase sectors they attempted to program and/or
-	// put part into a blank state.
-	// See XO2ECA_apiClearXO2() for clearing XO2 to a blank state.
-PROG_ABORT:
+STREAM_ABORT:
+	XO2ECAcmd_EraseFlashWait(pXO2dev);  // in case it is still running
 	XO2ECAcmd_closeCfgIF(pXO2dev);
 	XO2ECAcmd_Bypass(pXO2dev);
 	return(ret);
@@ -454,6 +1171,8 @@ void XO2ECA_apiJEDECinfo(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED)
 	printf("UFMDataSize = %d bytes (%d pages)\n", pProgJED->UFMDataSize, pProgJED->UFMDataSize / XO2_FLASH_PAGE_SIZE);
 	printf("USERCODE = 0x%08x\n", pProgJED->UserCode);
 	printf("Security = 0x%08x\n", pProgJED->SecurityFuses);
+	if (pProgJED->digestValid)
+		printf("CRC32C = Cfg 0x%08x UFM 0x%08x\n", pProgJED->CfgDigest, pProgJED->UFMDigest);
 
 }
 
@@ -473,15 +1192,316 @@ int XO2ECA_apiJEDECverify(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED)
 
 
 
+/* Add a differing page to the report, extending the last range if it is adjacent */
+static void XO2_addDiff(XO2DiffReport_t *pReport, XO2SectorMode_t sector, unsigned int pg)
+{
+	XO2DiffRange_t *pLast;
+
+	pReport->numDiffPgs++;
+	if (pReport->numRanges > 0 && pReport->numRanges <= XO2ECA_DIFF_MAX_RANGES)
+	{
+		pLast = &pReport->ranges[pReport->numRanges - 1];
+		if (pLast->sector == sector && pLast->startPg + pLast->numPgs == pg)
+		{
+			pLast->numPgs++;
+			return;
+		}
+	}
+
+	if (pReport->numRanges < XO2ECA_DIFF_MAX_RANGES)
+	{
+		pReport->ranges[pReport->numRanges].sector = sector;
+		pReport->ranges[pReport->numRanges].startPg = pg;
+		pReport->ranges[pReport->numRanges].numPgs = 1;
+	}
+	pReport->numRanges++;
+}
+
+
+/* Read back numPgs pages of a sector from page 0 on in bursts and compare the
+   first dataPgs of them to pData, the rest (all if pData is NULL) against erased
+   pages.
+   Return the number of differing pages, ERROR if the device could not be read.
+*/
+static int XO2_diffPages(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, const unsigned char *pData,
+						 unsigned int dataPgs, unsigned int numPgs, int mode, XO2DiffReport_t *pReport)
+{
+	static const unsigned char erased[XO2_FLASH_PAGE_SIZE];
+	unsigned char buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	const unsigned char *pExp;
+	unsigned int i, k, n;
+	int status, diffs;
+
+	if (sector == UFM_SECTOR)
+		status = XO2ECAcmd_UFMResetAddr(pXO2dev);
+	else
+		status = XO2ECAcmd_CfgResetAddr(pXO2dev);
+	if (status != OK)
+		return(ERROR);
+
+	diffs = 0;
+	for (i = 0; i < numPgs; i += n)
+	{
+		n = (numPgs - i > XO2ECA_CMD_READ_BURST) ? XO2ECA_CMD_READ_BURST : numPgs - i;
+		if (sector == UFM_SECTOR)
+			status = XO2ECAcmd_UFMReadPages(pXO2dev, n, buf);
+		else
+			status = XO2ECAcmd_CfgReadPages(pXO2dev, n, buf);
+		if (status != OK)
+			return(ERROR);
+		pReport->numPgsRead += n;
+
+		for (k = 0; k < n; k++)
+		{
+			pExp = (pData && i + k < dataPgs) ? pData + XO2_FLASH_PAGES_LEN(i + k) : erased;
+			if (memcmp(buf + XO2_FLASH_PAGES_LEN(k), pExp, XO2_FLASH_PAGE_SIZE) == 0)
+				continue;
+
+			XO2_addDiff(pReport, sector, i + k);
+			diffs++;
+			if (mode & XO2ECA_DIFF_FIRST)
+				return(diffs);
+		}
+	}
+
+	return(diffs);
+}
+
+
+/**
+ * Compare the contents of the XO2 Flash with a JEDEC file, without changing it.
+ * Used to find out if the device needs to be programmed at all.
+ * <p>
+ * The Configuration sector is compared in full, pages not in the JEDEC file must
+ * be erased.  Of the UFM only the pages the JEDEC file holds data for are compared,
+ * the rest is free for use by the design.  Sectors are streamed back with burst
+ * reads and compared page by page.
+ *
+ * @param pXO2dev reference to the XO2 device to access
+ * @param pProgJED JEDEC data to compare against
+ * @param mode XO2ECA_ERASE_PROG_CFG, XO2ECA_ERASE_PROG_UFM and/or XO2ECA_ERASE_PROG_FEATROW
+ * to select what to compare, plus XO2ECA_DIFF_FIRST to stop at the first difference
+ * @param pReport filled with the differing page ranges
+ * @return OK if identical, XO2ECA_DIFF_FOUND if there are differences, negative on error
+ */
+int XO2ECA_apiJEDECdiff(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode,
+						XO2DiffReport_t *pReport)
+{
+	int status, ret;
+
+	memset(pReport, 0, sizeof(*pReport));
+
+	if (pProgJED->devID != pXO2dev->devType)
+		return(-1);
+
+	status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+	if (status != OK)
+		return(-2);
+
+	ret = OK;
+	if (mode & XO2ECA_ERASE_PROG_CFG)
+	{
+		status = XO2_diffPages(pXO2dev, CFG_SECTOR, pProgJED->pCfgData,
+							   pProgJED->CfgDataSize / XO2_FLASH_PAGE_SIZE,
+							   XO2DevList[pXO2dev->devType].Cfgpages, mode, pReport);
+		if (status < 0)
+		{
+			ret = -11;
+			goto DIFF_DONE;
+		}
+	}
+
+	if ((mode & XO2ECA_ERASE_PROG_UFM) && pProgJED->pUFMData &&
+		!((mode & XO2ECA_DIFF_FIRST) && pReport->numDiffPgs))
+	{
+		status = XO2_diffPages(pXO2dev, UFM_SECTOR, pProgJED->pUFMData,
+							   pProgJED->UFMDataSize / XO2_FLASH_PAGE_SIZE,
+							   pProgJED->UFMDataSize / XO2_FLASH_PAGE_SIZE, mode, pReport);
+		if (status < 0)
+		{
+			ret = -21;
+			goto DIFF_DONE;
+		}
+	}
+
+	if ((mode & XO2ECA_ERASE_PROG_FEATROW) &&
+		!((mode & XO2ECA_DIFF_FIRST) && pReport->numDiffPgs))
+	{
+		status = XO2_diffFeatureRow(pXO2dev, &pProgJED->pFeatureRow);
+		if (status == ERROR)
+		{
+			ret = -31;
+			goto DIFF_DONE;
+		}
+		if (status == XO2ECA_DIFF_FOUND)
+			XO2_addDiff(pReport, FEATURE_ROW, 0);
+	}
+
+	if (pReport->numDiffPgs)
+		ret = XO2ECA_DIFF_FOUND;
+
+DIFF_DONE:
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+
+	return(ret);
+}
+
+
+/**
+ * Compare the Feature Row of the XO2 with the one of a JEDEC file, without
+ * changing it.  XO2ECA_apiProgram() does the same before erasing, to leave an
+ * unchanged Feature Row alone.  The design keeps running.
+ *
+ * @param pXO2dev reference to the XO2 device to access
+ * @param pFeatureRow Feature Row to compare against, e.g. XO2_JEDEC_t.pFeatureRow
+ * @return OK if identical, XO2ECA_DIFF_FOUND if different, -2 if configuration
+ * mode could not be entered or -31 if the Feature Row could not be read
+ */
+int XO2ECA_apiFeatureRowCompare(XO2Handle_t *pXO2dev, const XO2FeatureRow_t *pFeatureRow)
+{
+	int status;
+
+	status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+	if (status != OK)
+		return(-2);
+
+	status = XO2_diffFeatureRow(pXO2dev, pFeatureRow);
+
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+
+	return((status == ERROR) ? -31 : status);
+}
+
+
+/* Read numPgs pages of a sector from startPg on with the configuration
+   interface open.  The pages go straight into pBuf if set, else into a burst
+   buffer, and are passed to pSink if set.  *pDone counts the pages read for
+   the progress callback, out of total.
+   Return OK, -3 if the page address could not be set, ERROR if reading failed
+   or -2 if the sink aborted.
+*/
+static int XO2_readBack(XO2Handle_t *pXO2dev, XO2SectorMode_t sector, unsigned int startPg,
+						unsigned int numPgs, unsigned char *pBuf, const XO2PageSink_t *pSink,
+						unsigned int *pDone, unsigned int total)
+{
+	unsigned char burst[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned char *p;
+	unsigned int i, n;
+	int status;
+
+	if (startPg == 0)
+		status = (sector == CFG_SECTOR) ? XO2ECAcmd_CfgResetAddr(pXO2dev) : XO2ECAcmd_UFMResetAddr(pXO2dev);
+	else
+		status = XO2ECAcmd_SetPage(pXO2dev, sector, startPg);
+	if (status != OK)
+		return(-3);
+
+	for (i = 0; i < numPgs; i += n)
+	{
+		n = numPgs - i;
+		if (n > XO2ECA_CMD_READ_BURST)
+			n = XO2ECA_CMD_READ_BURST;
+		p = pBuf ? pBuf + XO2_FLASH_PAGES_LEN(i) : burst;
+
+		if (sector == CFG_SECTOR)
+			status = XO2ECAcmd_CfgReadPages(pXO2dev, n, p);
+		else
+			status = XO2ECAcmd_UFMReadPages(pXO2dev, n, p);
+		if (status != OK)
+		{
+#ifdef DEBUG_ECA
+			printf("ReadPages(%d) ERR\r\n", startPg + i);
+#endif
+			return(ERROR);
+		}
+
+		if (pSink && pSink->putPages &&
+			pSink->putPages(pSink->pCtx, sector, startPg + i, n, p) != OK)
+			return(-2);
+		*pDone += n;
+		if (pSink && pSink->progress)
+			pSink->progress(pSink->pCtx, *pDone, total);
+	}
+
+	return(OK);
+}
+
+
+/**
+ * Read back whole Configuration and/or UFM sectors and pass them to a sink,
+ * e.g. to save a snapshot of the device in a file.  The sectors are read in
+ * bursts of XO2ECA_CMD_READ_BURST pages, each burst is passed on as soon as
+ * it is read.  The design keeps running.
+ *
+ * @param pXO2dev reference to the XO2 device to access and read
+ * @param mode XO2ECA_ERASE_PROG_CFG and/or XO2ECA_ERASE_PROG_UFM to select the
+ * sectors, Cfg is read first
+ * @param pSink where the pages go and who gets to know the progress
+ * @return OK, -2 if configuration mode could not be entered, -11/-21 if the
+ * Cfg/UFM sector could not be read, -12/-22 if the sink aborted
+ */
+int XO2ECA_apiReadBack(XO2Handle_t *pXO2dev, int mode, const XO2PageSink_t *pSink)
+{
+	unsigned int cfgPgs, ufmPgs, done;
+	int status, ret;
+
+	cfgPgs = (mode & XO2ECA_ERASE_PROG_CFG) ? XO2DevList[pXO2dev->devType].Cfgpages : 0;
+	ufmPgs = (mode & XO2ECA_ERASE_PROG_UFM) ? XO2DevList[pXO2dev->devType].UFMpages : 0;
+
+	status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+	if (status != OK)
+		return(-2);
+
+	ret = OK;
+	done = 0;
+	if (cfgPgs)
+	{
+		status = XO2_readBack(pXO2dev, CFG_SECTOR, 0, cfgPgs, NULL, pSink, &done, cfgPgs + ufmPgs);
+		if (status != OK)
+			ret = (status == -2) ? -12 : -11;
+	}
+	if (ret == OK && ufmPgs)
+	{
+		status = XO2_readBack(pXO2dev, UFM_SECTOR, 0, ufmPgs, NULL, pSink, &done, cfgPgs + ufmPgs);
+		if (status != OK)
+			ret = (status == -2) ? -22 : -21;
+	}
+
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
+
+	return(ret);
+}
+
+
 /**
  * Readback and save the Configuration FLash area.
  * This would be used to compare what was written, or save current device design before erasing.
+ * The pages are read in bursts straight into pBuf.
  *  @param pXO2dev reference to the XO2 device to access and program
+ *  @param pBuf storage for all Cfg pages of the device, XO2DevList[].Cfgpages * 16 bytes
+ *  @return OK, -2 if configuration mode could not be entered, -3 if the page
+ *  address could not be set, -11 if reading failed
  */
 int XO2ECA_apiReadBackCfg(XO2Handle_t *pXO2dev, unsigned char *pBuf)
 {
-	return(NOT_IMPLEMENTED_ERR);
+	unsigned int done = 0, numPgs = XO2DevList[pXO2dev->devType].Cfgpages;
+	int status;
+
+	status = XO2ECAcmd_openCfgIF(pXO2dev, TRANSPARENT_MODE);
+	if (status != OK)
+		return(-2);
+
+	status = XO2_readBack(pXO2dev, CFG_SECTOR, 0, numPgs, pBuf, NULL, &done, numPgs);
+
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
 
+	if (status == -3)
+		return(-3);
+	return((status == OK) ? OK : -11);
 }
 
 
@@ -499,24 +1519,20 @@ int XO2ECA_apiReadBackCfg(XO2Handle_t *pXO2dev, unsigned char *pBuf)
  * @param startPg starting page to read from.  Numbering starts with page 0.
  * @param numPgs how many to read back.  -1 means read all
  * @param pBuf pointer to storage for bytes read from UFM, must be multiple of page size, and big enough.
+ * @return OK, -1 if the pages are not all in the UFM, -2 if configuration mode
+ * could not be entered, -3 if the page address could not be set, -11 if
+ * reading failed
  */
 int XO2ECA_apiReadBackUFM(XO2Handle_t *pXO2dev, int startPg, int numPgs, unsigned char *pBuf)
 {
+	unsigned int done = 0;
 	int status;
-	int devIndex;
-	int i;
-	int ret;
-
-	ret = OK;
-
-
-	devIndex = pXO2dev->devType;
 
 	if (numPgs == -1)
-		numPgs =  XO2DevList[devIndex].UFMpages;
+		numPgs =  XO2DevList[pXO2dev->devType].UFMpages;
 
 	// first check if pages are in the range supported by this device
-	if (startPg + numPgs > XO2DevList[devIndex].UFMpages)
+	if (startPg < 0 || numPgs < 0 || startPg + numPgs > XO2DevList[pXO2dev->devType].UFMpages)
 	{
 #ifdef DEBUG_ECA
 		printf("Page Range ERR\r\n");
@@ -533,37 +1549,15 @@ int XO2ECA_apiReadBackUFM(XO2Handle_t *pXO2dev, int startPg, int numPgs, unsigne
 		return(-2);
 	}
 
-	// Set the UFM beginning page to write to
-	status = XO2ECAcmd_SetPage(pXO2dev, UFM_SECTOR, startPg);
-	if (status != OK)
-	{
-#ifdef DEBUG_ECA
-		printf("XO2ECAcmd_SetPage(%d) ERR\r\n", startPg);
-#endif
-		return(-3);
-	}
-
-	for (i = 0; i < numPgs; i++)
-	{
-		// Write the next page with the new pattern
-		status = XO2ECAcmd_CfgReadPage(pXO2dev, pBuf);
-		if (status != OK)
-		{
-#ifdef DEBUG_ECA
-			printf("XO2ECAcmd_CfgReadPage(%d) ERR\r\n", startPg + i);
-#endif
-			ret = -11;
-			break;
-		}
-		pBuf = pBuf + 16;  // point to next page of data
-	}
-
-	status = XO2ECAcmd_closeCfgIF(pXO2dev);
-
-	status = XO2ECAcmd_Bypass(pXO2dev);
+	// Read all requested pages in bursts straight into pBuf
+	status = XO2_readBack(pXO2dev, UFM_SECTOR, startPg, numPgs, pBuf, NULL, &done, numPgs);
 
-	return(ret);
+	XO2ECAcmd_closeCfgIF(pXO2dev);
+	XO2ECAcmd_Bypass(pXO2dev);
 
+	if (status == -3)
+		return(-3);
+	return((status == OK) ? OK : -11);
 }
 
 
@@ -582,7 +1576,6 @@ int XO2ECA_apiWriteUFM(XO2Handle_t *pXO2dev, int startPg, int numPgs, unsigned c
 {
 	int status;
 	int devIndex;
-	int i;
 	int ret;
 
 	ret = OK;
@@ -629,19 +1622,14 @@ int XO2ECA_apiWriteUFM(XO2Handle_t *pXO2dev, int startPg, int numPgs, unsigned c
 		return(-3);
 	}
 
-	for (i = 0; i < numPgs; i++)
+	// Write the new pattern into all pages of the range
+	status = XO2ECAcmd_UFMWritePages(pXO2dev, numPgs, pBuf);
+	if (status != OK)
 	{
-		// Write the next page with the new pattern
-		status = XO2ECAcmd_CfgWritePage(pXO2dev, pBuf);
-		if (status != OK)
-		{
 #ifdef DEBUG_ECA
-			printf("XO2ECAcmd_CfgWritePage(%d) ERR\r\n", startPg + i);
+		printf("XO2ECAcmd_UFMWritePages(%d) ERR\r\n", startPg);
 #endif
-			ret = -11;
-			break;
-		}
-		pBuf = pBuf + 16;  // point to next page of data
+		ret = -11;
 	}
 
 	status = XO2ECAcmd_closeCfgIF(pXO2dev);
@@ -25,11 +25,82 @@
 #define XO2ECA_ERASE_SRAM          0x01 // Erase SRAM (used in Offline mode)
 
 
+#define XO2ECA_DIFF_FIRST          0x100 // Diff: stop at the first difference
+
+
 #define NOT_IMPLEMENTED_ERR   (-1000)
 
+#define XO2ECA_DIFF_FOUND     1     // XO2ECA_apiJEDECdiff() found differences
+#define XO2ECA_DIFF_MAX_RANGES 32   // differing page ranges kept in a XO2DiffReport_t
+#define XO2ECA_REFRESH_TRIES  3     // Refresh attempts before programming gives up booting the part
+
+
+/**
+ * Pages that differ between the device and a JEDEC file.
+ * The Feature Row is reported as one page 0 range of FEATURE_ROW.
+ */
+typedef struct
+{
+	XO2SectorMode_t sector;   /**< CFG_SECTOR, UFM_SECTOR or FEATURE_ROW */
+	unsigned int startPg;     /**< First differing page */
+	unsigned int numPgs;      /**< Number of consecutive differing pages */
+} XO2DiffRange_t;
+
+/**
+ * Result of XO2ECA_apiJEDECdiff().
+ */
+typedef struct
+{
+	unsigned int numPgsRead;  /**< Pages read back from the device */
+	unsigned int numDiffPgs;  /**< Differing pages, Feature Row counts as one */
+	unsigned int numRanges;   /**< Differing ranges, only the first XO2ECA_DIFF_MAX_RANGES are kept */
+	XO2DiffRange_t ranges[XO2ECA_DIFF_MAX_RANGES];
+} XO2DiffReport_t;
+
+/**
+ * Source of the pages for XO2ECA_apiProgramStream(), e.g. a JEDEC file still
+ * being parsed.
+ */
+typedef struct
+{
+	void *pCtx;   /**< Passed to the calls below */
+	/** Wait for the next pages in file order.  Returns their number, at most maxPgs,
+	    0 at the end of the fuse data, negative on error.  The pages start at
+	    *pStartPg of *pSector and stay valid until the next call. */
+	int (*nextPages)(void *pCtx, XO2SectorMode_t *pSector, unsigned int *pStartPg,
+					 unsigned int maxPgs, const unsigned char **ppData);
+	/** Wait for the end of the file and return its Feature Row, data sizes and
+	    digests, the page pointers are not set.  Returns OK only if the complete
+	    file is valid, ERROR otherwise. */
+	int (*finish)(void *pCtx, XO2_JEDEC_t *pSummary);
+} XO2PageSource_t;
+
+/**
+ * Destination of the pages read back by XO2ECA_apiReadBack(), e.g. a file.
+ */
+typedef struct
+{
+	void *pCtx;   /**< Passed to the calls below */
+	/** Take numPgs pages of sector starting at startPg, valid during the call only.
+	    Returns OK to go on, anything else aborts the read back. */
+	int (*putPages)(void *pCtx, XO2SectorMode_t sector, unsigned int startPg,
+					unsigned int numPgs, const unsigned char *pData);
+	/** Optional, called after every burst with the pages read so far and in total */
+	void (*progress)(void *pCtx, unsigned int donePgs, unsigned int totalPgs);
+} XO2PageSink_t;
+
+
+int XO2ECA_apiProgramStart(XO2Handle_t *pXO2dev, int mode);
+
+int XO2ECA_apiProgramAbort(XO2Handle_t *pXO2dev);
 
 int XO2ECA_apiProgram(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode);
 
+int XO2ECA_apiProgramResume(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode,
+							const XO2Checkpoint_t *pFrom);
+
+int XO2ECA_apiProgramStream(XO2Handle_t *pXO2dev, const XO2PageSource_t *pSrc, int mode);
+
 int XO2ECA_apiClearXO2(XO2Handle_t *pXO2dev);
 
 int XO2ECA_apiEraseFlash(XO2Handle_t *pXO2dev,  int mode);
@@ -38,6 +109,13 @@ void XO2ECA_apiJEDECinfo(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED);
 
 int XO2ECA_apiJEDECverify(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED);
 
+int XO2ECA_apiJEDECdiff(XO2Handle_t *pXO2dev, XO2_JEDEC_t *pProgJED, int mode,
+						XO2DiffReport_t *pReport);
+
+int XO2ECA_apiFeatureRowCompare(XO2Handle_t *pXO2dev, const XO2FeatureRow_t *pFeatureRow);
+
+
+int XO2ECA_apiReadBack(XO2Handle_t *pXO2dev, int mode, const XO2PageSink_t *pSink);
 
 int XO2ECA_apiReadBackCfg(XO2Handle_t *pXO2dev, unsigned char *pBuf);
 
@@ -28,52 +28,148 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <linux/i2c-dev.h>
-#include <linux/i2c.h>
+#include <time.h>
 
 #include "XO2_cmds.h"
+#include "XO2_timing.h"
+#include "XO2_stats.h"
+
+// Where to record the duration of an operation, NULL unless calibrating
+#define XO2_MEASURED(pXO2, f) ((pXO2)->pMeasured ? &(pXO2)->pMeasured->f : NULL)
+
+static int XO2_waitBusy(XO2Handle_t *pXO2, unsigned expectUs, unsigned *pMeasuredUs);
+static int XO2_waitBusySince(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs, unsigned *pMeasuredUs);
+static int XO2_waitStatus(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs,
+						  unsigned mask, unsigned want, unsigned *pUs);
+
+static uint64_t XO2_nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void XO2_delay(XO2Handle_t *pXO2, unsigned usec)
+{
+	uint64_t start;
+
+	if (!usec)
+		return;
+
+	start = pXO2->pStats ? XO2_nowUs() : 0;
+	if (pXO2->pDrvrCalls->delay)
+		pXO2->pDrvrCalls->delay(pXO2->pDrvrParams, usec);
+	else
+		usleep(usec);
+
+	if (pXO2->pStats) {
+		pXO2->pStats->sleeps++;
+		pXO2->pStats->sleepUs += XO2_nowUs() - start;
+	}
+}
+
+/* Sleep until deadline (XO2_nowUs() time).  The deadline is absolute so the
+   time spent on the bus between two polls does not stretch the schedule.
+   A driver delay() gets the time left instead.
+*/
+static void XO2_sleepUntil(XO2Handle_t *pXO2, uint64_t deadline)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	now = XO2_nowUs();
+	if (deadline <= now)
+		return;
+
+	if (pXO2->pDrvrCalls->delay)
+	{
+		XO2_delay(pXO2, deadline - now);
+		return;
+	}
+
+	ts.tv_sec = deadline / 1000000u;
+	ts.tv_nsec = (deadline % 1000000u) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+
+	if (pXO2->pStats) {
+		pXO2->pStats->sleeps++;
+		pXO2->pStats->sleepUs += XO2_nowUs() - now;
+	}
+}
+
+/* All driver transfers go through here to be accounted in pXO2->pStats */
+static int XO2_xfer(XO2Handle_t *pXO2, const uint8_t *pWr, unsigned wlen,
+					uint8_t *pRd, unsigned rlen)
+{
+	uint64_t start;
+	int status;
+
+	if (!pXO2->pStats)
+		return pXO2->pDrvrCalls->xfer(pXO2->pDrvrParams, pWr, wlen, pRd, rlen);
+
+	start = XO2_nowUs();
+	status = pXO2->pDrvrCalls->xfer(pXO2->pDrvrParams, pWr, wlen, pRd, rlen);
+	pXO2->pStats->xfers++;
+	XO2stats_addCmd(pXO2->pStats, pWr[0], wlen, rlen, XO2_nowUs() - start, status);
+	return status;
+}
+
+/* Batch of write frames, each frame is accounted an equal share of the time */
+static int XO2_writeFrames(XO2Handle_t *pXO2, const XO2Frame_t *pFrames, unsigned nFrames)
+{
+	uint64_t start, usec;
+	unsigned i;
+	int status;
+
+	if (!pXO2->pStats)
+		return pXO2->pDrvrCalls->writeFrames(pXO2->pDrvrParams, pFrames, nFrames);
+
+	start = XO2_nowUs();
+	status = pXO2->pDrvrCalls->writeFrames(pXO2->pDrvrParams, pFrames, nFrames);
+	usec = (XO2_nowUs() - start) / nFrames;
+	pXO2->pStats->xfers++;
+	for (i = 0;i < nFrames;++i)
+		XO2stats_addCmd(pXO2->pStats, pFrames[i].pBuf[0], pFrames[i].len, 0, usec, status);
+	return status;
+}
+
+/* Expected operation times: the loaded timing profile, else the datasheet maxima */
+static void XO2_getTiming(XO2Handle_t *pXO2, XO2Timing_t *pTiming)
+{
+	if (pXO2->pTiming)
+		*pTiming = *pXO2->pTiming;
+	else
+		XO2timing_default(pXO2->devType, pTiming);
+}
+
+/* Wait for the page program started by the last frame */
+static int XO2_waitProg(XO2Handle_t *pXO2)
+{
+	XO2Timing_t timing;
+
+	XO2_getTiming(pXO2, &timing);
+	return XO2_waitBusy(pXO2, timing.progUs, XO2_MEASURED(pXO2, progUs));
+}
 
 static int XO2_read(XO2Handle_t *pXO2, uint8_t reg, uint32_t args,
 					unsigned len, uint8_t *data)
 {
 	unsigned char cmd[4];
-	struct i2c_rdwr_ioctl_data i2c_req;
-	struct i2c_msg i2c_msgs[2];
-	int status;
 
 	cmd[0] = reg;
 	cmd[1] = args>>16; // arg0
 	cmd[2] = args>>8;  // arg1
 	cmd[3] = args;     // arg2
-	i2c_msgs[0].addr = pXO2->addr;
-	i2c_msgs[0].flags = 0;
-	i2c_msgs[0].len = 4;
-	i2c_msgs[0].buf = cmd;
-
-	i2c_msgs[1].addr = pXO2->addr;
-	i2c_msgs[1].flags = I2C_M_RD ;
-	i2c_msgs[1].len = len;
-	i2c_msgs[1].buf = data;
 
-	i2c_req.msgs = i2c_msgs;
-	i2c_req.nmsgs = 2;
-
-	status = ioctl(pXO2->i2cfd, I2C_RDWR, &i2c_req);
-
-	if (status != -1) {
-		return OK;
-	} else {
-		return ERROR;
-	}
+	return XO2_xfer(pXO2, cmd, 4, data, len);
 }
 
 static int XO2_write(XO2Handle_t *pXO2, uint8_t reg, uint32_t args,
 					 unsigned len, uint8_t *data)
 {
 	uint8_t buf[32];
-	struct i2c_rdwr_ioctl_data i2c_req;
-	struct i2c_msg i2c_msgs[1];
-	int status;
 
 	if ((data == NULL && len != 0) || len > 28) {
 		return ERROR;
@@ -86,22 +182,146 @@ static int XO2_write(XO2Handle_t *pXO2, uint8_t reg, uint32_t args,
 	if (len > 0) {
 		memcpy(buf+4, data, len);
 	}
-	i2c_msgs[0].addr = pXO2->addr;
-	i2c_msgs[0].flags = 0;
-	i2c_msgs[0].len = 4+len;
-	i2c_msgs[0].buf = buf;
 
-	i2c_req.msgs = i2c_msgs;
-	i2c_req.nmsgs = 1;
+	return XO2_xfer(pXO2, buf, 4+len, NULL, 0);
+}
+
+/* Time in usec a write frame of len bytes (plus address byte) takes on the bus,
+   at 9 clocks per byte incl. ACK
+*/
+static unsigned XO2_frameUs(XO2Handle_t *pXO2, unsigned len)
+{
+	unsigned hz = pXO2->busHz ? pXO2->busHz : XO2ECA_BUS_DEFAULT_HZ;
 
-	status = ioctl(pXO2->i2cfd, I2C_RDWR, &i2c_req);
+	return (uint64_t)(1 + len) * 9 * 1000000u / hz;
+}
 
-	if (status != -1) {
-		return OK;
-	} else {
-		return ERROR;
+/* After a FAIL, find the first of numPgs pages from startPg on that does not
+   read back as written. Return its page number or -1 if all match.
+*/
+static int XO2_locateFail(XO2Handle_t *pXO2, uint8_t readReg, unsigned startPg,
+						  const uint8_t *data, unsigned numPgs)
+{
+	uint8_t buf[XO2_FLASH_PAGES_LEN(XO2ECA_CMD_READ_BURST)];
+	unsigned i, k, n;
+
+	if (XO2ECAcmd_SetPage(pXO2, readReg == 0xCA ? UFM_SECTOR : CFG_SECTOR, startPg) != OK)
+		return -1;
+
+	for (i = 0;i < numPgs;i += n) {
+		n = numPgs - i > XO2ECA_CMD_READ_BURST ? XO2ECA_CMD_READ_BURST : numPgs - i;
+		if (XO2_read(pXO2, readReg, n, XO2_FLASH_PAGES_LEN(n), buf) != OK)
+			return -1;
+
+		for (k = 0;k < n;++k) {
+			if (memcmp(buf + XO2_FLASH_PAGES_LEN(k), data + XO2_FLASH_PAGES_LEN(i+k),
+					   XO2_FLASH_PAGE_SIZE) != 0)
+				return startPg + i + k;
+		}
 	}
+
+	return -1;
+}
+
+/* Write numPgs pages with a page program opcode (0x70 Cfg, 0xC9 UFM).
+   Pages go out back-to-back, paced against the bus clock: if a page frame
+   takes longer on the wire than a page takes to program, up to
+   XO2ECA_CMD_WRITE_BATCH frames are handed to the driver's writeFrames() at
+   once, since each page is done by the time the next frame completes.  On a
+   faster bus every frame is followed by the remaining program time instead.
+   BUSY/FAIL is only checked every XO2ECA_CMD_STATUS_INTERVAL pages and after
+   the last page. When FAIL is seen, the pages since the last good check are
+   read back to locate the page that failed, see XO2Handle_t.failPage.
+*/
+static int XO2_writePages(XO2Handle_t *pXO2, uint8_t reg, unsigned numPgs,
+						  uint8_t *data)
+{
+	const ECADrvrCalls_t *drvr = pXO2->pDrvrCalls;
+	uint8_t buf[XO2ECA_CMD_WRITE_BATCH][4+XO2_FLASH_PAGE_SIZE];
+	XO2Frame_t frames[XO2ECA_CMD_WRITE_BATCH];
+	XO2Timing_t timing;
+	unsigned i, n, batch, done, checked, frameUs, pace, startPg;
+	uint8_t *start = data;
+	int status;
+
+	XO2_getTiming(pXO2, &timing);
+	frameUs = XO2_frameUs(pXO2, 4+XO2_FLASH_PAGE_SIZE);
+	pace = frameUs < timing.progUs ? timing.progUs - frameUs : 0;
+
+	batch = XO2ECA_CMD_WRITE_BATCH;
+	if (drvr->writeFrames == NULL || pace)
+		batch = 1;
+	else if (drvr->maxFrames < batch)
+		batch = drvr->maxFrames;
+
+	startPg = pXO2->curPage;
+	pXO2->failPage = -1;
+	checked = 0;
+	for (done = 0;done < numPgs;done += n) {
+		n = numPgs - done > batch ? batch : numPgs - done;
+
+		for (i = 0;i < n;++i) {
+			buf[i][0] = reg;
+			buf[i][1] = 0x00; // arg0
+			buf[i][2] = 0x00; // arg1
+			buf[i][3] = 0x01; // arg2, one page per frame
+			memcpy(buf[i]+4, data, XO2_FLASH_PAGE_SIZE);
+			frames[i].pBuf = buf[i];
+			frames[i].len = 4+XO2_FLASH_PAGE_SIZE;
+			data += XO2_FLASH_PAGE_SIZE;
+		}
+
+		if (n > 1)
+			status = XO2_writeFrames(pXO2, frames, n);
+		else
+			status = XO2_xfer(pXO2, frames[0].pBuf, frames[0].len, NULL, 0);
+		if (status != OK)
+			return ERROR;
+		pXO2->curPage += n;
+
+		if (done + n - checked < XO2ECA_CMD_STATUS_INTERVAL && done + n < numPgs) {
+			XO2_delay(pXO2, pace);
+			continue;
+		}
+
+		// Only the last page written can still be programming
+		if (XO2_waitProg(pXO2) != OK) {
+			pXO2->failPage = XO2_locateFail(pXO2, reg == 0x70 ? 0x73 : 0xCA, startPg + checked,
+											start + XO2_FLASH_PAGES_LEN(checked), done + n - checked);
+#ifdef DEBUG_ECA
+			printf("\tFAIL, first bad page %d\n", pXO2->failPage);
+#endif
+			return ERROR;
+		}
+		checked = done + n;
+	}
+
+	return OK;
 }
+
+/* Read numPgs pages with a page read opcode (0x73 Cfg, 0xCA UFM), bursting
+   up to XO2ECA_CMD_READ_BURST pages per command. The page count goes into
+   arg1/arg2 of the operand.
+*/
+static int XO2_readPages(XO2Handle_t *pXO2, uint8_t reg, unsigned numPgs,
+						 uint8_t *data)
+{
+	unsigned n;
+
+	while (numPgs > 0) {
+		n = numPgs > XO2ECA_CMD_READ_BURST ? XO2ECA_CMD_READ_BURST : numPgs;
+
+		if (XO2_read(pXO2, reg, n, XO2_FLASH_PAGES_LEN(n), data) != OK)
+			return ERROR;
+		pXO2->curPage += n;
+
+		data += XO2_FLASH_PAGES_LEN(n);
+		numPgs -= n;
+	}
+
+	return OK;
+}
+
 /**
  * Read the 4 byte Device ID from the XO2 Configuration logic block.
  * This function assembles the command sequence that allows reading the XO2 Device ID
@@ -364,39 +584,40 @@ int XO2ECAcmd_closeCfgIF(XO2Handle_t *pXO2)
 
 /**
  * Issue the Refresh command that updates the SRAM from Flash and boots the XO2.
+ * The Status Register is polled until the part is in user mode, the time that
+ * took is left in pXO2->bootUs.
  *
  * @param pXO2 pointer to the XO2 device to access
- * @return OK if successful, ERROR code if failed to write
+ * @return OK if successful, ERROR if the part did not reach user mode in time
  *
  */
 int XO2ECAcmd_Refresh(XO2Handle_t *pXO2)
 {
 	int status;
-	unsigned int sr;
+	unsigned int us;
+	XO2Timing_t timing;
+	uint64_t start;
 
 #ifdef DEBUG_ECA
 	printf("XO2ECAcmd_Refresh()\n");
 #endif
 	status = XO2_write(pXO2, 0x79, 0, 0, NULL);
-
-	usleep(XO2DevList[pXO2->devType].Trefresh*1000);
-
-	if (XO2ECAcmd_readStatusReg(pXO2, &sr) != OK)
-		return(ERROR);
-
+	start = XO2_nowUs();
 #ifdef DEBUG_ECA
-	printf("\tstatus=%d   sr=%x\n", status, sr);
+	printf("\tstatus=%d\n", status);
 #endif
-	// Verify that only DONE bit is definitely set and not FAIL or BUSY or ISC_ENABLED
-	if ((sr & 0x3f00) == 0x0100)
-	{
-		pXO2->cfgEn = false;
-		return(OK);
-	}
-	else
-	{
+
+	// Poll until only DONE is set, not FAIL or BUSY or ISC_ENABLED: user mode
+	pXO2->bootUs = 0;
+	XO2_getTiming(pXO2, &timing);
+	if (XO2_waitStatus(pXO2, start, timing.refreshUs, 0x3f00, 0x0100, &us) != OK)
 		return(ERROR);
-	}
+
+	pXO2->bootUs = us;
+	if (pXO2->pMeasured && us > pXO2->pMeasured->refreshUs)
+		pXO2->pMeasured->refreshUs = us;
+	pXO2->cfgEn = false;
+	return(OK);
 }
 
 
@@ -404,15 +625,16 @@ int XO2ECAcmd_Refresh(XO2Handle_t *pXO2)
  * Issue the Done command that updates the Program DONE bit.
  * Typically used after programming the Cfg Flash and before
  * closing access to the configuration interface.
+ * The Status Register is polled until DONE reads as set.
  *
  * @param pXO2 pointer to the XO2 device to access
- * @return OK if successful, ERROR code if failed to write
+ * @return OK if successful, ERROR code if failed to write or DONE did not set
  *
  */
 int XO2ECAcmd_setDone(XO2Handle_t *pXO2)
 {
 	int status;
-	unsigned int sr;
+	unsigned int us;
 
 #ifdef DEBUG_ECA
 	printf("XO2ECAcmd_setDone()\n");
@@ -424,31 +646,11 @@ int XO2ECAcmd_setDone(XO2Handle_t *pXO2)
 	}
 
 	status = XO2_write(pXO2, 0x5E, 0, 0, NULL);
-
-// TODO: This delay time may be excessive
-
-	if (status == OK)
-	{
-		// Wait 10 msec for Done
-		usleep(10000);
-	}
-	else
-	{
-		return(ERROR);
-	}
-
-	if (XO2ECAcmd_readStatusReg(pXO2, &sr) != OK)
+	if (status != OK)
 		return(ERROR);
 
-	// Verify that DONE bit is definitely set and not FAIL or BUSY
-	if ((sr & 0x3100) == 0x0100)
-	{
-		return(OK);
-	}
-	else
-	{
-		return(ERROR);
-	}
+	// Poll until DONE is set and not FAIL or BUSY, the old fixed wait is the bound
+	return(XO2_waitStatus(pXO2, XO2_nowUs(), XO2ECA_DONE_US, 0x3100, 0x0100, &us));
 }
 
 
@@ -496,9 +698,8 @@ int XO2ECAcmd_readStatusReg(XO2Handle_t *pXO2, unsigned int *pVal)
  * Wait for the Status register to report no longer busy.
  * Read the 4 byte Status Register from the XO2 Configuration logic block and check bit 12
  * to see if BUSY.  Also check bit 13 for FAIL indication.  Return error if an error
- * condition is detected.  Also return if exceed polling loop timeout.
- * This function assembles the command sequence that allows reading the XO2 Status Register.
- * The command is first written to the XO2, then a read of 4 bytes is perfromed to return the value.
+ * condition is detected.  Also return if exceed polling timeout.
+ * Same as XO2ECAcmd_waitBusy() for an operation that is expected to be done already.
  *
  * @param pXO2 pointer to the XO2 device to access
  * @return OK if no longer Busy and can proceed, ERROR if failed to read.
@@ -506,38 +707,215 @@ int XO2ECAcmd_readStatusReg(XO2Handle_t *pXO2, unsigned int *pVal)
  */
 int XO2ECAcmd_waitStatusBusy(XO2Handle_t *pXO2)
 {
-	unsigned char data[4];
-	int status;
-	int loop;
-
 #ifdef DEBUG_ECA
 	printf("XO2ECAcmd_waitStatusBusy()\n");
 #endif
 
-	loop = XO2ECA_CMD_LOOP_TIMEOUT;
-	do
+	return(XO2ECAcmd_waitBusy(pXO2, 0));
+}
+
+
+
+/**
+ * Wait for an operation that is expected to take expectUs microseconds to complete.
+ * The first poll happens after expectUs, further polls back off exponentially from
+ * 1/16th up to 1/4th of the expected duration (bounded by XO2ECA_POLL_MIN_US and
+ * XO2ECA_POLL_MAX_US), so short page programs are picked up within a few tens of
+ * microseconds while multi-second erases only cost a handful of polls.
+ * <p>
+ * Short operations poll the 4 byte Status Register, which reports BUSY and FAIL in a
+ * single read.  Operations of XO2ECA_POLL_FLAG_MIN_US or longer poll the 1 byte Busy
+ * Flag instead and read the Status Register once at the end to check FAIL.
+ * Gives up after 4 times the expected duration, but no earlier than
+ * XO2ECA_CMD_BUSY_TIMEOUT_US.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param expectUs expected duration of the operation in progress
+ * @return OK if no longer Busy and did not fail, ERROR if failed, timed out or failed to read.
+ *
+ */
+int XO2ECAcmd_waitBusy(XO2Handle_t *pXO2, unsigned int expectUs)
+{
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_waitBusy(%u)\n", expectUs);
+#endif
+
+	return(XO2_waitBusy(pXO2, expectUs, NULL));
+}
+
+/* XO2ECAcmd_waitBusy() for an operation started at start (XO2_nowUs() time),
+   the expected duration and the timeout count from there.  If pMeasuredUs is
+   set the operation is timed instead: polling starts right away at 1/64th of
+   the expected duration and the time until BUSY cleared is recorded in
+   *pMeasuredUs if it is the longest so far.
+*/
+static int XO2_pollBusy(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs, unsigned *pMeasuredUs)
+{
+	unsigned char data[4];
+	unsigned int delay, maxDelay;
+	uint64_t deadline, elapsed;
+	bool useFlag, busy;
+
+	deadline = start + (expectUs * 4ull > XO2ECA_CMD_BUSY_TIMEOUT_US ?
+							  expectUs * 4ull : XO2ECA_CMD_BUSY_TIMEOUT_US);
+	useFlag = expectUs >= XO2ECA_POLL_FLAG_MIN_US;
+
+	delay = expectUs / 16;
+	if (delay < XO2ECA_POLL_MIN_US)
+		delay = XO2ECA_POLL_MIN_US;
+	maxDelay = expectUs / 4;
+	if (maxDelay < XO2ECA_POLL_MIN_US)
+		maxDelay = XO2ECA_POLL_MIN_US;
+	if (maxDelay > XO2ECA_POLL_MAX_US)
+		maxDelay = XO2ECA_POLL_MAX_US;
+	if (delay > maxDelay)
+		delay = maxDelay;
+
+	if (pMeasuredUs)
+	{
+		delay = maxDelay = expectUs / 64 > XO2ECA_POLL_MIN_US ? expectUs / 64 : XO2ECA_POLL_MIN_US;
+	}
+	else
 	{
-		status = XO2_read(pXO2, 0x3C, 0, 4, data);
+		elapsed = XO2_nowUs() - start;
+		if (elapsed < expectUs)
+			XO2_delay(pXO2, expectUs - elapsed);
+	}
 
-		if (status != OK)
-			return(ERROR);
+	while (true)
+	{
+		if (pXO2->pStats)
+			pXO2->pStats->busyPolls++;
 
-		if (data[2] & 0x20)  // FAIL bit set
-			return(ERROR);
+		busy = false;
+		if (useFlag)
+		{
+			if (XO2_read(pXO2, 0xF0, 0, 1, data) != OK)
+				return(ERROR);
+			busy = (data[0] & 0x80) != 0;
+		}
 
-		if (data[2] & 0x10)
+		if (!busy)
 		{
-			// Still busy so wait another msec and loop again, if not timed out
-			--loop;
-			usleep(1000); // delay 1 msec
+			// Status register for BUSY/FAIL, or to catch a failure once the flag cleared
+			if (XO2_read(pXO2, 0x3C, 0, 4, data) != OK)
+				return(ERROR);
+
+			if (data[2] & 0x20)  // FAIL bit set
+				return(ERROR);
+
+			if (!(data[2] & 0x10))
+			{
+				// BUSY bit clear
+				if (pMeasuredUs && XO2_nowUs() - start > *pMeasuredUs)
+					*pMeasuredUs = XO2_nowUs() - start;
+				return(OK);
+			}
 		}
 
-	} while(loop && (data[2] & 0x10));
+		if (XO2_nowUs() >= deadline)
+			return(ERROR);   // timed out waiting for BUSY to clear
 
-	if (loop)
-		return(OK);
-	else
-		return(ERROR);   // timed out waiting for BUSY to clear
+		// Still busy, back off and poll again
+		XO2_delay(pXO2, delay);
+		delay *= 2;
+		if (delay > maxDelay)
+			delay = maxDelay;
+	}
+}
+
+static int XO2_waitBusySince(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs, unsigned *pMeasuredUs)
+{
+	uint64_t now;
+	int status;
+
+	if (!pXO2->pStats)
+		return XO2_pollBusy(pXO2, start, expectUs, pMeasuredUs);
+
+	now = XO2_nowUs();
+	status = XO2_pollBusy(pXO2, start, expectUs, pMeasuredUs);
+	pXO2->pStats->busyWaits++;
+	pXO2->pStats->busyUs += XO2_nowUs() - now;
+	return status;
+}
+
+static int XO2_waitBusy(XO2Handle_t *pXO2, unsigned expectUs, unsigned *pMeasuredUs)
+{
+	return XO2_waitBusySince(pXO2, XO2_nowUs(), expectUs, pMeasuredUs);
+}
+
+/* Poll the Status Register until the bits in mask read as want, for an
+   operation started at start (XO2_nowUs() time) that takes about expectUs.
+   Polls are due on absolute deadlines from start, XO2ECA_POLL_MIN_US apart
+   at first and backing off to expectUs/16.  A failed read is retried, the
+   part may not answer while it boots.  FAIL ends the wait.  Gives up after
+   4 times expectUs, at least XO2ECA_STATUS_TIMEOUT_US.
+   Returns OK and the time from start until the bits matched in *pUs.
+*/
+static int XO2_pollStatus(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs,
+						  unsigned mask, unsigned want, unsigned *pUs)
+{
+	unsigned int sr, interval, maxInterval;
+	uint64_t due, deadline, now;
+
+	deadline = start + (expectUs * 4ull > XO2ECA_STATUS_TIMEOUT_US ?
+							  expectUs * 4ull : XO2ECA_STATUS_TIMEOUT_US);
+
+	maxInterval = expectUs / 16;
+	if (maxInterval < XO2ECA_POLL_MIN_US)
+		maxInterval = XO2ECA_POLL_MIN_US;
+	if (maxInterval > XO2ECA_POLL_MAX_US)
+		maxInterval = XO2ECA_POLL_MAX_US;
+
+	interval = XO2ECA_POLL_MIN_US;
+	due = start + interval;
+	while (true)
+	{
+		XO2_sleepUntil(pXO2, due);
+		if (pXO2->pStats)
+			pXO2->pStats->busyPolls++;
+
+		if (XO2ECAcmd_readStatusReg(pXO2, &sr) == OK)
+		{
+#ifdef DEBUG_ECA
+			printf("\tsr=%x\n", sr);
+#endif
+			if ((sr & mask) == want)
+			{
+				*pUs = XO2_nowUs() - start;
+				return(OK);
+			}
+			if (sr & 0x2000)  // FAIL bit set
+				return(ERROR);
+		}
+
+		now = XO2_nowUs();
+		if (now >= deadline)
+			return(ERROR);   // timed out
+
+		interval *= 2;
+		if (interval > maxInterval)
+			interval = maxInterval;
+		due += interval;
+		if (due < now)
+			due = now;   // fell behind on a slow bus, poll right away
+	}
+}
+
+static int XO2_waitStatus(XO2Handle_t *pXO2, uint64_t start, unsigned expectUs,
+						  unsigned mask, unsigned want, unsigned *pUs)
+{
+	uint64_t now;
+	int status;
+
+	if (!pXO2->pStats)
+		return XO2_pollStatus(pXO2, start, expectUs, mask, want, pUs);
+
+	now = XO2_nowUs();
+	status = XO2_pollStatus(pXO2, start, expectUs, mask, want, pUs);
+	pXO2->pStats->busyWaits++;
+	pXO2->pStats->busyUs += XO2_nowUs() - now;
+	return status;
 }
 
 
@@ -602,9 +980,14 @@ int XO2ECAcmd_waitBusyFlag(XO2Handle_t *pXO2)
 	printf("XO2ECAcmd_waitBusyFlag()\n");
 #endif
 
+	if (pXO2->pStats)
+		pXO2->pStats->busyWaits++;
+
 	loop = XO2ECA_CMD_LOOP_TIMEOUT;
 	do
 	{
+		if (pXO2->pStats)
+			pXO2->pStats->busyPolls++;
 		status = XO2_read(pXO2, 0xF0, 0, 1, data);
 
 		if (status != OK)
@@ -614,7 +997,7 @@ int XO2ECAcmd_waitBusyFlag(XO2Handle_t *pXO2)
 		{
 			// Still busy so wait another msec
 			--loop;
-			usleep(1000);   // delay 1 msec
+			XO2_delay(pXO2, 1000);   // delay 1 msec
 		}
 
 	} while(loop && data[0]);
@@ -639,8 +1022,6 @@ int XO2ECAcmd_Bypass(XO2Handle_t *pXO2)
 {
 	unsigned char cmd[1];
 	int status;
-	struct i2c_rdwr_ioctl_data i2c_req;
-	struct i2c_msg i2c_msgs[1];
 
 #ifdef DEBUG_ECA
 	printf("XO2ECAcmd_Bypass()\n");
@@ -650,21 +1031,8 @@ int XO2ECAcmd_Bypass(XO2Handle_t *pXO2)
 //	cmd[1] = 0x00;  // arg0
 //	cmd[2] = 0x00;  // arg1
 //	cmd[3] = 0x00;  // arg2
-	i2c_msgs[0].addr = pXO2->addr;
-	i2c_msgs[0].flags = 0;
-	i2c_msgs[0].len = 1;
-	i2c_msgs[0].buf = cmd;
 
-	i2c_req.msgs = i2c_msgs;
-	i2c_req.nmsgs = 1;
-
-	status = ioctl(pXO2->i2cfd, I2C_RDWR, &i2c_req);
-
-	if (status != -1) {
-		status = OK;
-	} else {
-		status = ERROR;
-	}
+	status = XO2_xfer(pXO2, cmd, 1, NULL, 0);
 
 
 #ifdef DEBUG_ECA
@@ -735,6 +1103,7 @@ int XO2ECAcmd_SetPage(XO2Handle_t *pXO2, XO2SectorMode_t mode, unsigned int page
 	cmd[3] = (unsigned char)pageNum;       // page[3] = page number LSB
 
 	status = XO2_write(pXO2, 0xB4, 0, 4, cmd);
+	pXO2->curPage = pageNum;
 
 #ifdef DEBUG_ECA
 	printf("\tstatus=%d\n", status);
@@ -775,6 +1144,32 @@ int XO2ECAcmd_EraseFlash(XO2Handle_t *pXO2, unsigned char mode)
 	printf("XO2ECAcmd_EraseFlash()\n");
 #endif
 
+	status = XO2ECAcmd_EraseFlashStart(pXO2, mode);
+	if (status == OK)
+		status = XO2ECAcmd_EraseFlashWait(pXO2);
+
+	return(status);
+}
+
+
+/**
+ * Start erasing sectors of the XO2 Flash memory without waiting for the erase
+ * to finish.  The host can get on with other work meanwhile, but must not send
+ * any command to the XO2 before XO2ECAcmd_EraseFlashWait().
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param mode bit map of what sector contents to erase, as for XO2ECAcmd_EraseFlash()
+ * @return OK if the erase was started, ERROR if failed.
+ *
+ */
+int XO2ECAcmd_EraseFlashStart(XO2Handle_t *pXO2, unsigned char mode)
+{
+	int status;
+
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_EraseFlashStart()\n");
+#endif
+
 	if (pXO2->cfgEn == false)
 	{
 #ifdef DEBUG_ECA
@@ -787,21 +1182,49 @@ int XO2ECAcmd_EraseFlash(XO2Handle_t *pXO2, unsigned char mode)
 
 	status = XO2_write(pXO2, 0x0E, mode<<16, 0, NULL);
 
-	if (status == OK)
-	{
-		// Must wait an amount of time, based on device size, for largest flash sector to erase.
-		if (mode & XO2ECA_CMD_ERASE_CFG)
-			usleep(XO2DevList[pXO2->devType].CfgErase*1000);  // longest
-		else if (mode & XO2ECA_CMD_ERASE_UFM)
-			usleep(XO2DevList[pXO2->devType].UFMErase*1000);  // medium
-		else
-			usleep(50000);	// SRAM & Feature Row = shortest
+#ifdef DEBUG_ECA
+	printf("\tstatus=%d\n", status);
+#endif
+	if (status != OK)
+		return(ERROR);
 
-		status = XO2ECAcmd_waitStatusBusy(pXO2);
-	}
+	pXO2->eraseMode = mode;
+	pXO2->eraseStartUs = XO2_nowUs();
+	return(OK);
+}
+
+
+/**
+ * Wait for the erase started by XO2ECAcmd_EraseFlashStart() to finish.
+ * The expected erase time counts from the start of the erase, so host work
+ * done in between shortens the wait.  Returns at once if no erase is pending.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @return OK if successful, ERROR if the erase failed or timed out.
+ *
+ */
+int XO2ECAcmd_EraseFlashWait(XO2Handle_t *pXO2)
+{
+	int status;
+	unsigned char mode;
+	XO2Timing_t timing;
+
+	mode = pXO2->eraseMode;
+	if (mode == 0)
+		return(OK);
+	pXO2->eraseMode = 0;
+
+	// Must wait an amount of time, based on device size, for largest flash sector to erase.
+	XO2_getTiming(pXO2, &timing);
+	if (mode & XO2ECA_CMD_ERASE_CFG)
+		status = XO2_waitBusySince(pXO2, pXO2->eraseStartUs, timing.cfgEraseUs, XO2_MEASURED(pXO2, cfgEraseUs));  // longest
+	else if (mode & XO2ECA_CMD_ERASE_UFM)
+		status = XO2_waitBusySince(pXO2, pXO2->eraseStartUs, timing.ufmEraseUs, XO2_MEASURED(pXO2, ufmEraseUs));  // medium
+	else
+		status = XO2_waitBusySince(pXO2, pXO2->eraseStartUs, timing.miscEraseUs, XO2_MEASURED(pXO2, miscEraseUs));	// SRAM & Feature Row = shortest
 
 #ifdef DEBUG_ECA
-	printf("\tstatus=%d\n", status);
+	printf("XO2ECAcmd_EraseFlashWait() status=%d\n", status);
 #endif
 	if (status == OK)
 	{
@@ -845,6 +1268,7 @@ int XO2ECAcmd_CfgResetAddr(XO2Handle_t *pXO2)
 	}
 
 	status = XO2_write(pXO2, 0x46, 0, 0, NULL);
+	pXO2->curPage = 0;
 
 #ifdef DEBUG_ECA
 	printf("\tstatus=%d\n", status);
@@ -869,8 +1293,8 @@ int XO2ECAcmd_CfgResetAddr(XO2Handle_t *pXO2)
  * @param pBuf pointer to the 16 byte array to return the Config page bytes in.
  * @return OK if successful, ERROR if failed to read.
  *
- * @note There is no advantage to reading multiple pages since the interface
- * is most likely so slow.  The I2C only runs at 100kHz.
+ * @note Use XO2ECAcmd_CfgReadPages() when reading more than one page, the
+ * per-transaction overhead dominates at these transfer sizes.
  *
  * @note The number of pages read is not comparted against the total pages in the
  * device.  Reading too far may have unexpected results.
@@ -894,6 +1318,7 @@ int XO2ECAcmd_CfgReadPage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 
 	status = XO2_read(pXO2, 0x73, 0x000001, XO2_FLASH_PAGE_SIZE, data);
+	pXO2->curPage++;
 
 #ifdef DEBUG_ECA
 	printf("\tstatus=%d  data=", status);
@@ -914,6 +1339,39 @@ int XO2ECAcmd_CfgReadPage(XO2Handle_t *pXO2, unsigned char *pBuf)
 }
 
 
+/**
+ * Read the next numPgs pages (numPgs * 16 bytes) from the Config Flash memory.
+ * The pages are requested in bursts of up to XO2ECA_CMD_READ_BURST pages, each
+ * burst being a single read command with the page count in its operand, so a full
+ * sector readback costs a handful of bus transactions instead of one per page.
+ * Page address can be set using SetAddress command and advances past the pages read.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param numPgs number of pages to read
+ * @param pBuf pointer to the numPgs * 16 byte array to return the Config page bytes in.
+ * @return OK if successful, ERROR if failed to read.
+ *
+ * @note The number of pages read is not comparted against the total pages in the
+ * device.  Reading too far may have unexpected results.
+ */
+int XO2ECAcmd_CfgReadPages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf)
+{
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_CfgReadPages(%u)\n", numPgs);
+#endif
+
+	if (pXO2->cfgEn == false)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NOT_IN_CFG_MODE\n");
+#endif
+		return(ERR_XO2_NOT_IN_CFG_MODE);
+	}
+
+	return(XO2_readPages(pXO2, 0x73, numPgs, pBuf));
+}
+
+
 /**
  * Write a page (16 bytes) into the current UFM memory page.
  * Page address can be set using SetAddress command.
@@ -947,13 +1405,13 @@ int XO2ECAcmd_CfgWritePage(XO2Handle_t *pXO2, unsigned char *pBuf)
 
 
 	status = XO2_write(pXO2, 0x70, 0x000001, 16, pBuf);
+	pXO2->curPage++;
 
 	if (status == OK)
 	{
 		// Must wait 200 usec for a page to program.  This is a constant for all
 		// devices (see XO2 datasheet)
-		usleep(200);
-		status = XO2ECAcmd_waitStatusBusy(pXO2);
+		status = XO2_waitProg(pXO2);
 	}
 
 #ifdef DEBUG_ECA
@@ -969,6 +1427,39 @@ int XO2ECAcmd_CfgWritePage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 }
 
+/**
+ * Write numPgs pages (numPgs * 16 bytes) into the Config Flash memory, starting
+ * at the current page.  Pages are written back-to-back paced against the bus
+ * clock, BUSY/FAIL is only checked every XO2ECA_CMD_STATUS_INTERVAL pages and
+ * after the last one.  On FAIL the first page that did not program is stored in
+ * pXO2->failPage.
+ * Page address advances past the pages written.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param numPgs number of pages to write
+ * @param pBuf pointer to the numPgs * 16 byte array to write into the Config pages.
+ * @return OK if successful, ERROR if failed to write.
+ *
+ * @note Programming must be done on a page basis.  Pages must be erased to 0's first.
+ * @see XO2ECAcmd_CfgErase
+ */
+int XO2ECAcmd_CfgWritePages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf)
+{
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_CfgWritePages(%u)\n", numPgs);
+#endif
+
+	if (pXO2->cfgEn == false)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NOT_IN_CFG_MODE\n");
+#endif
+		return(ERR_XO2_NOT_IN_CFG_MODE);
+	}
+
+	return(XO2_writePages(pXO2, 0x70, numPgs, pBuf));
+}
+
 /**
  * Erase the entire sector of the Configuration Flash memory.
  * This is a convience function to erase all Config contents to 0.  You can not erase on a page basis.
@@ -1032,6 +1523,7 @@ int XO2ECAcmd_UFMResetAddr(XO2Handle_t *pXO2)
 	}
 
 	status = XO2_write(pXO2, 0x47, 0, 0, NULL);
+	pXO2->curPage = 0;
 
 #ifdef DEBUG_ECA
 	printf("\tstatus=%d\n", status);
@@ -1056,8 +1548,8 @@ int XO2ECAcmd_UFMResetAddr(XO2Handle_t *pXO2)
  * @param pBuf pointer to the 16 byte array to return the UFM page bytes in.
  * @return OK if successful, ERROR if failed to read.
  *
- * @note There is no advantage to reading multiple pages since the interface
- * is most likely so slow.  The I2C only runs at 100kHz.
+ * @note Use XO2ECAcmd_UFMReadPages() when reading more than one page, the
+ * per-transaction overhead dominates at these transfer sizes.
  *
  */
 int XO2ECAcmd_UFMReadPage(XO2Handle_t *pXO2, unsigned char *pBuf)
@@ -1087,6 +1579,7 @@ int XO2ECAcmd_UFMReadPage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 
 	status = XO2_read(pXO2, 0xCA, 0x000001, 16, data);
+	pXO2->curPage++;
 
 #ifdef DEBUG_ECA
 	printf("\tstatus=%d  data=", status);
@@ -1106,6 +1599,42 @@ int XO2ECAcmd_UFMReadPage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 }
 
+/**
+ * Read the next numPgs pages (numPgs * 16 bytes) from the UFM memory.
+ * Same burst behaviour as XO2ECAcmd_CfgReadPages().
+ * Page address can be set using SetAddress command and advances past the pages read.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param numPgs number of pages to read
+ * @param pBuf pointer to the numPgs * 16 byte array to return the UFM page bytes in.
+ * @return OK if successful, ERROR if failed to read.
+ *
+ */
+int XO2ECAcmd_UFMReadPages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf)
+{
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_UFMReadPages(%u)\n", numPgs);
+#endif
+
+	if (pXO2->cfgEn == false)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NOT_IN_CFG_MODE\n");
+#endif
+		return(ERR_XO2_NOT_IN_CFG_MODE);
+	}
+
+	if (pXO2->devType == MachXO2_256)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NO_UFM\n");
+#endif
+		return(ERR_XO2_NO_UFM);
+	}
+
+	return(XO2_readPages(pXO2, 0xCA, numPgs, pBuf));
+}
+
 /**
  * Write a page (16 bytes) into the current UFM memory page.
  * Page address can be set using SetAddress command.
@@ -1144,12 +1673,12 @@ int XO2ECAcmd_UFMWritePage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 
 	status = XO2_write(pXO2, 0xC9, 0x000001, 16, pBuf);
+	pXO2->curPage++;
 
 	if (status == OK)
 	{
 		// Must wait 200 usec for a page to program.  This is a constant for all devices (see XO2 datasheet)
-		usleep(200);
-		status = XO2ECAcmd_waitStatusBusy(pXO2);
+		status = XO2_waitProg(pXO2);
 	}
 
 #ifdef DEBUG_ECA
@@ -1165,6 +1694,44 @@ int XO2ECAcmd_UFMWritePage(XO2Handle_t *pXO2, unsigned char *pBuf)
 	}
 }
 
+/**
+ * Write numPgs pages (numPgs * 16 bytes) into the UFM memory, starting at the
+ * current page.  Same pacing and status checks as XO2ECAcmd_CfgWritePages().
+ * Page address advances past the pages written.
+ *
+ * @param pXO2 pointer to the XO2 device to access
+ * @param numPgs number of pages to write
+ * @param pBuf pointer to the numPgs * 16 byte array to write into the UFM pages.
+ * @return OK if successful, ERROR if failed to write.
+ *
+ * @note Programming must be done on a page basis.  Pages must be erased to 0's first.
+ * @see XO2ECAcmd_UFMErase
+ */
+int XO2ECAcmd_UFMWritePages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf)
+{
+#ifdef DEBUG_ECA
+	printf("XO2ECAcmd_UFMWritePages(%u)\n", numPgs);
+#endif
+
+	if (pXO2->cfgEn == false)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NOT_IN_CFG_MODE\n");
+#endif
+		return(ERR_XO2_NOT_IN_CFG_MODE);
+	}
+
+	if (pXO2->devType == MachXO2_256)
+	{
+#ifdef DEBUG_ECA
+		printf("\tERR_XO2_NO_UFM\n");
+#endif
+		return(ERR_XO2_NO_UFM);
+	}
+
+	return(XO2_writePages(pXO2, 0xC9, numPgs, pBuf));
+}
+
 /**
  * Erase the entire sector of the UFM memory.
  * This is a convience function to erase all UFM contents to 0.  You can not erase on a page basis.
@@ -1258,7 +1825,9 @@ int XO2ECAcmd_FeatureRowWrite(XO2Handle_t *pXO2, XO2FeatureRow_t *pFeature)
 
 	// Must wait 200 usec for a page to program.  This is a constant for all
 	// devices (see XO2 datasheet)
-	usleep(200);
+	status = XO2_waitProg(pXO2);
+	if (status != OK)
+		return(ERROR);
 
 	status = XO2_write(pXO2, 0xF8, 0, 2, pFeature->feabits);
 
@@ -1266,8 +1835,7 @@ int XO2ECAcmd_FeatureRowWrite(XO2Handle_t *pXO2, XO2FeatureRow_t *pFeature)
 	{
 		// Must wait 200 usec for a page to program.  This is a constant for all
 		// devices (see XO2 datasheet)
-	    usleep(200);
-		status = XO2ECAcmd_waitStatusBusy(pXO2);
+		status = XO2_waitProg(pXO2);
 	}
 
 	if (status == OK)
@@ -26,11 +26,25 @@
 
 
 #define XO2ECA_CMD_LOOP_TIMEOUT    10000 // number of times to poll in a loop before aborting
+#define XO2ECA_CMD_BUSY_TIMEOUT_US 10000000 // minimum time to wait for BUSY to clear before aborting
+
+#define XO2ECA_PROG_PAGE_US     200      // page program time, same for all devices (see XO2 datasheet)
+#define XO2ECA_POLL_MIN_US      20       // shortest delay between two busy polls
+#define XO2ECA_POLL_MAX_US      100000   // longest delay between two busy polls
+#define XO2ECA_POLL_FLAG_MIN_US 10000    // poll the 1 byte Busy Flag for operations this long or longer
+#define XO2ECA_STATUS_TIMEOUT_US 100000  // minimum time to wait for DONE or user mode before aborting
+#define XO2ECA_DONE_US          10000    // longest time for DONE to set after the Done command
 #define XO2ECA_CMD_ERASE_UFM   8
 #define XO2ECA_CMD_ERASE_CFG   4
 #define XO2ECA_CMD_ERASE_FTROW 2
 #define XO2ECA_CMD_ERASE_SRAM  1
 
+#define XO2ECA_CMD_READ_BURST  256   // max pages requested by one multi-page read command
+#define XO2ECA_CMD_WRITE_BATCH 42    // max page frames per driver writeFrames() call
+#define XO2ECA_CMD_STATUS_INTERVAL 256  // pages written between two BUSY/FAIL checks
+#define XO2ECA_CMD_SKIP_PAGES  3     // all 0 pages worth a SetPage plus a BUSY check to skip them
+#define XO2ECA_BUS_DEFAULT_HZ  400000   // assumed bus clock if the driver does not know, max for XO2 I2C
+
 
 
 //--------------------------------------------
@@ -49,12 +63,15 @@ int XO2ECAcmd_openCfgIF(XO2Handle_t *pXO2, XO2CfgMode_t mode);
 int XO2ECAcmd_readStatusReg(XO2Handle_t *pXO2, unsigned int *pVal) ;
 int XO2ECAcmd_readBusyFlag(XO2Handle_t *pXO2, unsigned char *pVal) ;
 int XO2ECAcmd_waitStatusBusy(XO2Handle_t *pXO2) ;
+int XO2ECAcmd_waitBusy(XO2Handle_t *pXO2, unsigned int expectUs) ;
 int XO2ECAcmd_waitBusyFlag(XO2Handle_t *pXO2) ;
 
 
 int XO2ECAcmd_SetPage(XO2Handle_t *pXO2, XO2SectorMode_t mode, unsigned int pageNum) ;
 
 int XO2ECAcmd_EraseFlash(XO2Handle_t *pXO2, unsigned char mode) ;
+int XO2ECAcmd_EraseFlashStart(XO2Handle_t *pXO2, unsigned char mode) ;
+int XO2ECAcmd_EraseFlashWait(XO2Handle_t *pXO2) ;
 int XO2ECAcmd_SRAMErase(XO2Handle_t *pXO2) ;
 
 
@@ -68,7 +85,9 @@ int XO2ECAcmd_Refresh(XO2Handle_t *pXO2);
 int XO2ECAcmd_CfgErase(XO2Handle_t *pXO2) ;
 int XO2ECAcmd_CfgResetAddr(XO2Handle_t *pXO2) ;
 int XO2ECAcmd_CfgReadPage(XO2Handle_t *pXO2, unsigned char *pBuf) ;
+int XO2ECAcmd_CfgReadPages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf) ;
 int XO2ECAcmd_CfgWritePage(XO2Handle_t *pXO2, unsigned char *pBuf) ;
+int XO2ECAcmd_CfgWritePages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf) ;
 
 
 
@@ -78,7 +97,9 @@ int XO2ECAcmd_CfgWritePage(XO2Handle_t *pXO2, unsigned char *pBuf) ;
 int XO2ECAcmd_UFMErase(XO2Handle_t *pXO2) ;
 int XO2ECAcmd_UFMResetAddr(XO2Handle_t *pXO2);
 int XO2ECAcmd_UFMWritePage(XO2Handle_t *pXO2, unsigned char *pBuf) ;
+int XO2ECAcmd_UFMWritePages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf) ;
 int XO2ECAcmd_UFMReadPage(XO2Handle_t *pXO2, unsigned char *pBuf) ;
+int XO2ECAcmd_UFMReadPages(XO2Handle_t *pXO2, unsigned int numPgs, unsigned char *pBuf) ;
 
 
 
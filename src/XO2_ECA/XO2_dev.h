@@ -32,7 +32,7 @@
 #define ERROR -1
 
 #define XO2_FLASH_PAGE_SIZE (16)   /**< 16 bytes per page in Cfg and UFM sectors */
-#define XO2_FLASH_PAGES_LEN(n) (n * XO2_FLASH_PAGE_SIZE)   /**< Number of bytes in that many pages */
+#define XO2_FLASH_PAGES_LEN(n) ((n) * XO2_FLASH_PAGE_SIZE)   /**< Number of bytes in that many pages */
 #define LATTICE_XO2_NUM_DEVS 9
 
 
@@ -100,6 +100,119 @@ typedef struct
 
 
 
+/**
+ * Expected (or measured) durations of the slow configuration logic operations,
+ * in microseconds.  Used in place of the datasheet maxima of XO2DevList when a
+ * timing profile is loaded.
+ * @see XO2timing_load
+ */
+typedef struct
+{
+	unsigned int cfgEraseUs;    /**< Configuration sector erase */
+	unsigned int ufmEraseUs;    /**< UFM sector erase */
+	unsigned int miscEraseUs;   /**< Feature Row / SRAM erase */
+	unsigned int progUs;        /**< Page program */
+	unsigned int refreshUs;     /**< Refresh until user mode */
+} XO2Timing_t;
+
+
+#define XO2STATS_HIST_BINS 24   /**< Latency histogram bins: <1us, then [2^(n-1), 2^n) usec */
+
+/**
+ * Bus transactions of one command opcode.
+ */
+typedef struct
+{
+	uint64_t count;        /**< Commands sent, page frames of a batch count one each */
+	uint64_t errors;       /**< Commands the driver reported an error for */
+	uint64_t bytesWr;      /**< Bytes written, opcode and operands included */
+	uint64_t bytesRd;      /**< Bytes read */
+	uint64_t totalUs;      /**< Time spent in the driver */
+	uint64_t maxUs;        /**< Longest single command */
+	uint32_t hist[XO2STATS_HIST_BINS]; /**< Latency histogram, log2 usec */
+} XO2OpStats_t;
+
+/**
+ * Statistics of the command layer, collected while XO2Handle_t.pStats is set.
+ * @see XO2stats_print
+ */
+typedef struct
+{
+	XO2OpStats_t op[256];  /**< Per command opcode */
+	uint64_t xfers;        /**< Driver calls, a batch of page frames is one */
+	uint64_t busyWaits;    /**< Waits for BUSY to clear */
+	uint64_t busyPolls;    /**< Busy Flag / Status Register reads done while waiting */
+	uint64_t busyUs;       /**< Time spent waiting for BUSY to clear, sleeps included */
+	uint64_t sleeps;       /**< Delays done by the command layer */
+	uint64_t sleepUs;      /**< Time spent in those delays */
+} XO2Stats_t;
+
+
+/**
+ * How far a programming run got: the pages of each sector from page 0 up to
+ * the count are programmed and confirmed by a status check.
+ * @see XO2ECA_apiProgramResume
+ */
+typedef struct
+{
+	unsigned int cfgPgs;   /**< Cfg pages done */
+	unsigned int ufmPgs;   /**< UFM pages done */
+	bool featRow;          /**< Feature Row programmed */
+} XO2Checkpoint_t;
+
+/**
+ * Journal kept by XO2ECA_apiProgram() while XO2Handle_t.pJournal is set.
+ * done is updated and passed to save() after the erase, every
+ * XO2ECA_CMD_STATUS_INTERVAL pages and after the Feature Row.
+ */
+typedef struct
+{
+	void *pCtx;    /**< Passed to save() */
+	/** Record the progress, e.g. in a file.  Returns OK to go on, anything else aborts programming. */
+	int (*save)(void *pCtx, const XO2Checkpoint_t *pDone);
+	XO2Checkpoint_t done;  /**< Progress so far */
+} XO2Journal_t;
+
+
+/**
+ * One frame of a batched write, see ECADrvrCalls_t.writeFrames.
+ */
+typedef struct
+{
+	const uint8_t *pBuf;    /**< Frame bytes, starting with the command opcode */
+	unsigned int  len;      /**< Number of bytes in the frame */
+} XO2Frame_t;
+
+
+/**
+ * Access layer driver calls for one type of communication link to the XO2.
+ * Every call gets the pDrvrParams of the XO2Handle_t it was invoked for.
+ * <p>
+ * xfer() performs one bus transaction: wlen bytes (command opcode plus operands
+ * and data) are written and, if rlen is non-zero, rlen bytes are read back
+ * within the same transaction (repeated start on I2C, chip select held on SPI).
+ * <p>
+ * writeFrames() is optional.  It sends up to maxFrames independent write-only
+ * transactions with as little host overhead as the link allows.  When it is
+ * NULL the command layer falls back to one xfer() per frame.
+ * <p>
+ * delay() is optional as well.  All waits of the command layer go through it
+ * so a driver can account for or replace them, NULL sleeps with usleep().
+ */
+typedef struct
+{
+	const char *pName;      /**< Short name of the link, e.g. "i2c" */
+	int  (*xfer)(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+				 uint8_t *pRd, unsigned int rlen);
+	int  (*writeFrames)(void *pDrvrParams, const XO2Frame_t *pFrames, unsigned int nFrames);
+	void (*close)(void *pDrvrParams);
+	void (*delay)(void *pDrvrParams, unsigned int usec);
+	unsigned int maxFrames; /**< Max number of frames per writeFrames() call */
+} ECADrvrCalls_t;
+
+
+
+
 /**
  * This structure associates the particular XO2 device with the access layer driver
  * functions required for reading/writing bytes to the XO2 device over a supported
@@ -118,8 +231,18 @@ typedef struct
 {
 	bool		cfgEn;    /**< 1=Configuration Logic access is enabled, 0=not */
 	XO2Devices_t	devType;     /**< XO2 part number for information about sizes and programming times */
-	int i2cfd;
-	uint16_t addr;
+	const ECADrvrCalls_t *pDrvrCalls;  /**< Access layer driver for the link to the XO2 */
+	void		*pDrvrParams;  /**< Driver specific state, passed to all driver calls */
+	unsigned int	busHz;     /**< Bus clock set by the driver, used to pace page writes. 0 = unknown */
+	unsigned int	curPage;   /**< Page address register as left by the last page command */
+	int		failPage;  /**< Page found not programmed after a FAIL in a page write or a failed verify, -1 = unknown */
+	const XO2Timing_t *pTiming;  /**< Expected operation times, NULL = XO2DevList maxima */
+	XO2Timing_t	*pMeasured;  /**< If set, operations are timed and the longest duration of each is recorded here */
+	XO2Stats_t	*pStats;   /**< If set, command statistics are added up here */
+	XO2Journal_t	*pJournal;  /**< If set, programming progress is recorded here */
+	unsigned char	eraseMode;  /**< Sectors of an erase started by XO2ECAcmd_EraseFlashStart() not waited for yet, 0 = none */
+	uint64_t	eraseStartUs;  /**< When that erase was started */
+	unsigned int	bootUs;    /**< Time the last XO2ECAcmd_Refresh() took until user mode, 0 = failed */
 
 } XO2Handle_t;
 
@@ -150,6 +273,10 @@ typedef struct
 	unsigned char *pCfgData;
 	unsigned char *pUFMData;
 	XO2FeatureRow_t pFeatureRow;
+	const uint8_t *pPageMap;   /**< Bit per page of pCfgData, then of pUFMData, LSB first: set if the page is not all 0. NULL = not known */
+	uint32_t CfgDigest;        /**< CRC32C of the CfgDataSize bytes of Cfg data */
+	uint32_t UFMDigest;        /**< CRC32C of the UFMDataSize bytes of UFM data */
+	bool digestValid;          /**< CfgDigest and UFMDigest are set */
 } XO2_JEDEC_t;
 
 
@@ -0,0 +1,356 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_drvr.c
+ * Access layer drivers for the links a XO2 configuration port can be reached
+ * over from Linux user space.  Each driver fills in the pDrvrCalls and
+ * pDrvrParams members of a XO2Handle_t, the command layer in XO2_cmds.c only
+ * talks to the device through those.
+ * <ul>
+ * <li> i2c   - i2c-dev I2C_RDWR transfers, commands and reads use a repeated start
+ * <li> smbus - i2c-dev SMBus block writes, for adapters without plain I2C support
+ * <li> spi   - spidev full duplex transfers with chip select held per command
+ * </ul>
+ * The in-process simulator is in XO2_sim.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <linux/spi/spidev.h>
+
+#include "XO2_drvr.h"
+
+#define SPI_MAX_FRAMES 64
+
+typedef struct
+{
+	int fd;
+	uint16_t addr;
+} i2c_params_t;
+
+
+static int open_i2c_dev(int bus)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+	return open(path, O_RDWR);
+}
+
+static void fd_close(void *pDrvrParams)
+{
+	int *fd = pDrvrParams;  // fd is the first member of all parameter structs
+
+	close(*fd);
+	free(pDrvrParams);
+}
+
+
+//==============================================================================
+//                          i 2 c - d e v   I 2 C _ R D W R
+//==============================================================================
+static int i2c_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					uint8_t *pRd, unsigned int rlen)
+{
+	i2c_params_t *p = pDrvrParams;
+	struct i2c_rdwr_ioctl_data i2c_req;
+	struct i2c_msg i2c_msgs[2];
+
+	i2c_msgs[0].addr = p->addr;
+	i2c_msgs[0].flags = 0;
+	i2c_msgs[0].len = wlen;
+	i2c_msgs[0].buf = (uint8_t *)pWr;
+
+	i2c_msgs[1].addr = p->addr;
+	i2c_msgs[1].flags = I2C_M_RD;
+	i2c_msgs[1].len = rlen;
+	i2c_msgs[1].buf = pRd;
+
+	i2c_req.msgs = i2c_msgs;
+	i2c_req.nmsgs = rlen ? 2 : 1;
+
+	if (ioctl(p->fd, I2C_RDWR, &i2c_req) == -1)
+		return ERROR;
+	return OK;
+}
+
+static int i2c_writeFrames(void *pDrvrParams, const XO2Frame_t *pFrames, unsigned int nFrames)
+{
+	i2c_params_t *p = pDrvrParams;
+	struct i2c_rdwr_ioctl_data i2c_req;
+	struct i2c_msg i2c_msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	unsigned int i;
+
+	if (nFrames > I2C_RDWR_IOCTL_MAX_MSGS)
+		return ERROR;
+
+	for (i = 0;i < nFrames;++i) {
+		i2c_msgs[i].addr = p->addr;
+		i2c_msgs[i].flags = 0;
+		i2c_msgs[i].len = pFrames[i].len;
+		i2c_msgs[i].buf = (uint8_t *)pFrames[i].pBuf;
+	}
+
+	i2c_req.msgs = i2c_msgs;
+	i2c_req.nmsgs = nFrames;
+
+	if (ioctl(p->fd, I2C_RDWR, &i2c_req) == -1)
+		return ERROR;
+	return OK;
+}
+
+static const ECADrvrCalls_t i2cDrvrCalls =
+{
+	.pName = "i2c",
+	.xfer = i2c_xfer,
+	.writeFrames = i2c_writeFrames,
+	.close = fd_close,
+	.maxFrames = I2C_RDWR_IOCTL_MAX_MSGS,
+};
+
+/**
+ * Attach the XO2 handle to an I2C bus through i2c-dev I2C_RDWR transfers.
+ *
+ * @param pXO2 pointer to the XO2 device to set up
+ * @param bus number of the /dev/i2c-N device
+ * @param addr 7 bit slave address of the XO2 configuration port
+ * @return OK if successful, ERROR with errno set if the bus could not be opened
+ */
+int XO2drvr_openI2C(XO2Handle_t *pXO2, int bus, uint16_t addr)
+{
+	i2c_params_t *p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return ERROR;
+
+	p->fd = open_i2c_dev(bus);
+	if (p->fd < 0) {
+		free(p);
+		return ERROR;
+	}
+	p->addr = addr;
+
+	pXO2->pDrvrCalls = &i2cDrvrCalls;
+	pXO2->pDrvrParams = p;
+	pXO2->busHz = 0;  // not known from user space, the command layer assumes the XO2 maximum
+	return OK;
+}
+
+
+//==============================================================================
+//                          i 2 c - d e v   S M B u s
+//==============================================================================
+static int smbus_access(int fd, char rw, uint8_t cmd, int size, union i2c_smbus_data *data)
+{
+	struct i2c_smbus_ioctl_data args;
+
+	args.read_write = rw;
+	args.command = cmd;
+	args.size = size;
+	args.data = data;
+
+	if (ioctl(fd, I2C_SMBUS, &args) == -1)
+		return ERROR;
+	return OK;
+}
+
+/* The opcode goes out as the SMBus command byte, operands and data as an
+   I2C block.  SMBus has no way to send more than the command byte before a
+   repeated start, so reads are a separate read transaction after the command
+   has been written.  The XO2 keeps the command until the next START, but
+   adapters that insert a STOP between both may not work with all commands.
+*/
+static int smbus_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					  uint8_t *pRd, unsigned int rlen)
+{
+	i2c_params_t *p = pDrvrParams;
+	union i2c_smbus_data data;
+	int status;
+
+	if (wlen == 0 || wlen - 1 > I2C_SMBUS_BLOCK_MAX)
+		return ERROR;
+
+	if (wlen == 1) {
+		status = smbus_access(p->fd, I2C_SMBUS_WRITE, pWr[0], I2C_SMBUS_BYTE, NULL);
+	} else {
+		data.block[0] = wlen - 1;
+		memcpy(data.block+1, pWr+1, wlen - 1);
+		status = smbus_access(p->fd, I2C_SMBUS_WRITE, pWr[0], I2C_SMBUS_I2C_BLOCK_DATA, &data);
+	}
+	if (status != OK)
+		return ERROR;
+
+	if (rlen && read(p->fd, pRd, rlen) != (ssize_t)rlen)
+		return ERROR;
+
+	return OK;
+}
+
+static const ECADrvrCalls_t smbusDrvrCalls =
+{
+	.pName = "smbus",
+	.xfer = smbus_xfer,
+	.writeFrames = NULL,
+	.close = fd_close,
+	.maxFrames = 0,
+};
+
+/**
+ * Attach the XO2 handle to an I2C bus through i2c-dev SMBus transfers.
+ * Use on adapters that do not implement plain I2C_RDWR transfers.
+ *
+ * @param pXO2 pointer to the XO2 device to set up
+ * @param bus number of the /dev/i2c-N device
+ * @param addr 7 bit slave address of the XO2 configuration port
+ * @return OK if successful, ERROR with errno set if the bus could not be opened
+ */
+int XO2drvr_openSMBus(XO2Handle_t *pXO2, int bus, uint16_t addr)
+{
+	i2c_params_t *p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return ERROR;
+
+	p->fd = open_i2c_dev(bus);
+	if (p->fd < 0) {
+		free(p);
+		return ERROR;
+	}
+	p->addr = addr;
+
+	if (ioctl(p->fd, I2C_SLAVE, (unsigned long)addr) == -1) {
+		fd_close(p);
+		return ERROR;
+	}
+
+	pXO2->pDrvrCalls = &smbusDrvrCalls;
+	pXO2->pDrvrParams = p;
+	pXO2->busHz = 0;
+	return OK;
+}
+
+
+//==============================================================================
+//                          s p i d e v
+//==============================================================================
+typedef struct
+{
+	int fd;
+	uint32_t speedHz;
+} spi_params_t;
+
+static int spi_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					uint8_t *pRd, unsigned int rlen)
+{
+	spi_params_t *p = pDrvrParams;
+	struct spi_ioc_transfer tr[2];
+
+	memset(tr, 0, sizeof(tr));
+	tr[0].tx_buf = (unsigned long)pWr;
+	tr[0].len = wlen;
+	tr[0].speed_hz = p->speedHz;
+	tr[1].rx_buf = (unsigned long)pRd;
+	tr[1].len = rlen;
+	tr[1].speed_hz = p->speedHz;
+
+	if (ioctl(p->fd, SPI_IOC_MESSAGE(rlen ? 2 : 1), tr) == -1)
+		return ERROR;
+	return OK;
+}
+
+static int spi_writeFrames(void *pDrvrParams, const XO2Frame_t *pFrames, unsigned int nFrames)
+{
+	spi_params_t *p = pDrvrParams;
+	struct spi_ioc_transfer tr[SPI_MAX_FRAMES];
+	unsigned int i;
+
+	if (nFrames == 0 || nFrames > SPI_MAX_FRAMES)
+		return ERROR;
+
+	memset(tr, 0, sizeof(tr));
+	for (i = 0;i < nFrames;++i) {
+		tr[i].tx_buf = (unsigned long)pFrames[i].pBuf;
+		tr[i].len = pFrames[i].len;
+		tr[i].speed_hz = p->speedHz;
+		tr[i].cs_change = (i != nFrames - 1); // every frame is its own command
+	}
+
+	if (ioctl(p->fd, SPI_IOC_MESSAGE(nFrames), tr) == -1)
+		return ERROR;
+	return OK;
+}
+
+static const ECADrvrCalls_t spiDrvrCalls =
+{
+	.pName = "spi",
+	.xfer = spi_xfer,
+	.writeFrames = spi_writeFrames,
+	.close = fd_close,
+	.maxFrames = SPI_MAX_FRAMES,
+};
+
+/**
+ * Attach the XO2 handle to a SPI bus through spidev.
+ *
+ * @param pXO2 pointer to the XO2 device to set up
+ * @param dev path of the spidev device node, e.g. /dev/spidev0.0
+ * @param speedHz SPI clock to use, 0 keeps the spidev default
+ * @return OK if successful, ERROR with errno set if the device could not be set up
+ */
+int XO2drvr_openSPI(XO2Handle_t *pXO2, const char *dev, uint32_t speedHz)
+{
+	spi_params_t *p;
+	uint8_t spiMode = SPI_MODE_0, bits = 8;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return ERROR;
+
+	p->fd = open(dev, O_RDWR);
+	if (p->fd < 0) {
+		free(p);
+		return ERROR;
+	}
+	p->speedHz = speedHz;
+
+	if (ioctl(p->fd, SPI_IOC_WR_MODE, &spiMode) == -1 ||
+		ioctl(p->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1 ||
+		(speedHz && ioctl(p->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speedHz) == -1) ||
+		ioctl(p->fd, SPI_IOC_RD_MAX_SPEED_HZ, &speedHz) == -1) {
+		fd_close(p);
+		return ERROR;
+	}
+
+	pXO2->pDrvrCalls = &spiDrvrCalls;
+	pXO2->pDrvrParams = p;
+	pXO2->busHz = speedHz;
+	return OK;
+}
+
+
+/**
+ * Release the access layer driver attached to the XO2 handle.
+ *
+ * @param pXO2 pointer to the XO2 device to detach
+ */
+void XO2drvr_close(XO2Handle_t *pXO2)
+{
+	if (pXO2->pDrvrCalls && pXO2->pDrvrCalls->close)
+		pXO2->pDrvrCalls->close(pXO2->pDrvrParams);
+
+	pXO2->pDrvrCalls = NULL;
+	pXO2->pDrvrParams = NULL;
+}
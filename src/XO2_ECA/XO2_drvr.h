@@ -0,0 +1,23 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_drvr.h */
+
+#ifndef LATTICE_XO2_DRVR_H
+#define LATTICE_XO2_DRVR_H
+
+#include <stdint.h>
+
+#include "XO2_dev.h"
+
+int XO2drvr_openI2C(XO2Handle_t *pXO2, int bus, uint16_t addr);
+int XO2drvr_openSMBus(XO2Handle_t *pXO2, int bus, uint16_t addr);
+int XO2drvr_openSPI(XO2Handle_t *pXO2, const char *dev, uint32_t speedHz);
+
+void XO2drvr_close(XO2Handle_t *pXO2);
+
+#endif
@@ -0,0 +1,395 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_sim.c
+ * In-process model of the XO2 configuration logic, usable as access layer
+ * driver in place of a real bus.  It keeps the Cfg and UFM sectors, the
+ * Feature Row, USERCODE and the status register in host memory and decodes
+ * the same command frames the command layer sends over I2C or SPI.
+ * <p>
+ * Flash behaves like the real part: erase clears bits to 0 and programming a
+ * page can only set bits, so programming without a preceding erase shows up
+ * as a verify failure.  Commands that need the configuration interface while
+ * it is disabled, or that address pages past the end of a sector, set the
+ * FAIL bit in the status register.
+ * <p>
+ * Erase, program and refresh take the time given in XO2SimTiming_t, during
+ * which the part reports BUSY.  With a bus clock configured, every transfer
+ * blocks the caller for as long as its bytes would take on the wire, so a run
+ * against the simulator takes about as long as one against real hardware.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "XO2_sim.h"
+
+// Status register bits
+#define SR_DONE  0x00000100
+#define SR_ISC   0x00000200  // configuration interface enabled
+#define SR_BUSY  0x00001000
+#define SR_FAIL  0x00002000
+
+typedef struct
+{
+	XO2Devices_t devType;
+	uint8_t *cfg;
+	uint8_t *ufm;
+	XO2FeatureRow_t featRow;
+	uint32_t userCode;
+	uint32_t sr;
+	bool ufmSel;         // address register points into UFM
+	unsigned page;       // address register page number
+	XO2SimTiming_t timing;
+	uint64_t busyUntil;  // CLOCK_MONOTONIC ns at which the running operation ends
+} XO2Sim_t;
+
+static const uint8_t simTraceID[8] = {0x00, 0x51, 0x4d, 0x58, 0x4f, 0x32, 0x00, 0x01};
+
+
+static void put32(uint8_t *p, uint32_t val)
+{
+	p[0] = val>>24;
+	p[1] = val>>16;
+	p[2] = val>>8;
+	p[3] = val;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Block until the frame has been clocked out, 9 clocks per byte incl. ACK */
+static void sim_wire(XO2Sim_t *sim, unsigned bytes)
+{
+	uint64_t until;
+	struct timespec ts;
+
+	if (!sim->timing.busHz)
+		return;
+
+	until = now_ns() + (uint64_t)bytes * 9 * 1000000000u / sim->timing.busHz;
+	ts.tv_sec = until / 1000000000u;
+	ts.tv_nsec = until % 1000000000u;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+		;
+}
+
+static void sim_busy(XO2Sim_t *sim, unsigned usec)
+{
+	sim->busyUntil = now_ns() + (uint64_t)usec * 1000;
+}
+
+static void sim_updateStatus(XO2Sim_t *sim)
+{
+	if (sim->busyUntil > now_ns())
+		sim->sr |= SR_BUSY;
+	else
+		sim->sr &= ~SR_BUSY;
+}
+
+static unsigned sim_pages(XO2Sim_t *sim, bool ufm)
+{
+	return ufm ? XO2DevList[sim->devType].UFMpages : XO2DevList[sim->devType].Cfgpages;
+}
+
+/* Program the page at the address register, advance the address */
+static void sim_program(XO2Sim_t *sim, bool ufm, const uint8_t *data, unsigned len)
+{
+	uint8_t *page;
+	unsigned i;
+
+	if (!(sim->sr & SR_ISC) || sim->ufmSel != ufm || len != XO2_FLASH_PAGE_SIZE ||
+		sim->page >= sim_pages(sim, ufm)) {
+		sim->sr |= SR_FAIL;
+		return;
+	}
+
+	page = (ufm ? sim->ufm : sim->cfg) + XO2_FLASH_PAGES_LEN(sim->page);
+	for (i = 0;i < XO2_FLASH_PAGE_SIZE;++i)
+		page[i] |= data[i];
+	sim->page++;
+	sim_busy(sim, sim->timing.progUs);
+}
+
+/* Read count pages from the address register on, advance the address */
+static void sim_readPages(XO2Sim_t *sim, bool ufm, unsigned count, uint8_t *data, unsigned len)
+{
+	unsigned n;
+
+	memset(data, 0, len);
+	if (!(sim->sr & SR_ISC) || sim->ufmSel != ufm) {
+		sim->sr |= SR_FAIL;
+		return;
+	}
+
+	for (n = 0;n < count && len >= XO2_FLASH_PAGE_SIZE;++n) {
+		if (sim->page >= sim_pages(sim, ufm)) {
+			sim->sr |= SR_FAIL;
+			return;
+		}
+		memcpy(data, (ufm ? sim->ufm : sim->cfg) + XO2_FLASH_PAGES_LEN(sim->page),
+			   XO2_FLASH_PAGE_SIZE);
+		data += XO2_FLASH_PAGE_SIZE;
+		len -= XO2_FLASH_PAGE_SIZE;
+		sim->page++;
+	}
+}
+
+static void sim_erase(XO2Sim_t *sim, unsigned mode)
+{
+	if (!(sim->sr & SR_ISC)) {
+		sim->sr |= SR_FAIL;
+		return;
+	}
+
+	if (mode & 0x08)
+		memset(sim->ufm, 0, XO2_FLASH_PAGES_LEN(sim_pages(sim, true)));
+	if (mode & 0x04) {
+		memset(sim->cfg, 0, XO2_FLASH_PAGES_LEN(sim_pages(sim, false)));
+		sim->userCode = 0;
+		sim->sr &= ~SR_DONE;
+	}
+	if (mode & 0x02)
+		memset(&sim->featRow, 0, sizeof(sim->featRow));
+	sim->sr &= ~SR_FAIL;
+
+	// Sectors erase in parallel, the largest one determines the time
+	if (mode & 0x04)
+		sim_busy(sim, sim->timing.cfgEraseUs);
+	else if (mode & 0x08)
+		sim_busy(sim, sim->timing.ufmEraseUs);
+	else
+		sim_busy(sim, sim->timing.miscEraseUs);
+}
+
+static int sim_xfer(void *pDrvrParams, const uint8_t *pWr, unsigned int wlen,
+					uint8_t *pRd, unsigned int rlen)
+{
+	XO2Sim_t *sim = pDrvrParams;
+	const uint8_t *data;
+	unsigned args, dlen;
+
+	if (wlen == 0)
+		return ERROR;
+
+	sim_wire(sim, 1 + wlen + (rlen ? 1 + rlen : 0));
+	sim_updateStatus(sim);
+
+	// Only Bypass (0xFF) may come without operands
+	if (wlen < 4) {
+		return pWr[0] == 0xFF ? OK : ERROR;
+	}
+	args = (pWr[1]<<16) | (pWr[2]<<8) | pWr[3];
+	data = pWr + 4;
+	dlen = wlen - 4;
+
+	// A busy part only answers status queries, anything else is lost
+	if ((sim->sr & SR_BUSY) && pWr[0] != 0x3C && pWr[0] != 0xF0) {
+		sim->sr |= SR_FAIL;
+		if (rlen)
+			memset(pRd, 0xFF, rlen);
+		return OK;
+	}
+
+	switch (pWr[0]) {
+	case 0xE0: // Read Device ID
+		if (rlen != 4)
+			return ERROR;
+		put32(pRd, XO2DevList[sim->devType].DeviceIdHC);
+		break;
+	case 0xC0: // Read USERCODE
+		if (rlen != 4)
+			return ERROR;
+		put32(pRd, sim->userCode);
+		break;
+	case 0xC2: // Program USERCODE
+		if (!(sim->sr & SR_ISC) || dlen != 4) {
+			sim->sr |= SR_FAIL;
+			break;
+		}
+		sim->userCode |= (data[0]<<24) | (data[1]<<16) | (data[2]<<8) | data[3];
+		sim_busy(sim, sim->timing.progUs);
+		break;
+	case 0x19: // Read TraceID
+		if (rlen != 8)
+			return ERROR;
+		memcpy(pRd, simTraceID, 8);
+		break;
+	case 0x3C: // Read Status Register
+		if (rlen != 4)
+			return ERROR;
+		put32(pRd, sim->sr);
+		break;
+	case 0xF0: // Read Busy Flag
+		if (rlen != 1)
+			return ERROR;
+		pRd[0] = (sim->sr & SR_BUSY) ? 0x80 : 0x00;
+		break;
+	case 0x74: // Enable Configuration Interface, Transparent
+	case 0xC6: // Enable Configuration Interface, Offline
+		sim->sr |= SR_ISC;
+		sim->sr &= ~SR_FAIL;
+		break;
+	case 0x26: // Disable Configuration Interface
+		sim->sr &= ~SR_ISC;
+		break;
+	case 0x0E: // Erase
+		sim_erase(sim, (args>>16) & 0x0f);
+		break;
+	case 0x46: // Reset Cfg address
+	case 0x47: // Reset UFM address
+		sim->ufmSel = (pWr[0] == 0x47);
+		sim->page = 0;
+		break;
+	case 0xB4: // Set page address
+		if (dlen != 4) {
+			sim->sr |= SR_FAIL;
+			break;
+		}
+		sim->ufmSel = (data[0] & 0x40) != 0;
+		sim->page = (data[2]<<8) | data[3];
+		break;
+	case 0x70: // Program Cfg page
+	case 0xC9: // Program UFM page
+		sim_program(sim, pWr[0] == 0xC9, data, dlen);
+		break;
+	case 0x73: // Read Cfg pages
+	case 0xCA: // Read UFM pages
+		sim_readPages(sim, pWr[0] == 0xCA, args & 0x3fff, pRd, rlen);
+		break;
+	case 0xE4: // Program Feature Row
+	case 0xF8: // Program FEABITS
+	{
+		uint8_t *dst = pWr[0] == 0xE4 ? sim->featRow.feature : sim->featRow.feabits;
+
+		if (!(sim->sr & SR_ISC) || dlen != (pWr[0] == 0xE4 ? 8u : 2u)) {
+			sim->sr |= SR_FAIL;
+			break;
+		}
+		for (unsigned i = 0;i < dlen;++i)
+			dst[i] |= data[i];
+		sim_busy(sim, sim->timing.progUs);
+		break;
+	}
+	case 0xE7: // Read Feature Row
+		if (rlen != 8)
+			return ERROR;
+		memcpy(pRd, sim->featRow.feature, 8);
+		break;
+	case 0xFB: // Read FEABITS
+		if (rlen != 2)
+			return ERROR;
+		memcpy(pRd, sim->featRow.feabits, 2);
+		break;
+	case 0x5E: // Program DONE
+		if (!(sim->sr & SR_ISC)) {
+			sim->sr |= SR_FAIL;
+			break;
+		}
+		sim->sr |= SR_DONE;
+		sim_busy(sim, sim->timing.progUs);
+		break;
+	case 0x79: // Refresh, boots from flash and leaves configuration mode
+		sim->sr &= ~(SR_ISC | SR_FAIL);
+		sim_busy(sim, sim->timing.refreshUs);
+		break;
+	case 0xFF: // Bypass
+		break;
+	default:
+		return ERROR;  // unknown command, a real part would not ACK the read
+	}
+
+	return OK;
+}
+
+static int sim_writeFrames(void *pDrvrParams, const XO2Frame_t *pFrames, unsigned int nFrames)
+{
+	unsigned int i;
+
+	for (i = 0;i < nFrames;++i) {
+		if (sim_xfer(pDrvrParams, pFrames[i].pBuf, pFrames[i].len, NULL, 0) != OK)
+			return ERROR;
+	}
+	return OK;
+}
+
+static void sim_close(void *pDrvrParams)
+{
+	XO2Sim_t *sim = pDrvrParams;
+
+	free(sim->cfg);
+	free(sim->ufm);
+	free(sim);
+}
+
+static const ECADrvrCalls_t simDrvrCalls =
+{
+	.pName = "sim",
+	.xfer = sim_xfer,
+	.writeFrames = sim_writeFrames,
+	.close = sim_close,
+	.maxFrames = 64,
+};
+
+
+/**
+ * Fill in operation latencies for a part, derived from the maximum times in
+ * XO2DevList.  Erase and refresh take XO2SIM_TYPICAL_PCT percent of the
+ * maximum, page programming the 200 usec the command layer waits for, and
+ * the bus runs at 400 kHz.
+ *
+ * @param devType which part of XO2DevList to take the times from
+ * @param pTiming pointer to the timing structure to fill
+ */
+void XO2sim_defaultTiming(XO2Devices_t devType, XO2SimTiming_t *pTiming)
+{
+	pTiming->cfgEraseUs = XO2DevList[devType].CfgErase * 10 * XO2SIM_TYPICAL_PCT;
+	pTiming->ufmEraseUs = XO2DevList[devType].UFMErase * 10 * XO2SIM_TYPICAL_PCT;
+	pTiming->miscEraseUs = 50 * 10 * XO2SIM_TYPICAL_PCT;
+	pTiming->progUs = 200;
+	pTiming->refreshUs = XO2DevList[devType].Trefresh * 10 * XO2SIM_TYPICAL_PCT;
+	pTiming->busHz = 400000;
+}
+
+/**
+ * Attach the XO2 handle to a newly created simulated device.
+ * The simulated part starts out blank: all sectors erased, DONE clear.
+ *
+ * @param pXO2 pointer to the XO2 device to set up
+ * @param devType which part of XO2DevList to model
+ * @param pTiming operation latencies, NULL for a device without any delays
+ * @return OK if successful, ERROR if out of memory
+ */
+int XO2sim_open(XO2Handle_t *pXO2, XO2Devices_t devType, const XO2SimTiming_t *pTiming)
+{
+	XO2Sim_t *sim;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return ERROR;
+
+	sim->devType = devType;
+	if (pTiming)
+		sim->timing = *pTiming;
+	sim->cfg = calloc(XO2DevList[devType].Cfgpages, XO2_FLASH_PAGE_SIZE);
+	sim->ufm = calloc(XO2DevList[devType].UFMpages + 1, XO2_FLASH_PAGE_SIZE);
+	if (!sim->cfg || !sim->ufm) {
+		sim_close(sim);
+		return ERROR;
+	}
+
+	pXO2->pDrvrCalls = &simDrvrCalls;
+	pXO2->pDrvrParams = sim;
+	pXO2->busHz = sim->timing.busHz;
+	return OK;
+}
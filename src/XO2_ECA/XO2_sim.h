@@ -0,0 +1,36 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_sim.h */
+
+#ifndef LATTICE_XO2_SIM_H
+#define LATTICE_XO2_SIM_H
+
+#include "XO2_dev.h"
+
+#define XO2SIM_TYPICAL_PCT 60   // default operation times in % of the XO2DevList maximum
+
+/**
+ * Operation latencies of the simulated configuration logic.
+ * While an operation is in progress the device reports BUSY and ignores all
+ * commands except status reads, which sets FAIL like a lost command would.
+ * All zero gives a device that completes everything instantly.
+ */
+typedef struct
+{
+	unsigned int cfgEraseUs;    /**< Configuration sector erase */
+	unsigned int ufmEraseUs;    /**< UFM sector erase */
+	unsigned int miscEraseUs;   /**< Feature Row / SRAM erase */
+	unsigned int progUs;        /**< Page, Feature Row, USERCODE and DONE program */
+	unsigned int refreshUs;     /**< Refresh until user mode */
+	unsigned int busHz;         /**< Bus clock for the time frames spend on the wire, 0 = none */
+} XO2SimTiming_t;
+
+void XO2sim_defaultTiming(XO2Devices_t devType, XO2SimTiming_t *pTiming);
+int XO2sim_open(XO2Handle_t *pXO2, XO2Devices_t devType, const XO2SimTiming_t *pTiming);
+
+#endif
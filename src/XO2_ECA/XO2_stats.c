@@ -0,0 +1,184 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_stats.c
+ * Statistics of the command layer: transactions, bytes and latencies per
+ * command opcode, waits for BUSY and delays.  Collected by XO2_cmds.c while
+ * XO2Handle_t.pStats points to a XO2Stats_t, printed as JSON to find out
+ * whether the bus, the polling or the flash operations themselves were slow.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "XO2_stats.h"
+#include "XO2_cmds.h"
+
+static const struct
+{
+	uint8_t opcode;
+	const char *pName;
+} opNames[] =
+{
+	{0x0E, "ISC_ERASE"},
+	{0x19, "UIDCODE_PUB"},
+	{0x26, "ISC_DISABLE"},
+	{0x3C, "LSC_READ_STATUS"},
+	{0x46, "LSC_INIT_ADDRESS"},
+	{0x47, "LSC_INIT_ADDR_UFM"},
+	{0x5E, "ISC_PROGRAM_DONE"},
+	{0x70, "LSC_PROG_INCR_NV"},
+	{0x73, "LSC_READ_INCR_NV"},
+	{0x74, "ISC_ENABLE_X"},
+	{0x79, "LSC_REFRESH"},
+	{0xB4, "LSC_WRITE_ADDRESS"},
+	{0xC0, "USERCODE"},
+	{0xC2, "ISC_PROGRAM_USERCODE"},
+	{0xC6, "ISC_ENABLE"},
+	{0xC9, "LSC_PROG_TAG"},
+	{0xCA, "LSC_READ_TAG"},
+	{0xE0, "IDCODE_PUB"},
+	{0xE4, "LSC_PROG_FEATURE"},
+	{0xE7, "LSC_READ_FEATURE"},
+	{0xF0, "LSC_CHECK_BUSY"},
+	{0xF8, "LSC_PROG_FEABITS"},
+	{0xFB, "LSC_READ_FEABITS"},
+	{0xFF, "ISC_NOOP"},
+};
+
+
+/**
+ * Clear all counters.
+ *
+ * @param pStats statistics to clear
+ */
+void XO2stats_reset(XO2Stats_t *pStats)
+{
+	memset(pStats, 0, sizeof(*pStats));
+}
+
+
+/**
+ * Account one command sent to the XO2.
+ *
+ * @param pStats statistics to add to
+ * @param opcode command opcode
+ * @param wlen bytes written, opcode and operands included
+ * @param rlen bytes read back
+ * @param usec time the driver took
+ * @param status driver return value
+ */
+void XO2stats_addCmd(XO2Stats_t *pStats, uint8_t opcode, unsigned int wlen,
+					 unsigned int rlen, uint64_t usec, int status)
+{
+	XO2OpStats_t *pOp = &pStats->op[opcode];
+	unsigned int bin = 0;
+
+	while (bin < XO2STATS_HIST_BINS - 1 && (usec >> bin) != 0)
+		++bin;
+
+	pOp->count++;
+	if (status != OK)
+		pOp->errors++;
+	pOp->bytesWr += wlen;
+	pOp->bytesRd += rlen;
+	pOp->totalUs += usec;
+	if (usec > pOp->maxUs)
+		pOp->maxUs = usec;
+	pOp->hist[bin]++;
+}
+
+
+/**
+ * Estimate a latency percentile from the histogram of an opcode.
+ *
+ * @param pOp statistics of the opcode
+ * @param pct percentile, 0..100
+ * @return upper bound in usec of the histogram bin holding the percentile,
+ * limited to the longest command seen
+ */
+uint64_t XO2stats_percentileUs(const XO2OpStats_t *pOp, unsigned int pct)
+{
+	uint64_t rank, seen = 0, bound;
+	unsigned int bin;
+
+	if (pOp->count == 0)
+		return 0;
+
+	rank = (pOp->count * pct + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	for (bin = 0;bin < XO2STATS_HIST_BINS;++bin) {
+		seen += pOp->hist[bin];
+		if (seen >= rank)
+			break;
+	}
+
+	bound = bin ? (1ull << bin) - 1 : 0;
+	return bound < pOp->maxUs ? bound : pOp->maxUs;
+}
+
+
+/**
+ * Name of a command opcode as used in the XO2 programming guide.
+ *
+ * @param opcode command opcode
+ * @return name, NULL if unknown
+ */
+const char *XO2stats_opName(uint8_t opcode)
+{
+	for (unsigned int i = 0;i < sizeof(opNames)/sizeof(opNames[0]);++i) {
+		if (opNames[i].opcode == opcode)
+			return opNames[i].pName;
+	}
+	return NULL;
+}
+
+
+/**
+ * Print the statistics as a JSON object.
+ *
+ * @param out stream to print to
+ * @param pStats statistics to print
+ * @return OK if successful, ERROR if the stream could not be written
+ */
+int XO2stats_print(FILE *out, const XO2Stats_t *pStats)
+{
+	const char *sep = "";
+	unsigned int op, bin;
+
+	fprintf(out, "{\n  \"xfers\": %" PRIu64 ",\n", pStats->xfers);
+	fprintf(out, "  \"busy_waits\": %" PRIu64 ",\n  \"busy_polls\": %" PRIu64 ",\n  \"busy_us\": %" PRIu64 ",\n",
+			pStats->busyWaits, pStats->busyPolls, pStats->busyUs);
+	fprintf(out, "  \"sleeps\": %" PRIu64 ",\n  \"sleep_us\": %" PRIu64 ",\n",
+			pStats->sleeps, pStats->sleepUs);
+	fprintf(out, "  \"hist_bins_us\": \"<1, then [2^(n-1), 2^n)\",\n");
+	fprintf(out, "  \"cmds\": [");
+
+	for (op = 0;op < 256;++op) {
+		const XO2OpStats_t *pOp = &pStats->op[op];
+		const char *name = XO2stats_opName(op);
+
+		if (pOp->count == 0)
+			continue;
+
+		fprintf(out, "%s\n    {\"op\": \"0x%02X\", \"name\": \"%s\", \"count\": %" PRIu64
+				", \"errors\": %" PRIu64 ", \"bytes_wr\": %" PRIu64 ", \"bytes_rd\": %" PRIu64
+				", \"total_us\": %" PRIu64 ", \"p50_us\": %" PRIu64 ", \"p99_us\": %" PRIu64
+				", \"max_us\": %" PRIu64 ", \"hist\": [",
+				sep, op, name ? name : "?", pOp->count, pOp->errors, pOp->bytesWr, pOp->bytesRd,
+				pOp->totalUs, XO2stats_percentileUs(pOp, 50), XO2stats_percentileUs(pOp, 99),
+				pOp->maxUs);
+		for (bin = 0;bin < XO2STATS_HIST_BINS;++bin)
+			fprintf(out, "%s%u", bin ? "," : "", pOp->hist[bin]);
+		fprintf(out, "]}");
+		sep = ",";
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	return ferror(out) ? ERROR : OK;
+}
@@ -0,0 +1,24 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_stats.h */
+
+#ifndef LATTICE_XO2_STATS_H
+#define LATTICE_XO2_STATS_H
+
+#include <stdio.h>
+
+#include "XO2_dev.h"
+
+void XO2stats_reset(XO2Stats_t *pStats);
+void XO2stats_addCmd(XO2Stats_t *pStats, uint8_t opcode, unsigned int wlen,
+					 unsigned int rlen, uint64_t usec, int status);
+uint64_t XO2stats_percentileUs(const XO2OpStats_t *pOp, unsigned int pct);
+const char *XO2stats_opName(uint8_t opcode);
+int XO2stats_print(FILE *out, const XO2Stats_t *pStats);
+
+#endif
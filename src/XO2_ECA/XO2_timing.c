@@ -0,0 +1,194 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_timing.c
+ * Timing profiles: measured erase, program and refresh times per XO2 part,
+ * used by the command layer instead of the datasheet maxima in XO2DevList.
+ * <p>
+ * A profile is a text file with one line per part, holding the raw measured
+ * times in microseconds:
+ * @code
+   MachXO2-7000 cfgErase=2412000 ufmErase=803000 miscErase=0 prog=161 refresh=2100
+ * @endcode
+ * Zero or missing values fall back to the datasheet maximum.  Safety margins
+ * are added when the profile is loaded, and the result never exceeds the
+ * datasheet maximum, so a profile can only make waits shorter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "XO2_timing.h"
+#include "XO2_cmds.h"
+
+#define LINE_MAX_LEN 512
+
+static const struct
+{
+	const char *key;
+	size_t offset;
+} timingFields[] =
+{
+	{"cfgErase",  offsetof(XO2Timing_t, cfgEraseUs)},
+	{"ufmErase",  offsetof(XO2Timing_t, ufmEraseUs)},
+	{"miscErase", offsetof(XO2Timing_t, miscEraseUs)},
+	{"prog",      offsetof(XO2Timing_t, progUs)},
+	{"refresh",   offsetof(XO2Timing_t, refreshUs)},
+};
+#define NUM_FIELDS (sizeof(timingFields)/sizeof(timingFields[0]))
+
+static unsigned int *field(XO2Timing_t *pTiming, unsigned int i)
+{
+	return (unsigned int *)((char *)pTiming + timingFields[i].offset);
+}
+
+/* Parse the profile line of a part into pTiming, return false if it is another part */
+static bool parse_line(const char *line, const char *name, XO2Timing_t *pTiming)
+{
+	char buf[LINE_MAX_LEN], *tok, *save, *eq;
+	unsigned int i;
+
+	strncpy(buf, line, sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+
+	tok = strtok_r(buf, " \t\r\n", &save);
+	if (!tok || strcmp(tok, name) != 0)
+		return false;
+
+	memset(pTiming, 0, sizeof(*pTiming));
+	while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		eq = strchr(tok, '=');
+		if (!eq)
+			continue;
+		*eq = '\0';
+		for (i = 0;i < NUM_FIELDS;++i) {
+			if (strcmp(tok, timingFields[i].key) == 0)
+				*field(pTiming, i) = strtoul(eq+1, NULL, 10);
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Get the datasheet maximum operation times of a part from XO2DevList.
+ *
+ * @param devType part to get the times for
+ * @param pTiming pointer to the timing structure to fill
+ */
+void XO2timing_default(XO2Devices_t devType, XO2Timing_t *pTiming)
+{
+	pTiming->cfgEraseUs = XO2DevList[devType].CfgErase * 1000;
+	pTiming->ufmEraseUs = XO2DevList[devType].UFMErase * 1000;
+	pTiming->miscEraseUs = 50000;
+	pTiming->progUs = XO2ECA_PROG_PAGE_US;
+	pTiming->refreshUs = XO2DevList[devType].Trefresh * 1000;
+}
+
+
+/**
+ * Load the timing profile of a part.
+ * Measured times get XO2TIMING_MARGIN_PCT percent, at least XO2TIMING_MARGIN_MIN_US,
+ * added and are limited to the datasheet maximum.  Times not in the profile are
+ * set to the datasheet maximum.
+ *
+ * @param path profile file
+ * @param devType part to load the times for
+ * @param pTiming pointer to the timing structure to fill
+ * @return OK if successful, ERROR if the file could not be read or has no entry for the part
+ */
+int XO2timing_load(const char *path, XO2Devices_t devType, XO2Timing_t *pTiming)
+{
+	char line[LINE_MAX_LEN];
+	XO2Timing_t measured, maximum;
+	unsigned int i, val, margin;
+	bool found = false;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return ERROR;
+
+	while (!found && fgets(line, sizeof(line), f))
+		found = parse_line(line, XO2DevList[devType].pName, &measured);
+	fclose(f);
+
+	if (!found)
+		return ERROR;
+
+	XO2timing_default(devType, &maximum);
+	*pTiming = maximum;
+	for (i = 0;i < NUM_FIELDS;++i) {
+		val = *field(&measured, i);
+		if (val == 0)
+			continue;
+
+		margin = val / 100 * XO2TIMING_MARGIN_PCT;
+		if (margin < XO2TIMING_MARGIN_MIN_US)
+			margin = XO2TIMING_MARGIN_MIN_US;
+		if (val + margin < *field(&maximum, i))
+			*field(pTiming, i) = val + margin;
+	}
+
+	return OK;
+}
+
+
+/**
+ * Store measured times of a part in a timing profile.
+ * The entry of the part is created or replaced, entries of other parts are kept.
+ * Times that were not measured (zero) keep their previous value.
+ *
+ * @param path profile file
+ * @param devType part the times were measured on
+ * @param pMeasured measured times, e.g. from XO2Handle_t.pMeasured after a programming run
+ * @return OK if successful, ERROR if the file could not be written
+ */
+int XO2timing_save(const char *path, XO2Devices_t devType, const XO2Timing_t *pMeasured)
+{
+	char line[LINE_MAX_LEN], tmpPath[LINE_MAX_LEN];
+	XO2Timing_t merged, old;
+	unsigned int i;
+	FILE *in, *out;
+
+	if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath))
+		return ERROR;
+
+	out = fopen(tmpPath, "w");
+	if (!out)
+		return ERROR;
+
+	merged = *pMeasured;
+	in = fopen(path, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if (parse_line(line, XO2DevList[devType].pName, &old)) {
+				for (i = 0;i < NUM_FIELDS;++i) {
+					if (*field(&merged, i) == 0)
+						*field(&merged, i) = *field(&old, i);
+				}
+				continue;
+			}
+			fputs(line, out);
+		}
+		fclose(in);
+	}
+
+	fprintf(out, "%s", XO2DevList[devType].pName);
+	for (i = 0;i < NUM_FIELDS;++i)
+		fprintf(out, " %s=%u", timingFields[i].key, *field(&merged, i));
+	fprintf(out, "\n");
+
+	if (fclose(out) != 0 || rename(tmpPath, path) != 0) {
+		remove(tmpPath);
+		return ERROR;
+	}
+
+	return OK;
+}
@@ -0,0 +1,22 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_timing.h */
+
+#ifndef LATTICE_XO2_TIMING_H
+#define LATTICE_XO2_TIMING_H
+
+#include "XO2_dev.h"
+
+#define XO2TIMING_MARGIN_PCT  25   // added on top of measured times when loading a profile
+#define XO2TIMING_MARGIN_MIN_US 50 // but at least this much
+
+void XO2timing_default(XO2Devices_t devType, XO2Timing_t *pTiming);
+int XO2timing_load(const char *path, XO2Devices_t devType, XO2Timing_t *pTiming);
+int XO2timing_save(const char *path, XO2Devices_t devType, const XO2Timing_t *pMeasured);
+
+#endif
@@ -0,0 +1,572 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_ufmkv.c
+ * Key-value store in UFM pages.
+ * <p>
+ * The UFM can only be erased as a whole, but each erased page can be
+ * programmed once.  The store is therefore an append-only log of records in
+ * a range of UFM pages: an update appends the new value, the latest record of
+ * a key wins, a delete appends a tombstone.  Only when the range is full the
+ * sector is erased and the live records are written back (compaction).
+ * <p>
+ * A record is a header page followed by continuation pages:
+ * @code
+   header:       type, key length, value length (LE16), payload CRC16 (LE),
+                 header CRC16 (LE) over the 6 bytes before, 8 payload bytes
+   continuation: 0x5C, 15 payload bytes
+ * @endcode
+ * The payload is the key followed by the value, padded with 0.  A short key
+ * and value, e.g. "cal0" and 4 bytes, fit in the header page.  Every record
+ * page starts with a non-zero byte, so the log is written pages followed by
+ * erased (all 0) pages, and its end is found by binary search.  A record torn
+ * by a power loss fails its CRCs and is skipped.  The pages a failed write
+ * left erased get a lone continuation byte, so they close the gap without
+ * passing for a record.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XO2_cmds.h"
+#include "XO2_ufmkv.h"
+
+#define REC_PUT   0xA5
+#define REC_DEL   0xD1
+#define REC_CONT  0x5C
+#define HDR_LEN   8      // header bytes before the payload in the header page
+#define CONT_LEN  (XO2_FLASH_PAGE_SIZE - 1)  // payload bytes in a continuation page
+#define PAYLOAD_MAX (XO2UFMKV_KEY_MAX + XO2UFMKV_VAL_MAX)
+#define REC_MAX_PGS (1 + (PAYLOAD_MAX - (XO2_FLASH_PAGE_SIZE - HDR_LEN) + CONT_LEN - 1) / CONT_LEN)
+
+
+/* CRC-16/CCITT-FALSE, records are short and written rarely */
+static uint16_t crc16(uint16_t crc, const unsigned char *p, unsigned int len)
+{
+	unsigned int i;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (i = 0;i < 8;++i)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/* Pages of a record with len bytes of payload */
+static unsigned int rec_pages(unsigned int len)
+{
+	if (len <= XO2_FLASH_PAGE_SIZE - HDR_LEN)
+		return 1;
+	return 1 + (len - (XO2_FLASH_PAGE_SIZE - HDR_LEN) + CONT_LEN - 1) / CONT_LEN;
+}
+
+/* Copy len payload bytes of the record at pRec from (toRec false) or to it */
+static void rec_payload(unsigned char *pRec, unsigned char *pBuf, unsigned int len, bool toRec)
+{
+	unsigned int off, n, pg;
+	unsigned char *p;
+
+	for (off = 0, pg = 0;off < len;off += n, ++pg) {
+		if (pg == 0) {
+			p = pRec + HDR_LEN;
+			n = XO2_FLASH_PAGE_SIZE - HDR_LEN;
+		} else {
+			p = pRec + XO2_FLASH_PAGES_LEN(pg) + 1;
+			n = CONT_LEN;
+		}
+		if (n > len - off)
+			n = len - off;
+		if (toRec)
+			memcpy(p, pBuf + off, n);
+		else
+			memcpy(pBuf + off, p, n);
+	}
+}
+
+/* Build a record in pRec, zeroed by the caller.  Return its number of pages */
+static unsigned int rec_encode(unsigned char *pRec, unsigned char type, const char *key,
+							   const void *pVal, unsigned int valLen)
+{
+	unsigned char payload[PAYLOAD_MAX];
+	unsigned int keyLen = strlen(key), pgs, i;
+	uint16_t crc;
+
+	memcpy(payload, key, keyLen);
+	if (valLen)
+		memcpy(payload + keyLen, pVal, valLen);
+	crc = crc16(0xFFFF, payload, keyLen + valLen);
+
+	pRec[0] = type;
+	pRec[1] = keyLen;
+	pRec[2] = valLen;
+	pRec[3] = valLen >> 8;
+	pRec[4] = crc;
+	pRec[5] = crc >> 8;
+	crc = crc16(0xFFFF, pRec, 6);
+	pRec[6] = crc;
+	pRec[7] = crc >> 8;
+
+	pgs = rec_pages(keyLen + valLen);
+	for (i = 1;i < pgs;++i)
+		pRec[XO2_FLASH_PAGES_LEN(i)] = REC_CONT;
+	rec_payload(pRec, payload, keyLen + valLen, true);
+	return pgs;
+}
+
+/* Check the record at page pg of the log copy.  Return its number of pages
+   and its payload in pPayload, or 0 if there is no intact record.
+*/
+static unsigned int rec_check(XO2ufmkv_t *pKV, unsigned int pg, unsigned char *pPayload)
+{
+	unsigned char *pRec = pKV->pLog + XO2_FLASH_PAGES_LEN(pg);
+	unsigned int keyLen, valLen, pgs, i;
+
+	if ((pRec[0] != REC_PUT && pRec[0] != REC_DEL) ||
+		crc16(0xFFFF, pRec, 6) != (pRec[6] | pRec[7] << 8))
+		return 0;
+
+	keyLen = pRec[1];
+	valLen = pRec[2] | pRec[3] << 8;
+	if (keyLen == 0 || keyLen > XO2UFMKV_KEY_MAX || valLen > XO2UFMKV_VAL_MAX)
+		return 0;
+	pgs = rec_pages(keyLen + valLen);
+	if (pg + pgs > pKV->headPg)
+		return 0;
+	for (i = 1;i < pgs;++i) {
+		if (pRec[XO2_FLASH_PAGES_LEN(i)] != REC_CONT)
+			return 0;
+	}
+
+	rec_payload(pRec, pPayload, keyLen + valLen, false);
+	if (crc16(0xFFFF, pPayload, keyLen + valLen) != (pRec[4] | pRec[5] << 8))
+		return 0;
+	return pgs;
+}
+
+/* Find key in the index.  Return whether it is there, *pPos is its position
+   or where it would go.
+*/
+static bool index_find(XO2ufmkv_t *pKV, const char *key, unsigned int keyLen, unsigned int *pPos)
+{
+	unsigned int lo = 0, hi = pKV->numKeys, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = strncmp(pKV->pIndex[mid].key, key, keyLen);
+		if (cmp == 0 && pKV->pIndex[mid].key[keyLen] != '\0')
+			cmp = 1;
+		if (cmp == 0) {
+			*pPos = mid;
+			return true;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pPos = lo;
+	return false;
+}
+
+/* Account the record at page pg with the payload in pPayload in the index */
+static int index_add(XO2ufmkv_t *pKV, unsigned int pg, const unsigned char *pPayload)
+{
+	const unsigned char *pRec = pKV->pLog + XO2_FLASH_PAGES_LEN(pg);
+	unsigned int keyLen = pRec[1], pos;
+	XO2ufmkvEntry_t *pEntry;
+	bool found;
+
+	found = index_find(pKV, (const char *)pPayload, keyLen, &pos);
+	if (pRec[0] == REC_DEL) {
+		if (found) {
+			--pKV->numKeys;
+			memmove(&pKV->pIndex[pos], &pKV->pIndex[pos + 1],
+					(pKV->numKeys - pos) * sizeof(pKV->pIndex[0]));
+		}
+		return OK;
+	}
+
+	if (!found) {
+		if (pKV->numKeys == pKV->maxKeys) {
+			unsigned int maxKeys = pKV->maxKeys ? 2 * pKV->maxKeys : 16;
+
+			pEntry = realloc(pKV->pIndex, maxKeys * sizeof(pKV->pIndex[0]));
+			if (!pEntry)
+				return ERROR;
+			pKV->pIndex = pEntry;
+			pKV->maxKeys = maxKeys;
+		}
+		memmove(&pKV->pIndex[pos + 1], &pKV->pIndex[pos],
+				(pKV->numKeys - pos) * sizeof(pKV->pIndex[0]));
+		++pKV->numKeys;
+		memcpy(pKV->pIndex[pos].key, pPayload, keyLen);
+		pKV->pIndex[pos].key[keyLen] = '\0';
+	}
+	pEntry = &pKV->pIndex[pos];
+	pEntry->pg = pg;
+	pEntry->valLen = pRec[2] | pRec[3] << 8;
+	return OK;
+}
+
+/* Build the index from the log copy in one pass, later records win */
+static int index_build(XO2ufmkv_t *pKV)
+{
+	unsigned char payload[PAYLOAD_MAX];
+	unsigned int pg, n;
+
+	pKV->numKeys = 0;
+	for (pg = 0;pg < pKV->headPg;pg += n) {
+		n = rec_check(pKV, pg, payload);
+		if (n == 0) {
+			// Torn record or continuation page, resync on the next page
+#ifdef DEBUG_ECA
+			if (pKV->pLog[XO2_FLASH_PAGES_LEN(pg)] != REC_CONT)
+				printf("UFM KV: no intact record at page %d\n", pKV->firstPg + pg);
+#endif
+			n = 1;
+			continue;
+		}
+		if (index_add(pKV, pg, payload) != OK)
+			return ERROR;
+	}
+	return OK;
+}
+
+static bool page_written(const unsigned char *pPage)
+{
+	static const unsigned char zero[XO2_FLASH_PAGE_SIZE];
+
+	return memcmp(pPage, zero, XO2_FLASH_PAGE_SIZE) != 0;
+}
+
+static int cfg_begin(XO2ufmkv_t *pKV)
+{
+	return XO2ECAcmd_openCfgIF(pKV->pXO2, TRANSPARENT_MODE);
+}
+
+static void cfg_end(XO2ufmkv_t *pKV)
+{
+	XO2ECAcmd_closeCfgIF(pKV->pXO2);
+	XO2ECAcmd_Bypass(pKV->pXO2);
+}
+
+/* Program numPgs pages from UFM page pg on, with the interface open */
+static int write_pages(XO2ufmkv_t *pKV, unsigned int pg, unsigned int numPgs, unsigned char *pBuf)
+{
+	if (numPgs == 0)
+		return OK;
+	if (XO2ECAcmd_SetPage(pKV->pXO2, UFM_SECTOR, pg) != OK)
+		return ERROR;
+	return XO2ECAcmd_UFMWritePages(pKV->pXO2, numPgs, pBuf);
+}
+
+/* Read numPgs pages from UFM page pg on, with the interface open */
+static int read_pages(XO2ufmkv_t *pKV, unsigned int pg, unsigned int numPgs, unsigned char *pBuf)
+{
+	if (numPgs == 0)
+		return OK;
+	if (XO2ECAcmd_SetPage(pKV->pXO2, UFM_SECTOR, pg) != OK)
+		return ERROR;
+	return XO2ECAcmd_UFMReadPages(pKV->pXO2, numPgs, pBuf);
+}
+
+/* After a failed write of pgs pages from page pg of the log on, with the
+   interface open: read them back into the log copy and program those still
+   erased with a filler page, which is no record.  The log then stays written
+   pages followed by erased ones, as XO2ufmkv_open() expects.
+*/
+static int fill_torn(XO2ufmkv_t *pKV, unsigned int pg, unsigned int pgs)
+{
+	static const unsigned char filler[XO2_FLASH_PAGE_SIZE] = {REC_CONT};
+	unsigned char *pPage;
+	unsigned int i;
+
+	if (read_pages(pKV, pKV->firstPg + pg, pgs, pKV->pLog + XO2_FLASH_PAGES_LEN(pg)) != OK)
+		return ERROR;
+	for (i = 0;i < pgs;++i) {
+		pPage = pKV->pLog + XO2_FLASH_PAGES_LEN(pg + i);
+		if (page_written(pPage))
+			continue;
+		memcpy(pPage, filler, sizeof(filler));
+		if (write_pages(pKV, pKV->firstPg + pg + i, 1, pPage) != OK)
+			return ERROR;
+	}
+	return OK;
+}
+
+/* Append the record in pRec to the log, compacting first if it does not fit */
+static int append(XO2ufmkv_t *pKV, unsigned char *pRec, unsigned int pgs)
+{
+	unsigned char payload[PAYLOAD_MAX];
+	unsigned int pg;
+	int status;
+
+	if (pKV->broken)
+		return ERROR;
+
+	if (pKV->headPg + pgs > pKV->numPgs) {
+		status = XO2ufmkv_compact(pKV);
+		if (status != OK)
+			return status;
+		if (pKV->headPg + pgs > pKV->numPgs)
+			return ERR_XO2UFMKV_FULL;
+	}
+
+	pg = pKV->headPg;
+	if (cfg_begin(pKV) != OK)
+		return ERROR;
+	status = write_pages(pKV, pKV->firstPg + pg, pgs, pRec);
+	if (status == OK)
+		memcpy(pKV->pLog + XO2_FLASH_PAGES_LEN(pg), pRec, XO2_FLASH_PAGES_LEN(pgs));
+	else if (fill_torn(pKV, pg, pgs) != OK)
+		pKV->broken = true;
+	cfg_end(pKV);
+	pKV->headPg += pgs;
+
+	// After a failed write the record counts if it made it in full, else it is skipped
+	if (pKV->broken || rec_check(pKV, pg, payload) == 0)
+		return ERROR;
+	return index_add(pKV, pg, payload);
+}
+
+
+/**
+ * Open the key-value store in a range of UFM pages.
+ * The end of the log is found by binary search over the range, then the log
+ * is read in one burst and indexed on the host.  An erased range is an empty
+ * store.
+ *
+ * @param pKV store to open
+ * @param pXO2 XO2 device to access, closed in between calls
+ * @param firstPg first UFM page of the store
+ * @param numPgs number of UFM pages the store may use
+ * @return OK, ERR_XO2UFMKV_RANGE if the pages are not all in the UFM, ERROR
+ * if out of memory or the UFM could not be read
+ */
+int XO2ufmkv_open(XO2ufmkv_t *pKV, XO2Handle_t *pXO2, unsigned int firstPg, unsigned int numPgs)
+{
+	unsigned int lo, hi, mid;
+	int status;
+
+	memset(pKV, 0, sizeof(*pKV));
+	if (numPgs == 0 || firstPg + numPgs > (unsigned int)XO2DevList[pXO2->devType].UFMpages)
+		return ERR_XO2UFMKV_RANGE;
+
+	pKV->pXO2 = pXO2;
+	pKV->firstPg = firstPg;
+	pKV->numPgs = numPgs;
+	pKV->pLog = calloc(numPgs, XO2_FLASH_PAGE_SIZE);
+	if (!pKV->pLog)
+		return ERROR;
+
+	if (cfg_begin(pKV) != OK) {
+		XO2ufmkv_close(pKV);
+		return ERROR;
+	}
+
+	// Pages before lo are written, from hi on erased
+	lo = 0;
+	hi = numPgs;
+	status = OK;
+	while (status == OK && lo < hi) {
+		mid = (lo + hi) / 2;
+		status = read_pages(pKV, firstPg + mid, 1, pKV->pLog + XO2_FLASH_PAGES_LEN(mid));
+		if (page_written(pKV->pLog + XO2_FLASH_PAGES_LEN(mid)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pKV->headPg = lo;
+
+#ifdef DEBUG_ECA
+	if (pKV->headPg)
+		printf("UFM KV: log pages %d-%d\n", firstPg, firstPg + pKV->headPg - 1);
+	else
+		printf("UFM KV: log empty\n");
+#endif
+
+	if (status == OK)
+		status = read_pages(pKV, firstPg, pKV->headPg, pKV->pLog);
+	cfg_end(pKV);
+
+	if (status == OK)
+		status = index_build(pKV);
+	if (status != OK) {
+		XO2ufmkv_close(pKV);
+		return ERROR;
+	}
+	return OK;
+}
+
+/**
+ * Release the host side of the store, the UFM is not touched.
+ *
+ * @param pKV store opened with XO2ufmkv_open()
+ */
+void XO2ufmkv_close(XO2ufmkv_t *pKV)
+{
+	free(pKV->pLog);
+	free(pKV->pIndex);
+	memset(pKV, 0, sizeof(*pKV));
+}
+
+/**
+ * Get the value of a key, from the host copy of the log.
+ *
+ * @param pKV the store
+ * @param key key to look up
+ * @param pVal buffer for the value
+ * @param maxLen size of pVal, a longer value is cut off
+ * @return length of the value, ERR_XO2UFMKV_NOT_FOUND if the key is not set
+ */
+int XO2ufmkv_get(XO2ufmkv_t *pKV, const char *key, void *pVal, unsigned int maxLen)
+{
+	unsigned char payload[PAYLOAD_MAX];
+	XO2ufmkvEntry_t *pEntry;
+	unsigned int keyLen = strlen(key), pos;
+
+	if (keyLen > XO2UFMKV_KEY_MAX || !index_find(pKV, key, keyLen, &pos))
+		return ERR_XO2UFMKV_NOT_FOUND;
+
+	pEntry = &pKV->pIndex[pos];
+	rec_payload(pKV->pLog + XO2_FLASH_PAGES_LEN(pEntry->pg), payload, keyLen + pEntry->valLen, false);
+	memcpy(pVal, payload + keyLen, pEntry->valLen < maxLen ? pEntry->valLen : maxLen);
+	return pEntry->valLen;
+}
+
+/**
+ * Set the value of a key.
+ * Appends one record, one page for up to 8 bytes of key and value together,
+ * another page for every 15 bytes more.  Setting the value a key already has
+ * writes nothing.  If the pages are full, the store is compacted first.
+ *
+ * @param pKV the store
+ * @param key key of 1 to XO2UFMKV_KEY_MAX characters
+ * @param pVal the value
+ * @param len length of the value, at most XO2UFMKV_VAL_MAX
+ * @return OK, ERR_XO2UFMKV_RANGE if key or value are too long,
+ * ERR_XO2UFMKV_FULL if the live records do not leave room for it, ERROR if
+ * the UFM could not be accessed, the key keeps its old value then.  If even
+ * the pages of the failed record could not be filled, all writes fail until
+ * the store is reopened.
+ */
+int XO2ufmkv_put(XO2ufmkv_t *pKV, const char *key, const void *pVal, unsigned int len)
+{
+	unsigned char rec[XO2_FLASH_PAGES_LEN(REC_MAX_PGS)], payload[PAYLOAD_MAX];
+	unsigned int keyLen = strlen(key), pos;
+
+	if (keyLen == 0 || keyLen > XO2UFMKV_KEY_MAX || len > XO2UFMKV_VAL_MAX)
+		return ERR_XO2UFMKV_RANGE;
+
+	if (index_find(pKV, key, keyLen, &pos) && pKV->pIndex[pos].valLen == len) {
+		rec_payload(pKV->pLog + XO2_FLASH_PAGES_LEN(pKV->pIndex[pos].pg), payload, keyLen + len, false);
+		if (memcmp(payload + keyLen, pVal, len) == 0)
+			return OK;
+	}
+
+	memset(rec, 0, sizeof(rec));
+	return append(pKV, rec, rec_encode(rec, REC_PUT, key, pVal, len));
+}
+
+/**
+ * Remove a key by appending a tombstone record.
+ *
+ * @param pKV the store
+ * @param key key to remove
+ * @return OK, ERR_XO2UFMKV_NOT_FOUND if the key is not set, else see XO2ufmkv_put()
+ */
+int XO2ufmkv_delete(XO2ufmkv_t *pKV, const char *key)
+{
+	unsigned char rec[XO2_FLASH_PAGES_LEN(REC_MAX_PGS)];
+	unsigned int keyLen = strlen(key), pos;
+
+	if (keyLen > XO2UFMKV_KEY_MAX || !index_find(pKV, key, keyLen, &pos))
+		return ERR_XO2UFMKV_NOT_FOUND;
+
+	memset(rec, 0, sizeof(rec));
+	return append(pKV, rec, rec_encode(rec, REC_DEL, key, NULL, 0));
+}
+
+/**
+ * Compact the store: erase the UFM and write back the latest record of every
+ * key.  UFM pages outside the store are read before and written back as well.
+ * Done by XO2ufmkv_put() when the pages are full, there is no need to call it
+ * otherwise.
+ *
+ * @note The UFM sector is erased as a whole, the store and the rest of the UFM
+ * are lost if power fails before they are written back.
+ *
+ * @param pKV the store
+ * @return OK, ERROR if out of memory or the UFM could not be accessed, after
+ * that the host copy may no longer match the UFM, reopen the store
+ */
+int XO2ufmkv_compact(XO2ufmkv_t *pKV)
+{
+	unsigned int ufmPgs = XO2DevList[pKV->pXO2->devType].UFMpages;
+	unsigned int endPg = pKV->firstPg + pKV->numPgs, head, pgs, i, n;
+	unsigned char *pLog, *pUFM;
+	int status;
+
+	if (pKV->broken)
+		return ERROR;
+
+	pLog = calloc(pKV->numPgs, XO2_FLASH_PAGE_SIZE);
+	pUFM = calloc(ufmPgs, XO2_FLASH_PAGE_SIZE);
+	if (!pLog || !pUFM) {
+		free(pLog);
+		free(pUFM);
+		return ERROR;
+	}
+
+	// Keys are unique after compaction, the order of the records does not matter
+	for (head = 0, i = 0;i < pKV->numKeys;++i) {
+		pgs = rec_pages(strlen(pKV->pIndex[i].key) + pKV->pIndex[i].valLen);
+		memcpy(pLog + XO2_FLASH_PAGES_LEN(head), pKV->pLog + XO2_FLASH_PAGES_LEN(pKV->pIndex[i].pg),
+			   XO2_FLASH_PAGES_LEN(pgs));
+		head += pgs;
+	}
+
+#ifdef DEBUG_ECA
+	printf("UFM KV: compact %d pages to %d\n", pKV->headPg, head);
+#endif
+
+	status = cfg_begin(pKV);
+	if (status == OK) {
+		status = read_pages(pKV, 0, pKV->firstPg, pUFM);
+		if (status == OK)
+			status = read_pages(pKV, endPg, ufmPgs - endPg, pUFM + XO2_FLASH_PAGES_LEN(endPg));
+		if (status == OK)
+			status = XO2ECAcmd_UFMErase(pKV->pXO2);
+
+		// Pages before the store, then after it, up to the last one not erased
+		for (n = pKV->firstPg;n > 0 && !page_written(pUFM + XO2_FLASH_PAGES_LEN(n - 1));--n)
+			;
+		if (status == OK)
+			status = write_pages(pKV, 0, n, pUFM);
+		for (n = ufmPgs;n > endPg && !page_written(pUFM + XO2_FLASH_PAGES_LEN(n - 1));--n)
+			;
+		if (status == OK)
+			status = write_pages(pKV, endPg, n - endPg, pUFM + XO2_FLASH_PAGES_LEN(endPg));
+		if (status == OK)
+			status = write_pages(pKV, pKV->firstPg, head, pLog);
+		cfg_end(pKV);
+	}
+	free(pUFM);
+
+	if (status != OK) {
+		free(pLog);
+		return ERROR;
+	}
+
+	free(pKV->pLog);
+	pKV->pLog = pLog;
+	pKV->headPg = head;
+	return index_build(pKV);
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/** @file XO2_ufmkv.h */
+
+#ifndef LATTICE_XO2_UFMKV_H
+#define LATTICE_XO2_UFMKV_H
+
+#include "XO2_dev.h"
+
+#define XO2UFMKV_KEY_MAX   32     // longest key, without the terminating NUL
+#define XO2UFMKV_VAL_MAX   4096   // longest value
+
+#define ERR_XO2UFMKV_NOT_FOUND (-110)
+#define ERR_XO2UFMKV_FULL      (-111)
+#define ERR_XO2UFMKV_RANGE     (-112)
+
+/**
+ * A key of the store and where its current value is in the log.
+ */
+typedef struct
+{
+	char key[XO2UFMKV_KEY_MAX + 1];
+	unsigned int pg;       /**< Header page of the record, relative to the log start */
+	unsigned int valLen;   /**< Length of the value */
+} XO2ufmkvEntry_t;
+
+/**
+ * Key-value store kept as an append-only log in a range of UFM pages.
+ * The log pages are mirrored on the host, reads need no device access.
+ */
+typedef struct
+{
+	XO2Handle_t *pXO2;
+	unsigned int firstPg;     /**< First UFM page of the log */
+	unsigned int numPgs;      /**< UFM pages the log may use */
+	unsigned int headPg;      /**< First erased page, relative to firstPg */
+	unsigned char *pLog;      /**< Copy of the numPgs pages, erased ones as 0 */
+	XO2ufmkvEntry_t *pIndex;  /**< Live keys, sorted */
+	unsigned int numKeys;
+	unsigned int maxKeys;     /**< Entries allocated in pIndex */
+	bool broken;              /**< The log could not be repaired after a failed write, no more writes until reopened */
+} XO2ufmkv_t;
+
+int XO2ufmkv_open(XO2ufmkv_t *pKV, XO2Handle_t *pXO2, unsigned int firstPg, unsigned int numPgs);
+void XO2ufmkv_close(XO2ufmkv_t *pKV);
+int XO2ufmkv_get(XO2ufmkv_t *pKV, const char *key, void *pVal, unsigned int maxLen);
+int XO2ufmkv_put(XO2ufmkv_t *pKV, const char *key, const void *pVal, unsigned int len);
+int XO2ufmkv_delete(XO2ufmkv_t *pKV, const char *key);
+int XO2ufmkv_compact(XO2ufmkv_t *pKV);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "digest.h"
+
+#define CRC32C_POLY 0x82f63b78u  // Castagnoli, reflected
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init(void)
+{
+	for (uint32_t i = 0;i < 256;++i) {
+		uint32_t c = i;
+		for (int k = 0;k < 8;++k)
+			c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+		crc32c_table[i] = c;
+	}
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC
+
+/* The crc32 instruction of SSE4.2 is CRC32C, only called if the CPU has it */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+	crc = ~crc;
+#ifdef __x86_64__
+	for (;len >= 8;len -= 8, p += 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u64(crc, v);
+	}
+#endif
+	for (;len >= 4;len -= 4, p += 4) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u32(crc, v);
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return ~crc;
+}
+#endif
+
+/**
+ * CRC32C (Castagnoli) of a buffer.
+ *
+ * @param crc CRC of the preceding data, 0 to start
+ * @param buf data
+ * @param len number of bytes
+ * @return CRC of the preceding data and buf
+ */
+uint32_t digest_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+#ifdef HAVE_SSE42_CRC
+	static int have_sse42 = -1;
+	if (have_sse42 < 0)
+		have_sse42 = __builtin_cpu_supports("sse4.2");
+	if (have_sse42)
+		return crc32c_sse42(crc, p, len);
+#endif
+
+	if (!crc32c_table[1])
+		crc32c_init();
+
+	crc = ~crc;
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
@@ -7,9 +7,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "XO2_ECA/XO2_dev.h"
+#include "digest.h"
+#include "jedec.h"
+#include "xo2img.h"
+#include "reader.h"
 
 typedef enum {
 	S_START,
@@ -19,41 +30,183 @@ typedef enum {
 
 typedef struct parser_state {
 	jedec_state_t state;
-	uint8_t *data, *data_pos;
-	unsigned data_len;
+	uint8_t *data;
+	unsigned data_pos, data_len;	// offset of the next fuse line, size of the fuse array
 	XO2_JEDEC_t *jedec;
 	unsigned cur_fuse_addr, cur_fuse_len;
 	unsigned highest_cfg_addr, highest_ufm_addr;
+	const char *line_end;	// end of the current line, for the length-aware parsers
+	uint16_t file_csum;	// file checksum so far, while do_csum
+	bool do_csum;
+	uint16_t fuse_csum;	// fuse checksum of the fuse lines so far
+	uint32_t crc[2];	// CRC32C of the Cfg and UFM data so far
+	unsigned crc_len[2];	// bytes covered by crc[], from the start of the sector
+	bool crc_broken;	// fuse data out of order, crc[] not usable
+	uint8_t *map;		// bit per page of data, set if the page is not all 0
+	jedec_stream_t *stream;	// fuse lines go to the stream instead of data
+	bool keep;		// with stream: fuse lines go to data, the stream only learns of the header
 } parser_state_t;
 
-/* Parse a string of len*8 '0' and '1' (MSB first) into data
-   Return 0 on success, -1 on error.
+static uint8_t *stream_slot(jedec_stream_t *s);
+static void stream_commit(jedec_stream_t *s, unsigned page);
+static void stream_header(jedec_stream_t *s);
+static jedec_stream_t *stream_start(const char *path, bool keep);
+
+/* Fuse lines are decoded 8, 16 or 32 characters at a time.  Valid characters
+   are '0' and '1' only, the bits are packed MSB first, so the first character
+   of a group of 8 ends up in bit 7 of the byte.
+*/
+
+/* Gather the low bit of the 8 bytes of v (first character in the lowest byte)
+   into one byte, first character in bit 7.  Each byte lands on its own bit of
+   the top byte of the product, nothing carries into it.
 */
+static inline uint8_t pack8(uint64_t v)
+{
+	return (v * 0x8040201008040201ULL) >> 56;
+}
+
+/* Bit reversed bytes, from
+   http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
+*/
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+static const uint8_t bitrev_table[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/* Reverse the bit order of a byte */
+static inline uint8_t bitrev8(uint8_t b)
+{
+	return bitrev_table[b];
+}
 
-static int parsebin(const char *line, unsigned len, uint8_t *data)
+/* 8 characters to 1 byte, plain C.  Return false on an invalid character. */
+static inline bool decode8(const char *p, uint8_t *data)
 {
-	if (strlen(line) < len*8)
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	v ^= 0x3030303030303030ULL;  // '0' -> 0, '1' -> 1
+	if (v & 0xfefefefefefefefeULL)
+		return false;
+
+	*data = pack8(v);
+	return true;
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* 16 characters to 2 bytes.  movemask puts the first character in bit 0. */
+static inline bool decode16_sse2(const char *p, uint8_t *data)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)p);
+	__m128i ones = _mm_cmpeq_epi8(c, _mm_set1_epi8('1'));
+	__m128i valid = _mm_or_si128(ones, _mm_cmpeq_epi8(c, _mm_set1_epi8('0')));
+	unsigned int m;
+
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return false;
+
+	m = _mm_movemask_epi8(ones);
+	data[0] = bitrev8(m);
+	data[1] = bitrev8(m >> 8);
+	return true;
+}
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_DECODE
+
+/* 32 characters to 4 bytes, only called if the CPU supports AVX2 */
+__attribute__((target("avx2")))
+static bool decode32_avx2(const char *p, uint8_t *data)
+{
+	__m256i c = _mm256_loadu_si256((const __m256i *)p);
+	__m256i ones = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('1'));
+	__m256i valid = _mm256_or_si256(ones, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('0')));
+	uint32_t m;
+
+	if ((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffffu)
+		return false;
+
+	m = _mm256_movemask_epi8(ones);
+	for (int i = 0;i < 4;++i)
+		data[i] = bitrev8(m >> (i*8));
+	return true;
+}
+#endif
+
+/* Parse a string of len*8 '0' and '1' (MSB first) ending before end into data
+   Return 0 on success, -1 on error.
+*/
+static int parsebin(const char *line, const char *end, unsigned len, uint8_t *data)
+{
+	unsigned i = 0;
+
+	if ((size_t)(end - line) < len*8)
 		return -1;
 
-	for (unsigned i = 0;i < len;++i) {
-		uint8_t val = 0;
-		for (unsigned j = 0;j < 8;++j) {
-			int b;
-			if (line[i*8+j] == '0') {
-				b = 0;
-			} else if (line[i*8+j] == '1') {
-				b = 1;
-			} else {
-				fprintf(stderr, "Invalid char in bit string %c\n", line[i*8+j]);
-				return -1;
-			}
-			val |= b<<(7-j);
+#ifdef HAVE_AVX2_DECODE
+	static int have_avx2 = -1;
+	if (have_avx2 < 0)
+		have_avx2 = __builtin_cpu_supports("avx2");
+	if (have_avx2) {
+		for (;i + 4 <= len;i += 4) {
+			if (!decode32_avx2(line + i*8, data + i))
+				goto invalid;
 		}
-
-		*(data++) = val;
+	}
+#endif
+#ifdef __SSE2__
+	for (;i + 2 <= len;i += 2) {
+		if (!decode16_sse2(line + i*8, data + i))
+			goto invalid;
+	}
+#endif
+	for (;i < len;++i) {
+		if (!decode8(line + i*8, data + i))
+			goto invalid;
 	}
 
 	return 0;
+
+  invalid:
+	for (unsigned j = i*8;j < len*8;++j) {
+		if (line[j] != '0' && line[j] != '1') {
+			fprintf(stderr, "Invalid char in bit string %c\n", line[j]);
+			break;
+		}
+	}
+	return -1;
+}
+
+/* Find the XO2DevList entry of a Lattice part number, given from after the
+   "LCMXO2-", e.g. "1200UHC-4TG100" is MachXO2-1200U.
+   Return 0 on success, -1 if the part is not in the list.
+*/
+static int lookup_device(const char *part, XO2Devices_t *devID)
+{
+	char name[32];
+	size_t digits = strspn(part, "0123456789");
+
+	if (digits == 0 || digits > 8)
+		return -1;
+
+	snprintf(name, sizeof(name), "MachXO2-%.*s%s", (int)digits, part,
+			 part[digits] == 'U' ? "U" : "");
+	for (int i = 0;i < LATTICE_XO2_NUM_DEVS;++i) {
+		if (strcmp(XO2DevList[i].pName, name) == 0) {
+			*devID = i;
+			return 0;
+		}
+	}
+
+	return -1;
 }
 
 /* Toplevel JEDEC parse state */
@@ -62,13 +215,8 @@ static int parse_field(parser_state_t *state, const char *line)
 	switch(line[0]) {
 	case 'N': // Comment
 		if (memcmp(line, "NOTE DEVICE NAME", 16) == 0) {
-			if (strstr(line, "LCMXO2-1200") != NULL) {
-				state->jedec->devID = MachXO2_1200;
-			} else if (strstr(line, "LCMXO2-640") != NULL) {
-				state->jedec->devID = MachXO2_640;
-			} else if (strstr(line, "LCMXO2-2000") != NULL) {
-				state->jedec->devID = MachXO2_2000;
-			} else {
+			const char *part = strstr(line, "LCMXO2-");
+			if (!part || lookup_device(part+7, &state->jedec->devID) != 0) {
 				fprintf(stderr, "Unsupported device\n");
 				return -1;
 			}
@@ -83,17 +231,23 @@ static int parse_field(parser_state_t *state, const char *line)
 				fprintf(stderr, "Could not parse:\n\t%s\n", line);
 				return -1;
 			}
-			if (state->data) {
+			if (state->data_len) {
 				fprintf(stderr, "Multiple QF records\n");
 				return -1;
 			}
 			state->jedec->pageCnt = fuses/128;
-			state->data = malloc(fuses/8);
-			if (!state->data) {
-				return -1;
+			if (!state->stream || state->keep) {
+				state->data = malloc(fuses/8);
+				if (!state->data) {
+					return -1;
+				}
+				memset(state->data, 0, fuses/8);
+				state->map = calloc(1, (fuses/128 + 7) / 8);
+				if (!state->map) {
+					return -1;
+				}
 			}
-			memset(state->data, 0, fuses/8);
-			state->data_pos = state->data;
+			state->data_pos = 0;
 			state->data_len = fuses/8;
 		} else if (line[1] == 'P') { // Pin count
 			// Ignore
@@ -111,13 +265,8 @@ static int parse_field(parser_state_t *state, const char *line)
 				fprintf(stderr, "Invalid fuse checksum: %s\n", line+1);
 				return -1;
 			}
-			for (size_t pos = 0;pos < state->data_len;++pos) {
-				uint8_t b = state->data[pos];
-				// Invert bit order, from
-				// http://graphics.stanford.edu/~seander/bithacks.html#ReverseByteWith64Bits
-				b = ((b * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32;
-				calc_csum += b;
-			}
+			// Added up while the fuse lines were decoded
+			calc_csum = state->fuse_csum;
 			if (calc_csum != csum) {
 				fprintf(stderr, "Fuse checksum failed: got %.4hx, expected %.4hx\n",
 						calc_csum, csum);
@@ -130,7 +279,7 @@ static int parse_field(parser_state_t *state, const char *line)
 			fprintf(stderr, "Could not parse:\n\t%s\n", line);
 			return -1;
 		}
-		if (!state->data) {
+		if (!state->data_len) {
 			fprintf(stderr, "Fuse data before QF record\n");
 			return -1;
 		}
@@ -147,17 +296,26 @@ static int parse_field(parser_state_t *state, const char *line)
 			return -1;
 		}
 
-		if (state->cur_fuse_addr < XO2DevList[state->jedec->devID].Cfgpages*16) {
-			state->jedec->pCfgData = state->data;
-		} else {
-			state->jedec->pUFMData = state->data + XO2DevList[state->jedec->devID].Cfgpages*16;
+		// Lines are streamed, mapped and digested as whole flash pages
+		if (state->cur_fuse_addr % XO2_FLASH_PAGE_SIZE != 0) {
+			fprintf(stderr, "Fuse data not page aligned, NYI\n");
+			return -1;
+		}
+
+		if (!state->stream || state->keep) {
+			if (state->cur_fuse_addr < XO2DevList[state->jedec->devID].Cfgpages*16)
+				state->jedec->pCfgData = state->data;
+			else
+				state->jedec->pUFMData = state->data + XO2DevList[state->jedec->devID].Cfgpages*16;
 		}
+		if (state->stream)
+			stream_header(state->stream);
 		state->cur_fuse_len = 0;
-		state->data_pos = state->data + (state->cur_fuse_addr);
+		state->data_pos = state->cur_fuse_addr;
 		state->state = S_FUSES;
 		break;
 	case 'E': // "Architecture fuses", feature row & bits for Lattice
-		if (parsebin(line+1, 8, state->jedec->pFeatureRow.feature) != 0) {
+		if (parsebin(line+1, state->line_end, 8, state->jedec->pFeatureRow.feature) != 0) {
 			return -1;
 		}
 
@@ -176,7 +334,7 @@ static int parse_field(parser_state_t *state, const char *line)
 			}
 			state->jedec->UserCode = line[2] << 24 | line[3] << 16 | line[5] << 8 | line[5];
 		} else if (line[1] == '0' || line[1] == '1') {
-			if (parsebin(line+1, 4, (uint8_t*)&state->jedec->UserCode) != 0) {
+			if (parsebin(line+1, state->line_end, 4, (uint8_t*)&state->jedec->UserCode) != 0) {
 				fprintf(stderr, "Invalid UserCode\n");
 				return -1;
 			}
@@ -193,6 +351,44 @@ static int parse_field(parser_state_t *state, const char *line)
 	return 0;
 }
 
+/* Account a decoded fuse line at data_pos while it is still in cache: the
+   line's 128 characters for the file checksum (48 for '0', 49 for '1'), the
+   bit reversed bytes for the fuse checksum, the page for the digest of its
+   sector and whether it is all 0 for the page map.  Pages after a gap are
+   digested after the gap's zeros, a page before the end of what was digested
+   means the digest has to be redone at the end.
+*/
+static void sum_page(parser_state_t *state, const uint8_t *page)
+{
+	static const uint8_t zero[256];
+	unsigned cfg_len = XO2DevList[state->jedec->devID].Cfgpages * XO2_FLASH_PAGE_SIZE;
+	unsigned sec = state->data_pos >= cfg_len;
+	unsigned off = sec ? state->data_pos - cfg_len : state->data_pos;
+	uint64_t lo, hi;
+	uint16_t csum = 0;
+
+	memcpy(&lo, page, sizeof(lo));
+	memcpy(&hi, page + 8, sizeof(hi));
+	state->file_csum += 128*'0' + __builtin_popcountll(lo) + __builtin_popcountll(hi);
+	for (int i = 0;i < XO2_FLASH_PAGE_SIZE;++i)
+		csum += bitrev8(page[i]);
+	state->fuse_csum += csum;
+	if ((lo | hi) && state->map)
+		state->map[state->data_pos / 128] |= 1 << (state->data_pos / 16 % 8);
+
+	if (off < state->crc_len[sec]) {
+		state->crc_broken = true;
+		return;
+	}
+	while (state->crc_len[sec] < off) {
+		unsigned n = off - state->crc_len[sec] < sizeof(zero) ? off - state->crc_len[sec] : sizeof(zero);
+		state->crc[sec] = digest_crc32c(state->crc[sec], zero, n);
+		state->crc_len[sec] += n;
+	}
+	state->crc[sec] = digest_crc32c(state->crc[sec], page, XO2_FLASH_PAGE_SIZE);
+	state->crc_len[sec] += XO2_FLASH_PAGE_SIZE;
+}
+
 /* JEDEC 'L' (fuse data) parse state */
 static int parse_fuses(parser_state_t *state, const char *line)
 {
@@ -200,16 +396,29 @@ static int parse_fuses(parser_state_t *state, const char *line)
 	case '0':
 	case '1':
 		// parse binary data
-		if (state->data_pos - state->data > state->data_len-16) {
+		if (state->data_pos > state->data_len-16) {
 			fprintf(stderr, "Data overflow\n");
 			return -1;
 		}
-		if (line[128] != '\n' && line[128] != '\r') {
+		if (state->line_end - line > 128 && line[128] != '\n' && line[128] != '\r') {
 			fprintf(stderr, "Fuse data line too long\n");
 			return -1;
 		}
-		if (parsebin(line, 16, state->data_pos) != 0)
+		if (state->line_end - line < 128) {
+			fprintf(stderr, "Fuse data line too short\n");
+			return -1;
+		}
+		if (state->stream && !state->keep) {
+			uint8_t *page = stream_slot(state->stream);
+			if (!page || parsebin(line, state->line_end, 16, page) != 0)
+				return -1;
+			sum_page(state, page);
+			stream_commit(state->stream, state->data_pos / XO2_FLASH_PAGE_SIZE);
+		} else if (parsebin(line, state->line_end, 16, state->data + state->data_pos) != 0) {
 			return -1;
+		} else {
+			sum_page(state, state->data + state->data_pos);
+		}
 
 		state->data_pos += 16;
 		state->cur_fuse_len += 16;
@@ -222,7 +431,8 @@ static int parse_fuses(parser_state_t *state, const char *line)
 				state->jedec->CfgDataSize = XO2DevList[state->jedec->devID].Cfgpages*16u;
 				state->cur_fuse_len -= XO2DevList[state->jedec->devID].Cfgpages*16u - state->cur_fuse_addr;
 				state->cur_fuse_addr = XO2DevList[state->jedec->devID].Cfgpages*16u;
-				state->jedec->pUFMData = state->data + XO2DevList[state->jedec->devID].Cfgpages*16;
+				if (state->data)
+					state->jedec->pUFMData = state->data + XO2DevList[state->jedec->devID].Cfgpages*16;
 			} else if (state->cur_fuse_addr + state->cur_fuse_len > state->jedec->CfgDataSize) {
 				state->jedec->CfgDataSize = (state->cur_fuse_addr + state->cur_fuse_len);
 			}
@@ -245,7 +455,7 @@ static int parse_fuses(parser_state_t *state, const char *line)
 /* JEDEC 'E' (feature fuse data) parse state */
 static int parse_featrow(parser_state_t *state, const char *line)
 {
-	if (parsebin(line, 2, state->jedec->pFeatureRow.feabits) != 0) {
+	if (parsebin(line, state->line_end, 2, state->jedec->pFeatureRow.feabits) != 0) {
 		fprintf(stderr, "Invalid feature bits record\n");
 		return -1;
 	}
@@ -257,108 +467,849 @@ static int parse_featrow(parser_state_t *state, const char *line)
 	return 0;
 }
 
-XO2_JEDEC_t *jedec_parse(FILE *jedfile)
+/* Records other than fuse data are copied into a buffer of this size to be
+   NUL terminated for sscanf() and friends, longer ones are cut off.
+*/
+#define RECORD_MAX_LEN 256
+#define READ_BLOCK_SIZE (256*1024)
+
+/* The fuse data belongs to the parsed JEDEC, jedec_free() releases both */
+typedef struct {
+	XO2_JEDEC_t jedec;
+	uint8_t *data;
+	size_t mapLen;		// data is mapped, not malloc'ed
+	uint8_t *map;		// page map built while parsing
+} jedec_image_t;
+
+/**
+ * Allocate an empty JEDEC that owns a buffer holding its fuse data.
+ *
+ * @param data buffer from malloc(), or from mmap() if mapLen is not 0
+ * @param mapLen length of the mapping
+ * @return the JEDEC, to be released with jedec_free(), NULL if out of memory
+ */
+XO2_JEDEC_t *jedec_alloc(void *data, size_t mapLen)
 {
-	parser_state_t state;
-	int c;
-	if (!jedfile)
+	jedec_image_t *img = calloc(1, sizeof(*img));
+
+	if (!img)
 		return NULL;
+	img->data = data;
+	img->mapLen = mapLen;
+	return &img->jedec;
+}
 
-	while (true) {
-		c = fgetc(jedfile);
+/* Parse one line, in place for fuse data, else from a NUL terminated copy */
+static int parse_line(parser_state_t *state, const char *line, size_t len)
+{
+	char record[RECORD_MAX_LEN];
 
-		if (c == EOF) {
-			fprintf(stderr, "Unexpected end of file\n");
-			return NULL;
+	if (state->state != S_FUSES || (line[0] != '0' && line[0] != '1')) {
+		if (len > sizeof(record) - 1)
+			len = sizeof(record) - 1;
+		memcpy(record, line, len);
+		record[len] = '\0';
+		line = record;
+	}
+	state->line_end = line + len;
+
+	switch (state->state) {
+	case S_START:
+		return parse_field(state, line);
+	case S_FUSES:
+		return parse_fuses(state, line);
+	case S_FEATROW:
+		return parse_featrow(state, line);
+	}
+	return -1;
+}
+
+/* Start parsing after the ^B that starts the JEDEC data */
+static void parse_start(parser_state_t *state, XO2_JEDEC_t *jedec)
+{
+	memset(state, 0, sizeof(*state));
+	state->state = S_START;
+	state->jedec = jedec;
+	state->do_csum = true;
+	state->file_csum = 0x02; // File checksum includes the initial ^B
+}
+
+/* All of the file has been parsed: take over the sector digests, or if the fuse
+   data came out of order, digest the sectors now if the data is at hand.
+   The page map is packed to the layout of XO2_JEDEC_t.pPageMap, with the UFM
+   bits right after the used Cfg pages instead of after the whole Cfg sector.
+*/
+static void parse_finish(parser_state_t *state)
+{
+	XO2_JEDEC_t *jedec = state->jedec;
+	unsigned cfgPgs, ufmPg, i;
+
+	if (state->map) {
+		cfgPgs = jedec->pCfgData ? jedec->CfgDataSize / XO2_FLASH_PAGE_SIZE : 0;
+		ufmPg = XO2DevList[jedec->devID].Cfgpages;
+		for (i = 0;jedec->pUFMData && i < jedec->UFMDataSize / XO2_FLASH_PAGE_SIZE;++i) {
+			unsigned from = ufmPg + i, to = cfgPgs + i;
+			bool set = state->map[from / 8] & (1 << (from % 8));
+
+			state->map[to / 8] = (state->map[to / 8] & ~(1 << (to % 8))) | (set << (to % 8));
 		}
+		jedec->pPageMap = state->map;
+	}
 
-		// ^B - Start of JEDEC data
-		if ((unsigned char)c == 0x02)
-			break;
+	if (!state->crc_broken && state->crc_len[0] == jedec->CfgDataSize &&
+		state->crc_len[1] == jedec->UFMDataSize) {
+		jedec->CfgDigest = state->crc[0];
+		jedec->UFMDigest = state->crc[1];
+		jedec->digestValid = true;
+	} else if (state->data) {
+		jedec->CfgDigest = jedec->pCfgData ? digest_crc32c(0, jedec->pCfgData, jedec->CfgDataSize) : 0;
+		jedec->UFMDigest = jedec->pUFMData ? digest_crc32c(0, jedec->pUFMData, jedec->UFMDataSize) : 0;
+		jedec->digestValid = true;
 	}
+}
 
-	memset(&state, 0, sizeof(state));
-	state.state = S_START;
-	state.jedec = malloc(sizeof(*state.jedec));
-	if (!state.jedec)
-		return NULL;
+/* Add characters to the file checksum until and including the terminating ^C */
+static void sum_chars(parser_state_t *state, const char *pos, const char *end)
+{
+	const char *stop = memchr(pos, 0x03, end - pos);
+	uint16_t csum = 0;
 
+	if (stop) {
+		end = stop + 1;
+		state->do_csum = false;
+	}
+	for (const char *p = pos;p < end;++p)
+		csum += (uint8_t)*p;
+	state->file_csum += csum;
+}
+
+/* Parse one line from pos up to eol, which is after its newline if it has one.
+   Return 0 to go on, 1 at the end of the JEDEC data, -1 on error.
+*/
+static int parse_text_line(parser_state_t *state, const char *pos, const char *eol)
+{
+	// File checksum includes every character including newline until and
+	// including the terminating ^C.  The 128 fuses of a fuse line are added
+	// by sum_page() when decoded, only the line end is left.
+	if (state->do_csum) {
+		if (state->state == S_FUSES && eol - pos >= 128 && (pos[0] == '0' || pos[0] == '1'))
+			sum_chars(state, pos + 128, eol);
+		else
+			sum_chars(state, pos, eol);
+	}
+
+	// File checksum is stored as four hex digits after the terminating ^C
+	if (pos[0] == 0x03) {
+		char record[RECORD_MAX_LEN];
+		size_t n = eol - pos < (ptrdiff_t)sizeof(record) ? (size_t)(eol - pos) : sizeof(record) - 1;
+		uint16_t csum;
+
+		memcpy(record, pos, n);
+		record[n] = '\0';
+		if (sscanf(record+1, "%hx", &csum) != 1) {
+			fprintf(stderr, "Invalid file checksum: %s\n", record+1);
+			return -1;
+		}
+		if (state->file_csum != csum) {
+			fprintf(stderr, "File checksum failed: got %.4hx, expected %.4hx\n",
+					state->file_csum, csum);
+			return -1;
+		}
+		parse_finish(state);
+		return 1; // ^C - End of JEDEC data
+	}
+	if (eol - pos <= 1) {
+		return 0;
+	}
+
+	return parse_line(state, pos, eol - pos);
+}
+
+/* Parse a JEDEC file read block by block into buf, for input that is not at
+   hand as a whole, e.g. decompressed on the fly.  Lines are parsed as they
+   are complete, the rest is moved to the start of buf for the next block.
+   The first len bytes of buf are already read.  Stop early if cancel becomes
+   set, by another thread.
+   Return 0 on success, -1 on error.
+*/
+static int parse_blocks(parser_state_t *state, reader_t *r, char *buf, size_t size,
+						size_t len, const atomic_bool *cancel)
+{
+	const char *pos, *eol, *end;
+	bool started = false, eof = false;
+	ssize_t n;
 	int ret;
-	bool do_csum = true;
-	uint16_t calc_csum = 0x02; // File checksum includes the initial ^B
-	while(true) {
-		char *line = NULL;
-		size_t linesize = 0;
-		ssize_t len = getline(&line, &linesize, jedfile);
-		if (len == -1) {
-			free(line);
-			if (feof(jedfile)) {
-				fprintf(stderr, "Unexpected end of file\n");
-			} else {
-				fprintf(stderr, "getline() failed: %s\n", strerror(errno));
+
+	while (!eof && !(cancel && atomic_load(cancel))) {
+		n = reader_read(r, buf + len, size - len);
+		if (n < 0)
+			return -1;
+		eof = n == 0;
+		len += n;
+		pos = buf;
+		end = buf + len;
+
+		// ^B - Start of JEDEC data
+		if (!started) {
+			pos = memchr(buf, 0x02, len);
+			if (!pos) {
+				len = 0;
+				continue;
 			}
-			goto fail;
+			++pos;
+			started = true;
 		}
 
-		// File checksum includes every character including newline
-		// until and including the terminating ^C
-		for (int p = 0;p < len;++p) {
-			if (do_csum) {
-				calc_csum += line[p];
-			}
-			if (line[p] == 0x03) {
-				do_csum = false;
-			}
+		for (;;pos = eol) {
+			eol = memchr(pos, '\n', end - pos);
+			if (!eol && !eof)
+				break;
+			if (pos == end)
+				break;
+			eol = eol ? eol + 1 : end;
+
+			ret = parse_text_line(state, pos, eol);
+			if (ret < 0)
+				return -1;
+			if (ret > 0)
+				return 0;
 		}
 
-		// File checksum is stored as four hex digits after the terminating ^C
-		if (line[0] == 0x03) {
-			uint16_t csum;
-			if (sscanf(line+1, "%hx", &csum) != 1) {
-				fprintf(stderr, "Invalid file checksum: %s\n", line+1);
-				free(line);
-				goto fail;
-			}
-			if (calc_csum != csum) {
-				fprintf(stderr, "File checksum failed: got %.4hx, expected %.4hx\n",
-						calc_csum, csum);
-				free(line);
-				goto fail;
-			}
-			break; // ^C - End of JEDEC data
+		len = end - pos;
+		memmove(buf, pos, len);
+		if (len == size) {
+			fprintf(stderr, "Line too long\n");
+			return -1;
 		}
-		if (len <= 1) {
-			free(line);
-			continue;
+	}
+	if (eof)
+		fprintf(stderr, "Unexpected end of file\n");
+	return -1;
+}
+
+/* Parse compressed JEDEC file contents, decompressing a block at a time */
+static XO2_JEDEC_t *parse_compressed(const char *buf, size_t len)
+{
+	parser_state_t state;
+	jedec_image_t *img;
+	char *block;
+	reader_t *r;
+	int ret = -1;
+
+	img = calloc(1, sizeof(*img));
+	block = malloc(READ_BLOCK_SIZE);
+	r = reader_open(-1, buf, len);
+	if (img && block && r) {
+		parse_start(&state, &img->jedec);
+		ret = parse_blocks(&state, r, block, READ_BLOCK_SIZE, 0, NULL);
+		if (ret == 0) {
+			img->data = state.data;
+			img->map = state.map;
+		} else {
+			free(state.data);
+			free(state.map);
 		}
+	}
+	reader_close(r);
+	free(block);
+	if (ret != 0) {
+		free(img);
+		return NULL;
+	}
+	return &img->jedec;
+}
 
-		switch (state.state) {
-		case S_START:
-			ret = parse_field(&state, line);
-			break;
-		case S_FUSES:
-			ret = parse_fuses(&state, line);
-			break;
-		case S_FEATROW:
-			ret = parse_featrow(&state, line);
-			break;
+/**
+ * Parse a JEDEC file held in memory.
+ *
+ * gzip or zstd compressed contents are decompressed while parsing.
+ *
+ * @param buf file contents, need not be NUL terminated
+ * @param len length of the file
+ * @return the parsed JEDEC, to be released with jedec_free(), NULL on error
+ */
+XO2_JEDEC_t *jedec_parse_mem(const char *buf, size_t len)
+{
+	const char *pos, *end = buf + len, *eol;
+	parser_state_t state;
+	jedec_image_t *img;
+	int ret;
+
+	if (reader_detect(buf, len) != READER_PLAIN)
+		return parse_compressed(buf, len);
+
+	// ^B - Start of JEDEC data
+	pos = memchr(buf, 0x02, len);
+	if (!pos) {
+		fprintf(stderr, "Unexpected end of file\n");
+		return NULL;
+	}
+	++pos;
+
+	img = calloc(1, sizeof(*img));
+	if (!img)
+		return NULL;
+	parse_start(&state, &img->jedec);
+
+	for (;;pos = eol) {
+		if (pos == end) {
+			fprintf(stderr, "Unexpected end of file\n");
+			goto fail;
 		}
+		eol = memchr(pos, '\n', end - pos);
+		eol = eol ? eol + 1 : end;
 
-		free(line);
-		if (ret != 0)
+		ret = parse_text_line(&state, pos, eol);
+		if (ret < 0)
 			goto fail;
+		if (ret > 0)
+			break;
 	}
 
-	return state.jedec;
+	img->data = state.data;
+	img->map = state.map;
+	return &img->jedec;
 
   fail:
 	if (state.data)
 		free(state.data);
-	free(state.jedec);
+	free(state.map);
+	free(img);
+	return NULL;
+}
+
+/* Read a stream to its end in large blocks, returns a malloc'ed buffer */
+static char *read_all(int fd, size_t *pLen)
+{
+	char *buf = NULL, *tmp;
+	size_t len = 0, size = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (size - len < READ_BLOCK_SIZE) {
+			size = size ? size * 2 : READ_BLOCK_SIZE;
+			tmp = realloc(buf, size);
+			if (!tmp)
+				goto fail;
+			buf = tmp;
+		}
+
+		n = read(fd, buf + len, size - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "read() failed: %s\n", strerror(errno));
+			goto fail;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+
+	*pLen = len;
+	return buf;
+
+  fail:
+	free(buf);
 	return NULL;
 }
 
+/**
+ * Parse a JEDEC file.  Regular files are mapped into memory, anything else,
+ * e.g. a pipe, is read in large blocks.  A precompiled image (see xo2img.c)
+ * is used in place instead, its mapping or buffer is kept for the JEDEC.
+ * gzip or zstd compressed files are decompressed while parsing.
+ *
+ * @param path file to parse, "-" for stdin
+ * @return the parsed JEDEC, to be released with jedec_free(), NULL on error
+ */
+XO2_JEDEC_t *jedec_parse_file(const char *path)
+{
+	XO2_JEDEC_t *jedec = NULL;
+	struct stat st;
+	size_t len;
+	char *buf;
+	void *map;
+	int fd;
+
+	fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		// Writable copy-on-write, so an image can be used as any other JEDEC
+		map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			if (xo2img_probe(map, st.st_size)) {
+				jedec = xo2img_attach(map, st.st_size, st.st_size);
+				if (!jedec)
+					munmap(map, st.st_size);
+				goto done;
+			}
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			jedec = jedec_parse_mem(map, st.st_size);
+			munmap(map, st.st_size);
+			goto done;
+		}
+	}
+
+	buf = read_all(fd, &len);
+	if (buf && xo2img_probe(buf, len)) {
+		jedec = xo2img_attach(buf, len, 0);
+		if (!jedec)
+			free(buf);
+	} else if (buf) {
+		jedec = jedec_parse_mem(buf, len);
+		free(buf);
+	}
+
+  done:
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return jedec;
+}
+
+/**
+ * Parse a JEDEC file from a stream, read to its end in large blocks.
+ * The stream stays open.  A precompiled image is taken as is.
+ *
+ * @param jedfile stream to parse
+ * @return the parsed JEDEC, to be released with jedec_free(), NULL on error
+ */
+XO2_JEDEC_t *jedec_parse(FILE *jedfile)
+{
+	XO2_JEDEC_t *jedec;
+	char *buf = NULL, *tmp;
+	size_t len = 0, n;
+
+	if (!jedfile)
+		return NULL;
+
+	do {
+		tmp = realloc(buf, len + READ_BLOCK_SIZE);
+		if (!tmp) {
+			free(buf);
+			return NULL;
+		}
+		buf = tmp;
+		n = fread(buf + len, 1, READ_BLOCK_SIZE, jedfile);
+		len += n;
+	} while (n == READ_BLOCK_SIZE);
+
+	if (ferror(jedfile)) {
+		fprintf(stderr, "fread() failed: %s\n", strerror(errno));
+		free(buf);
+		return NULL;
+	}
+
+	if (xo2img_probe(buf, len)) {
+		jedec = xo2img_attach(buf, len, 0);
+		if (!jedec)
+			free(buf);
+		return jedec;
+	}
+
+	jedec = jedec_parse_mem(buf, len);
+	free(buf);
+	return jedec;
+}
+
+/**
+ * Release a parsed JEDEC including its fuse data.
+ *
+ * @param jedec JEDEC returned by one of the jedec_parse functions, may be NULL
+ */
 void jedec_free(XO2_JEDEC_t *jedec)
 {
-	free(jedec);
+	jedec_image_t *img = (jedec_image_t *)jedec;  // jedec is the first member
+
+	if (!img)
+		return;
+	if (img->mapLen)
+		munmap(img->data, img->mapLen);
+	else
+		free(img->data);
+	free(img->map);
+	free(img);
+}
+
+/* Streaming parser
+ *
+ * A thread reads and parses the file and hands the fuse pages over through a
+ * ring of STREAM_RING_PGS pages, so programming can start before the file is
+ * complete and the fuse data never needs to be held in full.
+ *
+ * Loaded with jedec_stream_load() instead, the thread keeps the fuse data
+ * like jedec_parse_file() and the ring stays unused, only the header is
+ * known early.
+ */
+
+#define STREAM_RING_PGS 1024
+#define STREAM_BLOCK_SIZE (64*1024)
+
+struct jedec_stream {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	// signalled on every change of the fields below
+	int fd;
+	parser_state_t state;
+	XO2_JEDEC_t *jedec;
+	uint8_t ring[STREAM_RING_PGS][XO2_FLASH_PAGE_SIZE];
+	unsigned ring_pg[STREAM_RING_PGS];	// fuse page number of each ring entry
+	unsigned head, tail;	// free running, entries tail..head-1 are filled
+	unsigned taken;		// entries handed out, released by the next call
+	bool header, done;
+	atomic_bool cancel;	// set under lock, also read by the parser without it
+	bool handed;		// jedec belongs to the caller of jedec_stream_header()
+	int result;		// once done: 0 if the file parsed with good checksums
+	char buf[STREAM_BLOCK_SIZE];
+};
+
+/* Wait for a free ring entry, NULL if the stream is being closed */
+static uint8_t *stream_slot(jedec_stream_t *s)
+{
+	uint8_t *page = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->head - s->tail == STREAM_RING_PGS && !s->cancel)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (!s->cancel)
+		page = s->ring[s->head % STREAM_RING_PGS];
+	pthread_mutex_unlock(&s->lock);
+	return page;
+}
+
+/* Publish the entry returned by stream_slot() */
+static void stream_commit(jedec_stream_t *s, unsigned page)
+{
+	pthread_mutex_lock(&s->lock);
+	s->ring_pg[s->head % STREAM_RING_PGS] = page;
+	s->head++;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* The device and the fuse count are known */
+static void stream_header(jedec_stream_t *s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->header = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void *stream_thread(void *arg)
+{
+	jedec_stream_t *s = arg;
+	reader_t *r;
+	int ret = -1;
+
+	r = reader_open(s->fd, NULL, 0);
+	if (r)
+		ret = parse_blocks(&s->state, r, s->buf, sizeof(s->buf), 0, &s->cancel);
+	reader_close(r);
+
+	pthread_mutex_lock(&s->lock);
+	s->result = ret;
+	s->done = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+/* Read the rest of a precompiled image, the first len bytes are in s->buf,
+   and put it in place of s->jedec.  Return 0 on success, -1 on error.
+*/
+static int load_image(jedec_stream_t *s, reader_t *r, size_t len)
+{
+	XO2_JEDEC_t *jedec;
+	char *buf, *tmp;
+	size_t size = sizeof(s->buf);
+	ssize_t n;
+
+	buf = malloc(size);
+	if (!buf)
+		return -1;
+	memcpy(buf, s->buf, len);
+	while ((n = reader_read(r, buf + len, size - len)) > 0 && !atomic_load(&s->cancel)) {
+		len += n;
+		if (len == size) {
+			tmp = realloc(buf, size * 2);
+			if (!tmp)
+				break;
+			buf = tmp;
+			size *= 2;
+		}
+	}
+	if (n != 0) {
+		free(buf);
+		return -1;
+	}
+
+	jedec = xo2img_attach(buf, len, 0);
+	if (!jedec) {
+		free(buf);
+		return -1;
+	}
+	jedec_free(s->jedec);  // not handed out before done
+	s->jedec = jedec;
+	return 0;
+}
+
+static void *load_thread(void *arg)
+{
+	jedec_stream_t *s = arg;
+	jedec_image_t *img = (jedec_image_t *)s->jedec;
+	reader_t *r;
+	size_t len = 0;
+	ssize_t n = 0;
+	int ret = -1;
+
+	// Enough to tell a precompiled image from a JEDEC file
+	r = reader_open(s->fd, NULL, 0);
+	while (r && len < XO2IMG_MAGIC_LEN && (n = reader_read(r, s->buf + len, XO2IMG_MAGIC_LEN - len)) > 0)
+		len += n;
+	if (r && n >= 0) {
+		if (xo2img_probe(s->buf, len)) {
+			ret = load_image(s, r, len);
+		} else {
+			ret = parse_blocks(&s->state, r, s->buf, sizeof(s->buf), len, &s->cancel);
+			if (ret == 0) {
+				img->data = s->state.data;
+				img->map = s->state.map;
+			} else {
+				free(s->state.data);
+				free(s->state.map);
+			}
+		}
+	}
+	reader_close(r);
+
+	pthread_mutex_lock(&s->lock);
+	s->result = ret;
+	s->done = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+/* XO2PageSource_t.nextPages */
+static int stream_next(void *pCtx, XO2SectorMode_t *pSector, unsigned int *pStartPg,
+					   unsigned int maxPgs, const unsigned char **ppData)
+{
+	jedec_stream_t *s = pCtx;
+	unsigned cfgPgs = XO2DevList[s->jedec->devID].Cfgpages;
+	unsigned idx, pg, n, want;
+
+	pthread_mutex_lock(&s->lock);
+	s->tail += s->taken;
+	s->taken = 0;
+	pthread_cond_broadcast(&s->cond);
+
+	// Wait for a good run of pages, the page writes check status after each
+	idx = s->tail % STREAM_RING_PGS;
+	want = maxPgs < STREAM_RING_PGS - idx ? maxPgs : STREAM_RING_PGS - idx;
+	while (s->head - s->tail < want && !s->done)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (s->done && (s->result != 0 || s->head == s->tail)) {
+		pthread_mutex_unlock(&s->lock);
+		return s->result != 0 ? -1 : 0;
+	}
+
+	pg = s->ring_pg[idx];
+	for (n = 1;n < want && s->tail + n != s->head;++n) {
+		if (s->ring_pg[idx + n] != pg + n || pg + n == cfgPgs)
+			break;
+	}
+	s->taken = n;
+	pthread_mutex_unlock(&s->lock);
+
+	*pSector = pg < cfgPgs ? CFG_SECTOR : UFM_SECTOR;
+	*pStartPg = pg < cfgPgs ? pg : pg - cfgPgs;
+	*ppData = s->ring[idx];
+	return n;
+}
+
+/* XO2PageSource_t.finish */
+static int stream_finish(void *pCtx, XO2_JEDEC_t *pSummary)
+{
+	jedec_stream_t *s = pCtx;
+	int result;
+
+	// Pages not taken are dropped until the parser is through
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		s->tail = s->head;
+		s->taken = 0;
+		pthread_cond_broadcast(&s->cond);
+		if (s->done)
+			break;
+		pthread_cond_wait(&s->cond, &s->lock);
+	}
+	result = s->result;
+	pthread_mutex_unlock(&s->lock);
+
+	if (result != 0)
+		return ERROR;
+	*pSummary = *s->jedec;
+	pSummary->pCfgData = NULL;
+	pSummary->pUFMData = NULL;
+	pSummary->pPageMap = NULL;
+	return OK;
+}
+
+/**
+ * Start parsing a JEDEC file in the background, for programming while it is
+ * still being read.  Only the fuse pages in flight are kept in memory.
+ * gzip or zstd compressed files are decompressed on the fly.
+ *
+ * @param path file to parse, "-" for stdin
+ * @return the stream, to be closed with jedec_stream_close(), NULL on error
+ */
+jedec_stream_t *jedec_stream_open(const char *path)
+{
+	return stream_start(path, false);
+}
+
+/**
+ * Start loading a JEDEC file or precompiled image in the background, so the
+ * device can be prepared while it is read, decompressed and parsed.  Unlike
+ * jedec_stream_open() the fuse data is kept in full.
+ *
+ * @param path file to load, "-" for stdin
+ * @return the stream, to be closed with jedec_stream_close(), NULL on error
+ */
+jedec_stream_t *jedec_stream_load(const char *path)
+{
+	return stream_start(path, true);
+}
+
+/* Open path and start the parser thread, see jedec_stream_load() for keep */
+static jedec_stream_t *stream_start(const char *path, bool keep)
+{
+	jedec_stream_t *s = calloc(1, sizeof(*s));
+
+	if (!s)
+		return NULL;
+	s->jedec = jedec_alloc(NULL, 0);
+	if (!s->jedec) {
+		free(s);
+		return NULL;
+	}
+	s->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+	if (s->fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		goto fail;
+	}
+
+	parse_start(&s->state, s->jedec);
+	s->state.stream = s;
+	s->state.keep = keep;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	if (pthread_create(&s->thread, NULL, keep ? load_thread : stream_thread, s) != 0) {
+		fprintf(stderr, "Could not start parser thread\n");
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->lock);
+		if (s->fd != STDIN_FILENO)
+			close(s->fd);
+		goto fail;
+	}
+	return s;
+
+  fail:
+	jedec_free(s->jedec);
+	free(s);
+	return NULL;
+}
+
+/**
+ * Wait for the header of a streamed JEDEC file.
+ *
+ * @param s stream
+ * @return the JEDEC with devID and pageCnt set, NULL if the file failed to
+ * parse before the fuse data.  The data sizes and the Feature Row are only
+ * valid after the page source's finish() returned OK, the fuse data pointers
+ * stay NULL.  It belongs to the caller, release it with jedec_free() after
+ * jedec_stream_close().  Of a stream from jedec_stream_load() it stays with
+ * the stream and only devID is to be used, jedec_stream_wait() returns the
+ * complete JEDEC.
+ */
+XO2_JEDEC_t *jedec_stream_header(jedec_stream_t *s)
+{
+	bool ok;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->header && !s->done)
+		pthread_cond_wait(&s->cond, &s->lock);
+	ok = s->header || s->result == 0;
+	if (!s->state.keep)
+		s->handed = ok;
+	pthread_mutex_unlock(&s->lock);
+
+	return ok ? s->jedec : NULL;
+}
+
+/**
+ * Wait until a file started with jedec_stream_load() is loaded.
+ *
+ * @param s stream
+ * @return the JEDEC as from jedec_parse_file(), NULL on error.  It belongs to
+ * the caller, release it with jedec_free() after jedec_stream_close().
+ */
+XO2_JEDEC_t *jedec_stream_wait(jedec_stream_t *s)
+{
+	bool ok;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->done)
+		pthread_cond_wait(&s->cond, &s->lock);
+	ok = s->result == 0;
+	s->handed = ok;
+	pthread_mutex_unlock(&s->lock);
+
+	return ok ? s->jedec : NULL;
+}
+
+/**
+ * Get the page source for XO2ECA_apiProgramStream() of a stream.  Its
+ * finish() only returns OK if the whole file parsed and both the fuse and the
+ * file checksum matched.
+ *
+ * @param s stream
+ * @param pSrc filled with the page source
+ */
+void jedec_stream_source(jedec_stream_t *s, XO2PageSource_t *pSrc)
+{
+	pSrc->pCtx = s;
+	pSrc->nextPages = stream_next;
+	pSrc->finish = stream_finish;
+}
+
+/**
+ * Stop parsing and release the stream, but not the JEDEC header returned by
+ * jedec_stream_header().
+ *
+ * @param s stream, may be NULL
+ */
+void jedec_stream_close(jedec_stream_t *s)
+{
+	if (!s)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	atomic_store(&s->cancel, true);
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+
+	if (s->fd != STDIN_FILENO)
+		close(s->fd);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	if (!s->handed)
+		jedec_free(s->jedec);
+	free(s);
 }
@@ -10,8 +10,21 @@
 
 #include <stdio.h>
 #include "XO2_ECA/XO2_dev.h"
+#include "XO2_ECA/XO2_api.h"
+
+typedef struct jedec_stream jedec_stream_t;
 
 XO2_JEDEC_t *jedec_parse(FILE *jedfile);
+XO2_JEDEC_t *jedec_parse_file(const char *path);
+XO2_JEDEC_t *jedec_parse_mem(const char *buf, size_t len);
+XO2_JEDEC_t *jedec_alloc(void *data, size_t mapLen);
 void jedec_free(XO2_JEDEC_t *jedec);
 
+jedec_stream_t *jedec_stream_open(const char *path);
+jedec_stream_t *jedec_stream_load(const char *path);
+XO2_JEDEC_t *jedec_stream_header(jedec_stream_t *s);
+XO2_JEDEC_t *jedec_stream_wait(jedec_stream_t *s);
+void jedec_stream_source(jedec_stream_t *s, XO2PageSource_t *pSrc);
+void jedec_stream_close(jedec_stream_t *s);
+
 #endif
@@ -8,85 +8,403 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <linux/i2c-dev.h>
+#include <getopt.h>
 
 #include "XO2_ECA/XO2_api.h"
+#include "XO2_ECA/XO2_drvr.h"
+#include "XO2_ECA/XO2_sim.h"
+#include "XO2_ECA/XO2_timing.h"
+#include "XO2_ECA/XO2_stats.h"
 #include "jedec.h"
+#include "xo2img.h"
 
 void usage(const char *arg0)
 {
-	fprintf(stderr, "Usage: %s [-l] [-u] [-f] <i2c-bus> <i2c-addr> <bitstream.jed>\n", arg0);
+	fprintf(stderr, "Usage: %s [-l | -o [-F]] [-u] [-f] [-v] [-s | -d [-q] | -j <journal> [-R]] [-t <link>] [-T <profile> | -C <profile>] [--stats[=<file>]] <i2c-bus> <i2c-addr> <bitstream.jed>\n", arg0);
+	fprintf(stderr, "       %s [-u] [-t <link>] --dump <snapshot.bin> <i2c-bus> <i2c-addr> <bitstream.jed | part>\n", arg0);
+	fprintf(stderr, "       %s --convert <image.xo2img> <bitstream.jed>\n", arg0);
+	fprintf(stderr, "\tThe bitstream is a JEDEC file or a precompiled .xo2img image, - for stdin.\n");
+	fprintf(stderr, "\tIt is loaded while the device is erased, DONE is only set if it is valid\n");
 	fprintf(stderr, "\t-l\tLoad new bitstream after flashing\n");
+	fprintf(stderr, "\t-o\tOffline: halt the design while flashing, the new one is\n");
+	fprintf(stderr, "\t\tloaded after flashing\n");
+	fprintf(stderr, "\t-F\tFlash the Feature Row as well, only if it differs\n");
 	fprintf(stderr, "\t-u\tFlash UFM sector\n");
 	fprintf(stderr, "\t-f\tForce programming\n");
+	fprintf(stderr, "\t-v\tVerify: read back what was programmed and compare its CRC32C\n");
+	fprintf(stderr, "\t\twith the bitstream's before setting DONE\n");
+	fprintf(stderr, "\t-s\tStream: program while the bitstream is being read and parsed,\n");
+	fprintf(stderr, "\t\te.g. from a pipe.  DONE is only set if the whole file is valid\n");
+	fprintf(stderr, "\t-d\tDiff: only compare device Cfg, Feature Row and with -u UFM to\n");
+	fprintf(stderr, "\t\tthe bitstream.  Exit status 0 if identical, 2 if different\n");
+	fprintf(stderr, "\t-q\tDiff: stop at the first difference\n");
+	fprintf(stderr, "\t-j\tJournal: record the programming progress in a file, it is\n");
+	fprintf(stderr, "\t\tremoved once programming succeeded\n");
+	fprintf(stderr, "\t-R\tResume the interrupted run recorded in the journal without\n");
+	fprintf(stderr, "\t\terasing again, same bitstream and options required\n");
+	fprintf(stderr, "\t-t\tLink to the device: i2c (default), smbus, spi or sim\n");
+	fprintf(stderr, "\t\tspi: <i2c-bus> is the spidev node, <i2c-addr> the SPI clock in Hz\n");
+	fprintf(stderr, "\t\tsim: <i2c-bus> and <i2c-addr> are ignored, a blank device with\n");
+	fprintf(stderr, "\t\t     typical erase/program/refresh times is simulated\n");
+	fprintf(stderr, "\t-T\tUse erase/program/refresh times from timing profile\n");
+	fprintf(stderr, "\t-C\tCalibrate: measure erase/program/refresh times while flashing\n");
+	fprintf(stderr, "\t\tand store them in timing profile\n");
+	fprintf(stderr, "\t--stats\tPrint command statistics as JSON at the end of the run,\n");
+	fprintf(stderr, "\t\tto stderr or the given file\n");
+	fprintf(stderr, "\t--dump\tRead back the Cfg sector, with -u followed by the UFM, into\n");
+	fprintf(stderr, "\t\ta raw file, then exit.  The part, e.g. MachXO2-1200, may be\n");
+	fprintf(stderr, "\t\tgiven instead of a bitstream\n");
+	fprintf(stderr, "\t--convert\tPrecompile the bitstream into an image that loads\n");
+	fprintf(stderr, "\t\twithout parsing, then exit\n");
+}
+
+static const struct option longOpts[] = {
+	{"stats", optional_argument, NULL, 'S'},
+	{"convert", required_argument, NULL, 'X'},
+	{"dump", required_argument, NULL, 'D'},
+	{NULL, 0, NULL, 0}
+};
+
+static void print_diff(const XO2DiffReport_t *pReport)
+{
+	static const char *sectorNames[] = {"Cfg", "UFM", "Feature Row", "SRAM"};
+	unsigned int i;
+
+	for (i = 0;i < pReport->numRanges && i < XO2ECA_DIFF_MAX_RANGES;++i) {
+		const XO2DiffRange_t *r = &pReport->ranges[i];
+		if (r->sector == FEATURE_ROW)
+			printf("%s differs\n", sectorNames[r->sector]);
+		else
+			printf("%s pages %u-%u differ\n", sectorNames[r->sector], r->startPg,
+				   r->startPg + r->numPgs - 1);
+	}
+	if (pReport->numRanges > XO2ECA_DIFF_MAX_RANGES)
+		printf("... %u more ranges\n", pReport->numRanges - XO2ECA_DIFF_MAX_RANGES);
+	printf("%u of %u pages read differ\n", pReport->numDiffPgs, pReport->numPgsRead);
+}
+
+static int dump_pages(void *pCtx, XO2SectorMode_t sector, unsigned int startPg,
+					  unsigned int numPgs, const unsigned char *pData)
+{
+	(void)sector;
+	(void)startPg;
+	return fwrite(pData, XO2_FLASH_PAGE_SIZE, numPgs, pCtx) == numPgs ? OK : ERROR;
+}
+
+static void dump_progress(void *pCtx, unsigned int donePgs, unsigned int totalPgs)
+{
+	(void)pCtx;
+	fprintf(stderr, "\rRead %u of %u pages", donePgs, totalPgs);
+	if (donePgs == totalPgs)
+		fputc('\n', stderr);
+}
+
+/* Read back the sectors selected by mode into a raw file, return the exit status */
+static int dump(XO2Handle_t *pXO2, const char *path, int mode)
+{
+	XO2PageSink_t sink = {.putPages = dump_pages, .progress = isatty(2) ? dump_progress : NULL};
+	FILE *out;
+	int err;
+
+	out = fopen(path, "wb");
+	if (!out) {
+		fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	sink.pCtx = out;
+	err = XO2ECA_apiReadBack(pXO2, mode, &sink);
+	if (fclose(out) != 0 && err == OK)
+		err = -12;
+	if (err != OK) {
+		if (err == -12 || err == -22)
+			fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+		else
+			fprintf(stderr, "XO2ECA_apiReadBack failed: %d\n", err);
+		unlink(path);
+		return 1;
+	}
+	return 0;
+}
+
+/* Programming journal: one line naming the part, the bitstream digests and the
+   mode, followed by the progress, replaced as a whole on every checkpoint */
+typedef struct {
+	const char *path;
+	char *tmpPath;
+	XO2Devices_t devType;
+	const XO2_JEDEC_t *jedec;
+	int mode;
+} journal_t;
+
+static int journal_save(void *pCtx, const XO2Checkpoint_t *pDone)
+{
+	journal_t *j = pCtx;
+	FILE *out;
+	int err;
+
+	out = fopen(j->tmpPath, "w");
+	if (!out)
+		return ERROR;
+	fprintf(out, "xo2journal %s %.8x %.8x %d %u %u %d\n", XO2DevList[j->devType].pName,
+			j->jedec->CfgDigest, j->jedec->UFMDigest, j->mode,
+			pDone->cfgPgs, pDone->ufmPgs, pDone->featRow);
+	err = fflush(out) != 0 || fsync(fileno(out)) != 0;
+	if (fclose(out) != 0 || err || rename(j->tmpPath, j->path) != 0) {
+		unlink(j->tmpPath);
+		return ERROR;
+	}
+	return OK;
+}
+
+/* Read the progress from the journal, ERROR if there is none for this run */
+static int journal_load(const journal_t *j, XO2Checkpoint_t *pDone)
+{
+	char part[32];
+	unsigned cfgDigest, ufmDigest;
+	int mode, featRow, n;
+	FILE *in;
+
+	in = fopen(j->path, "r");
+	if (!in)
+		return ERROR;
+	n = fscanf(in, "xo2journal %31s %x %x %d %u %u %d", part, &cfgDigest, &ufmDigest, &mode,
+			   &pDone->cfgPgs, &pDone->ufmPgs, &featRow);
+	fclose(in);
+	if (n != 7 || strcmp(part, XO2DevList[j->devType].pName) != 0 ||
+		cfgDigest != j->jedec->CfgDigest || ufmDigest != j->jedec->UFMDigest || mode != j->mode)
+		return ERROR;
+	pDone->featRow = featRow != 0;
+	return OK;
+}
+
+/* Look up a part by name, e.g. MachXO2-1200, return -1 if unknown */
+static int find_part(const char *name)
+{
+	int i;
+
+	for (i = 0;i < LATTICE_XO2_NUM_DEVS;++i) {
+		if (strcmp(XO2DevList[i].pName, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Release the bitstream, stop parsing it first if streamed */
+static void release(XO2_JEDEC_t *jedec, jedec_stream_t *stream)
+{
+	jedec_stream_close(stream);
+	jedec_free(jedec);
+}
+
+/* Print the statistics if requested, release the link and the bitstream */
+static int finish(XO2Handle_t *pXO2, XO2_JEDEC_t *jedec, jedec_stream_t *stream,
+				  const char *statsPath, int ret)
+{
+	FILE *out;
+
+	if (pXO2->pStats) {
+		out = statsPath ? fopen(statsPath, "w") : stderr;
+		if (!out || XO2stats_print(out, pXO2->pStats) != OK) {
+			fprintf(stderr, "Could not write statistics %s: %s\n", statsPath, strerror(errno));
+			ret = 1;
+		}
+		if (out && out != stderr)
+			fclose(out);
+	}
+
+	XO2drvr_close(pXO2);
+	release(jedec, stream);
+	return ret;
 }
 
 int main(int argc, char *argv[])
 {
 	XO2Handle_t xo2;
 	XO2RegInfo_t xo2Info;
+	XO2Timing_t timing, measured;
+	XO2Stats_t stats;
 	int err;
 	bool load_after_flash = false, flash_ufm = false, force = false;
+	bool offline = false, flash_featrow = false;
+	bool diff = false, diff_first = false, streamed = false, verify = false;
+	XO2DiffReport_t diffReport;
+	const char *link = "i2c", *profile = NULL, *calibrate = NULL, *statsPath = NULL;
+	const char *convert = NULL, *dumpPath = NULL, *journalPath = NULL;
+	bool resume = false;
+	XO2Devices_t devType;
+	bool print_stats = false;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "luf")) != -1) {
+	memset(&xo2, 0, sizeof(xo2));
+	while ((opt = getopt_long(argc, argv, "loFufvsdqj:Rt:T:C:", longOpts, NULL)) != -1) {
 		switch (opt) {
 		case 'l':
 			load_after_flash = true;
 			break;
+		case 'o':
+			offline = true;
+			break;
+		case 'F':
+			flash_featrow = true;
+			break;
 		case 'u':
 			flash_ufm = true;
 			break;
 		case 'f':
 			force = true;
 			break;
+		case 'v':
+			verify = true;
+			break;
+		case 's':
+			streamed = true;
+			break;
+		case 'd':
+			diff = true;
+			break;
+		case 'q':
+			diff_first = true;
+			break;
+		case 'j':
+			journalPath = optarg;
+			break;
+		case 'R':
+			resume = true;
+			break;
+		case 't':
+			link = optarg;
+			break;
+		case 'T':
+			profile = optarg;
+			break;
+		case 'C':
+			calibrate = optarg;
+			break;
+		case 'S':
+			print_stats = true;
+			statsPath = optarg;
+			break;
+		case 'X':
+			convert = optarg;
+			break;
+		case 'D':
+			dumpPath = optarg;
+			break;
 		default:
 			usage(argv[0]);
 			return 1;
 		}
 	}
 
-	if (argc - optind < 3) {
-		usage(argv[0]);
-		return 1;
+	if (convert) {
+		if (argc - optind != 1) {
+			usage(argv[0]);
+			return 1;
+		}
+		XO2_JEDEC_t *jedec = jedec_parse_file(argv[optind]);
+		if (!jedec) {
+			fprintf(stderr, "jedec_parse failed\n");
+			return 1;
+		}
+		err = xo2img_write(convert, jedec);
+		if (err != 0)
+			fprintf(stderr, "Could not write image %s: %s\n", convert, strerror(errno));
+		jedec_free(jedec);
+		return err != 0;
 	}
 
-	XO2_JEDEC_t *jedec = jedec_parse(fopen(argv[optind+2], "r"));
-	if (!jedec) {
-		fprintf(stderr, "jedec_parse failed\n");
+	if (argc - optind < 3 || (streamed && diff) || (dumpPath && (streamed || diff)) ||
+		(journalPath && (streamed || diff || dumpPath)) || (resume && !journalPath) ||
+		(offline && load_after_flash) || (flash_featrow && !offline)) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	XO2ECA_apiJEDECinfo(NULL, jedec);
-
-	char *tmp, tmparr[32];
-	long i2cbus = strtol(argv[optind], &tmp, 0);
-	if (*tmp != '\0' || i2cbus < 0) {
-		fprintf(stderr, "Invalid i2c bus\n");
-		usage(argv[0]);
-		return 1;
+	XO2_JEDEC_t *jedec = NULL, *header = NULL;
+	jedec_stream_t *stream = NULL;
+	int part = dumpPath ? find_part(argv[optind+2]) : -1;
+	if (part >= 0) {
+		devType = part;
+	} else if (streamed) {
+		stream = jedec_stream_open(argv[optind+2]);
+		jedec = header = stream ? jedec_stream_header(stream) : NULL;
+	} else {
+		// The rest is loaded in the background, see jedec_stream_wait()
+		stream = jedec_stream_load(argv[optind+2]);
+		header = stream ? jedec_stream_header(stream) : NULL;
+	}
+	if (part < 0) {
+		if (!header) {
+			fprintf(stderr, "jedec_parse failed\n");
+			release(NULL, stream);
+			return 1;
+		}
+		devType = header->devID;
 	}
 
-	snprintf(tmparr, sizeof(tmparr), "/dev/i2c-%ld", i2cbus);
-	xo2.i2cfd = open(tmparr, O_RDWR);
-	if (xo2.i2cfd < 0) {
-		fprintf(stderr, "open %s failed: %s\n", tmparr, strerror(errno));
-		return 1;
+	char *tmp;
+	long i2cbus = 0, addr = 0;
+	if (strcmp(link, "i2c") == 0 || strcmp(link, "smbus") == 0) {
+		i2cbus = strtol(argv[optind], &tmp, 0);
+		if (*tmp != '\0' || i2cbus < 0) {
+			fprintf(stderr, "Invalid i2c bus\n");
+			usage(argv[0]);
+			release(jedec, stream);
+			return 1;
+		}
+	}
+	if (strcmp(link, "sim") != 0) {
+		addr = strtol(argv[optind+1], &tmp, 0);
+		if (*tmp != '\0' || addr < 0) {
+			fprintf(stderr, "Invalid i2c addr\n");
+			usage(argv[0]);
+			release(jedec, stream);
+			return 1;
+		}
 	}
 
-	xo2.addr = strtol(argv[optind+1], &tmp, 0);
-	if (*tmp != '\0' || xo2.addr < 0) {
-		fprintf(stderr, "Invalid i2c addr\n");
+	if (strcmp(link, "i2c") == 0) {
+		err = XO2drvr_openI2C(&xo2, i2cbus, addr);
+	} else if (strcmp(link, "smbus") == 0) {
+		err = XO2drvr_openSMBus(&xo2, i2cbus, addr);
+	} else if (strcmp(link, "spi") == 0) {
+		err = XO2drvr_openSPI(&xo2, argv[optind], addr);
+	} else if (strcmp(link, "sim") == 0) {
+		XO2SimTiming_t simTiming;
+		XO2sim_defaultTiming(devType, &simTiming);
+		err = XO2sim_open(&xo2, devType, &simTiming);
+	} else {
+		fprintf(stderr, "Invalid link %s\n", link);
 		usage(argv[0]);
+		release(jedec, stream);
+		return 1;
+	}
+	if (err != OK) {
+		fprintf(stderr, "open %s %s failed: %s\n", link, argv[optind], strerror(errno));
+		release(jedec, stream);
 		return 1;
 	}
 
 	xo2.cfgEn = false;
-	xo2.devType = MachXO2_640;
+	xo2.devType = devType;
+
+	if (profile) {
+		if (XO2timing_load(profile, devType, &timing) != OK) {
+			fprintf(stderr, "No timing for %s in profile %s, using datasheet maximum\n",
+					XO2DevList[devType].pName, profile);
+		} else {
+			xo2.pTiming = &timing;
+		}
+	}
+	if (calibrate) {
+		memset(&measured, 0, sizeof(measured));
+		xo2.pMeasured = &measured;
+	}
+	if (print_stats) {
+		XO2stats_reset(&stats);
+		xo2.pStats = &stats;
+	}
 
 	bool deviceIdOk = false;
 	int attempt;
@@ -101,8 +419,8 @@ int main(int argc, char *argv[])
 			   xo2Info.devID, xo2Info.UserCode, xo2Info.TraceID[0], xo2Info.TraceID[1],
 			   xo2Info.TraceID[2], xo2Info.TraceID[3], xo2Info.TraceID[4], xo2Info.TraceID[5],
 			   xo2Info.TraceID[6], xo2Info.TraceID[7]);
-		if (xo2Info.devID != XO2DevList[jedec->devID].DeviceIdHEZE &&
-			xo2Info.devID != XO2DevList[jedec->devID].DeviceIdHC) {
+		if (xo2Info.devID != XO2DevList[devType].DeviceIdHEZE &&
+			xo2Info.devID != XO2DevList[devType].DeviceIdHC) {
 			fprintf(stderr, "Device ID does not match device type of bitstream\n");
 			continue;
 		}
@@ -113,19 +431,122 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "No matching device ID read after %d attempts", attempt);
 		if (!force) {
 			fprintf(stderr, ", exiting\n");
-			return 1;
+			return finish(&xo2, jedec, stream, statsPath, 1);
 		} else {
 			fprintf(stderr, ", continuing anyway\n");
 		}
 	}
 
-	err = XO2ECA_apiProgram(&xo2, jedec, XO2ECA_ERASE_PROG_CFG |
-							(flash_ufm?XO2ECA_ERASE_PROG_UFM:0) |
-							(load_after_flash?XO2ECA_PROGRAM_TRANSPARENT:XO2ECA_PROGRAM_NOLOAD));
+	if (dumpPath) {
+		err = dump(&xo2, dumpPath, XO2ECA_ERASE_PROG_CFG | (flash_ufm?XO2ECA_ERASE_PROG_UFM:0));
+		return finish(&xo2, jedec, stream, statsPath, err);
+	}
+
+	if (diff) {
+		jedec = jedec_stream_wait(stream);
+		if (!jedec) {
+			fprintf(stderr, "jedec_parse failed\n");
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		}
+		XO2ECA_apiJEDECinfo(NULL, jedec);
+		err = XO2ECA_apiJEDECdiff(&xo2, jedec, XO2ECA_ERASE_PROG_CFG | XO2ECA_ERASE_PROG_FEATROW |
+								  (flash_ufm?XO2ECA_ERASE_PROG_UFM:0) |
+								  (diff_first?XO2ECA_DIFF_FIRST:0), &diffReport);
+		if (err < 0) {
+			fprintf(stderr, "XO2ECA_apiJEDECdiff failed: %d\n", err);
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		}
+		print_diff(&diffReport);
+		return finish(&xo2, jedec, stream, statsPath, err == XO2ECA_DIFF_FOUND ? 2 : 0);
+	}
+
+	int mode = XO2ECA_ERASE_PROG_CFG | (flash_ufm?XO2ECA_ERASE_PROG_UFM:0) |
+		(flash_featrow?XO2ECA_ERASE_PROG_FEATROW:0) |
+		(offline?XO2ECA_PROGRAM_OFFLINE:
+		 load_after_flash?XO2ECA_PROGRAM_TRANSPARENT:XO2ECA_PROGRAM_NOLOAD) |
+		(verify?XO2ECA_PROGRAM_VERIFY:0);
+	journal_t journal = {.path = journalPath, .devType = devType, .mode = mode};
+	XO2Journal_t xo2Journal = {.pCtx = &journal, .save = journal_save};
+	if (journalPath) {
+		journal.tmpPath = malloc(strlen(journalPath) + 5);
+		if (!journal.tmpPath)
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		sprintf(journal.tmpPath, "%s.tmp", journalPath);
+		xo2.pJournal = &xo2Journal;
+	}
+	if (streamed) {
+		XO2PageSource_t src;
+		jedec_stream_source(stream, &src);
+		err = XO2ECA_apiProgramStream(&xo2, &src, mode);
+		if (err == -50 || err == -51)
+			fprintf(stderr, "Bitstream invalid, device left without DONE\n");
+		else if (err == -52)
+			fprintf(stderr, "Bitstream has no digest to verify against, device left without DONE\n");
+	} else if (resume) {
+		jedec = jedec_stream_wait(stream);
+		if (!jedec) {
+			fprintf(stderr, "jedec_parse failed\n");
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		}
+		XO2ECA_apiJEDECinfo(NULL, jedec);
+		journal.jedec = jedec;
+		if (journal_load(&journal, &xo2Journal.done) != OK) {
+			fprintf(stderr, "No progress of this bitstream and options in %s\n", journalPath);
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		}
+		printf("Resuming after %u Cfg and %u UFM pages\n", xo2Journal.done.cfgPgs, xo2Journal.done.ufmPgs);
+		err = XO2ECA_apiProgramResume(&xo2, jedec, mode, &xo2Journal.done);
+		if (err == -17 || err == -27)
+			fprintf(stderr, "%s page %d is neither erased nor programmed, cannot resume\n",
+					err == -17 ? "Cfg" : "UFM", xo2.failPage);
+	} else {
+		if (journalPath)
+			unlink(journalPath);  // stale once the erase starts
+
+		// The device erases while the bitstream is loaded and checked
+		err = XO2ECA_apiProgramStart(&xo2, mode);
+		if (err == OK) {
+			jedec = jedec_stream_wait(stream);
+			if (!jedec) {
+				fprintf(stderr, "jedec_parse failed, device left without DONE\n");
+				XO2ECA_apiProgramAbort(&xo2);
+				return finish(&xo2, jedec, stream, statsPath, 1);
+			}
+			XO2ECA_apiJEDECinfo(NULL, jedec);
+			journal.jedec = jedec;
+			err = XO2ECA_apiProgram(&xo2, jedec, mode);
+		}
+	}
+	if (err == -15 || err == -25) {
+		fprintf(stderr, "Verify of %s failed", err == -15 ? "Cfg" : "UFM");
+		if (xo2.failPage >= 0)
+			fprintf(stderr, ", first differing page %d", xo2.failPage);
+		fprintf(stderr, ", device left without DONE\n");
+	}
+	if (err == -3)
+		fprintf(stderr, "Could not write journal %s: %s\n", journalPath, strerror(errno));
 	if (err != OK) {
 		fprintf(stderr, "XO2ECAcmd_apiProgram failed: %d\n", err);
-		return 1;
+		if (journalPath && err < -3 && err != -17 && err != -27)
+			fprintf(stderr, "Progress recorded in %s, continue with -R\n", journalPath);
+		free(journal.tmpPath);
+		return finish(&xo2, jedec, stream, statsPath, 1);
 	}
+	if (journalPath) {
+		unlink(journalPath);
+		free(journal.tmpPath);
+	}
+	if (xo2.bootUs)
+		printf("User mode %u us after refresh\n", xo2.bootUs);
 
-	return 0;
+	if (calibrate) {
+		printf("Measured: Cfg erase %u us, UFM erase %u us, page program %u us, refresh %u us\n",
+			   measured.cfgEraseUs, measured.ufmEraseUs, measured.progUs, measured.refreshUs);
+		if (XO2timing_save(calibrate, jedec->devID, &measured) != OK) {
+			fprintf(stderr, "Could not write timing profile %s: %s\n", calibrate, strerror(errno));
+			return finish(&xo2, jedec, stream, statsPath, 1);
+		}
+	}
+
+	return finish(&xo2, jedec, stream, statsPath, 0);
 }
@@ -0,0 +1,320 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/* Bitstream input that may be compressed
+ *
+ * A reader hands out the plain contents of a file descriptor or a buffer
+ * block by block.  gzip (with HAVE_ZLIB) and zstd (with HAVE_ZSTD) input is
+ * recognised by its magic bytes and decompressed on the fly, so the
+ * uncompressed file never has to be held in full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "reader.h"
+
+#define READER_IN_SIZE (64*1024)
+#define MAGIC_LEN 4
+
+static const uint8_t gzipMagic[] = {0x1f, 0x8b};
+static const uint8_t zstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+struct reader {
+	reader_format_t format;
+	int fd;			// input, -1 if all input is in the buffer given to reader_open()
+	const uint8_t *in;	// input not consumed yet
+	size_t avail;
+	bool inEof;		// nothing more to read after avail
+	bool end;		// end of the compressed stream seen with no input after it
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zds;
+#endif
+	uint8_t inBuf[READER_IN_SIZE];
+};
+
+/**
+ * Find out how a file is compressed from its first bytes.
+ *
+ * @param buf start of the file
+ * @param len bytes available, at least 4 to recognise all formats
+ * @return the format
+ */
+reader_format_t reader_detect(const void *buf, size_t len)
+{
+	if (len >= sizeof(gzipMagic) && memcmp(buf, gzipMagic, sizeof(gzipMagic)) == 0)
+		return READER_GZIP;
+	if (len >= sizeof(zstdMagic) && memcmp(buf, zstdMagic, sizeof(zstdMagic)) == 0)
+		return READER_ZSTD;
+	return READER_PLAIN;
+}
+
+/* Read more input into inBuf if everything has been consumed.
+   Return 0 on success or at the end of input, -1 on error.
+*/
+static int refill(reader_t *r)
+{
+	ssize_t n;
+
+	if (r->avail || r->inEof)
+		return 0;
+	if (r->fd < 0) {
+		r->inEof = true;
+		return 0;
+	}
+
+	do {
+		n = read(r->fd, r->inBuf, sizeof(r->inBuf));
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		fprintf(stderr, "read() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	r->in = r->inBuf;
+	r->avail = n;
+	r->inEof = n == 0;
+	return 0;
+}
+
+/**
+ * Open a reader on a file descriptor or a buffer.  The first bytes are read
+ * right away to find out the format.
+ *
+ * @param fd file to read, -1 to read buf instead.  Stays open.
+ * @param buf input if fd is -1, must stay valid until reader_close()
+ * @param len length of buf
+ * @return the reader, NULL on error
+ */
+reader_t *reader_open(int fd, const void *buf, size_t len)
+{
+	reader_t *r = calloc(1, sizeof(*r));
+	const char *name = NULL;
+	ssize_t n;
+
+	if (!r)
+		return NULL;
+	r->fd = fd;
+	if (fd < 0) {
+		r->in = buf;
+		r->avail = len;
+		r->inEof = true;
+	} else {
+		// Enough for the magic, a pipe may deliver less per read
+		r->in = r->inBuf;
+		while (r->avail < MAGIC_LEN) {
+			n = read(fd, r->inBuf + r->avail, sizeof(r->inBuf) - r->avail);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				fprintf(stderr, "read() failed: %s\n", strerror(errno));
+				goto fail;
+			}
+			if (n == 0) {
+				r->inEof = true;
+				break;
+			}
+			r->avail += n;
+		}
+	}
+
+	r->format = reader_detect(r->in, r->avail);
+	switch (r->format) {
+	case READER_PLAIN:
+		break;
+	case READER_GZIP:
+#ifdef HAVE_ZLIB
+		if (inflateInit2(&r->zs, 15 + 16) != Z_OK) // gzip wrapper only
+			goto fail;
+		break;
+#else
+		name = "gzip";
+		break;
+#endif
+	case READER_ZSTD:
+#ifdef HAVE_ZSTD
+		r->zds = ZSTD_createDStream();
+		if (!r->zds || ZSTD_isError(ZSTD_initDStream(r->zds)))
+			goto fail;
+		break;
+#else
+		name = "zstd";
+		break;
+#endif
+	}
+	if (name) {
+		fprintf(stderr, "%s compressed input not supported by this build\n", name);
+		goto fail;
+	}
+
+	return r;
+
+  fail:
+	reader_close(r);
+	return NULL;
+}
+
+/**
+ * Format of the input of a reader.
+ *
+ * @param r reader
+ * @return the format
+ */
+reader_format_t reader_format(const reader_t *r)
+{
+	return r->format;
+}
+
+/* The decoders below may hold back output when buf fills up, so they are
+   called again without new input until they stop producing.  After refill()
+   no input means the end of it.
+*/
+
+#ifdef HAVE_ZLIB
+static ssize_t read_gzip(reader_t *r, void *buf, size_t len)
+{
+	size_t out;
+	int ret;
+
+	for (;;) {
+		if (refill(r) != 0)
+			return -1;
+		if (r->end) {
+			if (!r->avail)
+				return 0;
+			// Another member follows, as from cat a.gz b.gz
+			inflateReset(&r->zs);
+			r->end = false;
+		}
+
+		r->zs.next_in = (Bytef *)r->in;
+		r->zs.avail_in = r->avail;
+		r->zs.next_out = buf;
+		r->zs.avail_out = len;
+		ret = inflate(&r->zs, Z_NO_FLUSH);
+		r->in += r->avail - r->zs.avail_in;
+		r->avail = r->zs.avail_in;
+		out = len - r->zs.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			r->end = true;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			fprintf(stderr, "gzip input corrupt: %s\n", r->zs.msg ? r->zs.msg : "inflate failed");
+			return -1;
+		}
+		if (out)
+			return out;
+		if (!r->end && !r->avail && r->inEof) {
+			fprintf(stderr, "Truncated gzip input\n");
+			return -1;
+		}
+	}
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static ssize_t read_zstd(reader_t *r, void *buf, size_t len)
+{
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t ret;
+
+	for (;;) {
+		if (refill(r) != 0)
+			return -1;
+		if (r->end && !r->avail)
+			return 0;
+
+		in.src = r->in;
+		in.size = r->avail;
+		in.pos = 0;
+		out.dst = buf;
+		out.size = len;
+		out.pos = 0;
+		ret = ZSTD_decompressStream(r->zds, &out, &in);
+		r->in += in.pos;
+		r->avail -= in.pos;
+		if (ZSTD_isError(ret)) {
+			fprintf(stderr, "zstd input corrupt: %s\n", ZSTD_getErrorName(ret));
+			return -1;
+		}
+		r->end = ret == 0;  // frame complete and flushed, another one may follow
+		if (out.pos)
+			return out.pos;
+		if (!r->end && !r->avail && r->inEof) {
+			fprintf(stderr, "Truncated zstd input\n");
+			return -1;
+		}
+	}
+}
+#endif
+
+/**
+ * Read plain file contents.
+ *
+ * @param r reader
+ * @param buf filled with up to len bytes
+ * @param len size of buf
+ * @return number of bytes read, 0 at the end of the file, -1 on error
+ */
+ssize_t reader_read(reader_t *r, void *buf, size_t len)
+{
+	size_t n;
+
+	switch (r->format) {
+	case READER_PLAIN:
+		if (refill(r) != 0)
+			return -1;
+		n = r->avail < len ? r->avail : len;
+		memcpy(buf, r->in, n);
+		r->in += n;
+		r->avail -= n;
+		return n;
+#ifdef HAVE_ZLIB
+	case READER_GZIP:
+		return read_gzip(r, buf, len);
+#endif
+#ifdef HAVE_ZSTD
+	case READER_ZSTD:
+		return read_zstd(r, buf, len);
+#endif
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Release a reader, the file descriptor stays open.
+ *
+ * @param r reader, may be NULL
+ */
+void reader_close(reader_t *r)
+{
+	if (!r)
+		return;
+#ifdef HAVE_ZLIB
+	if (r->format == READER_GZIP)
+		inflateEnd(&r->zs);
+#endif
+#ifdef HAVE_ZSTD
+	if (r->zds)
+		ZSTD_freeDStream(r->zds);
+#endif
+	free(r);
+}
@@ -0,0 +1,28 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+	READER_PLAIN,
+	READER_GZIP,
+	READER_ZSTD,
+} reader_format_t;
+
+typedef struct reader reader_t;
+
+reader_format_t reader_detect(const void *buf, size_t len);
+reader_t *reader_open(int fd, const void *buf, size_t len);
+reader_format_t reader_format(const reader_t *r);
+ssize_t reader_read(reader_t *r, void *buf, size_t len);
+void reader_close(reader_t *r);
+
+#endif
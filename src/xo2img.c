@@ -0,0 +1,271 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+/* Precompiled bitstream image (.xo2img)
+ *
+ * The fuse data of a parsed JEDEC file in a form that can be used in place,
+ * so loading an image is mapping it and checking its digest.  All fields are
+ * little endian:
+ *
+ *   xo2img_hdr_t                 128 bytes
+ *   Cfg data                     CfgDataSize bytes, at a multiple of XO2IMG_ALIGN
+ *   UFM data                     UFMDataSize bytes, at a multiple of XO2IMG_ALIGN
+ *   page map                     one bit per Cfg then UFM data page, LSB first,
+ *                                set if the page is not all 0
+ *
+ * The digest is the CRC32C of the whole file with the digest field set to 0.
+ * The header also carries the CRC32C of the Cfg and of the UFM data, see
+ * XO2_JEDEC_t.CfgDigest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include "XO2_ECA/XO2_dev.h"
+#include "digest.h"
+#include "jedec.h"
+#include "xo2img.h"
+
+#define XO2IMG_VERSION 1
+#define XO2IMG_ALIGN 4096   // payloads start on a memory page of the mapping
+
+typedef struct {
+	char magic[XO2IMG_MAGIC_LEN];
+	uint32_t version;
+	uint32_t hdrSize;
+	char devName[16];        // XO2DevList name, NUL padded
+	uint32_t pageCnt;
+	uint32_t cfgDataSize;
+	uint32_t ufmDataSize;
+	uint32_t userCode;
+	uint32_t securityFuses;
+	uint8_t feature[8];
+	uint8_t feabits[2];
+	uint8_t reserved0[2];
+	uint32_t cfgOffset;      // 0 if the JEDEC has no Cfg data
+	uint32_t ufmOffset;      // 0 if the JEDEC has no UFM data
+	uint32_t mapOffset;
+	uint32_t mapSize;
+	uint32_t fileSize;
+	uint32_t digest;
+	uint32_t cfgDigest;
+	uint32_t ufmDigest;
+	uint8_t reserved[32];
+} xo2img_hdr_t;
+
+_Static_assert(sizeof(xo2img_hdr_t) == 128, "xo2img header layout");
+
+static size_t align_up(size_t n)
+{
+	return (n + XO2IMG_ALIGN - 1) & ~(size_t)(XO2IMG_ALIGN - 1);
+}
+
+/* Set the bits of the non-zero pages of data in map, from bit first on */
+static void map_pages(uint8_t *map, unsigned first, const uint8_t *data, unsigned size)
+{
+	static const uint8_t zero[XO2_FLASH_PAGE_SIZE];
+
+	for (unsigned pg = 0;pg < size / XO2_FLASH_PAGE_SIZE;++pg) {
+		if (memcmp(data + XO2_FLASH_PAGES_LEN(pg), zero, XO2_FLASH_PAGE_SIZE) != 0)
+			map[(first + pg) / 8] |= 1 << ((first + pg) % 8);
+	}
+}
+
+/**
+ * Check whether a buffer starts like an image.
+ *
+ * @param buf start of the file
+ * @param len number of bytes available
+ * @return true if buf holds the image magic
+ */
+bool xo2img_probe(const void *buf, size_t len)
+{
+	return len >= XO2IMG_MAGIC_LEN && memcmp(buf, XO2IMG_MAGIC, XO2IMG_MAGIC_LEN) == 0;
+}
+
+/**
+ * Use an image in place.  The returned JEDEC points into buf and takes it over.
+ *
+ * @param buf image, from malloc() or mmap()
+ * @param len length of the image
+ * @param mapLen length of the mapping if buf is from mmap(), 0 if from malloc()
+ * @return the JEDEC, to be released with jedec_free(), NULL on error in which
+ * case buf still belongs to the caller
+ */
+XO2_JEDEC_t *xo2img_attach(void *buf, size_t len, size_t mapLen)
+{
+	xo2img_hdr_t hdr;
+	XO2_JEDEC_t *jedec;
+	uint8_t *img = buf;
+	uint32_t crc;
+	unsigned pages;
+	int dev;
+
+	if (!xo2img_probe(buf, len) || len < sizeof(hdr)) {
+		fprintf(stderr, "Not an xo2img image\n");
+		return NULL;
+	}
+	memcpy(&hdr, img, sizeof(hdr));
+	if (le32toh(hdr.version) != XO2IMG_VERSION || le32toh(hdr.hdrSize) != sizeof(hdr)) {
+		fprintf(stderr, "Unsupported xo2img version %u\n", le32toh(hdr.version));
+		return NULL;
+	}
+	if (le32toh(hdr.fileSize) != len) {
+		fprintf(stderr, "xo2img truncated: %zu of %u bytes\n", len, le32toh(hdr.fileSize));
+		return NULL;
+	}
+
+	// Digest over the file with the digest field zeroed
+	crc = digest_crc32c(0, img, offsetof(xo2img_hdr_t, digest));
+	crc = digest_crc32c(crc, "\0\0\0\0", sizeof(hdr.digest));
+	crc = digest_crc32c(crc, img + offsetof(xo2img_hdr_t, digest) + sizeof(hdr.digest),
+						len - offsetof(xo2img_hdr_t, digest) - sizeof(hdr.digest));
+	if (crc != le32toh(hdr.digest)) {
+		fprintf(stderr, "xo2img digest failed: got %.8x, expected %.8x\n", crc, le32toh(hdr.digest));
+		return NULL;
+	}
+
+	hdr.devName[sizeof(hdr.devName) - 1] = '\0';
+	for (dev = 0;dev < LATTICE_XO2_NUM_DEVS;++dev) {
+		if (strcmp(XO2DevList[dev].pName, hdr.devName) == 0)
+			break;
+	}
+	if (dev == LATTICE_XO2_NUM_DEVS) {
+		fprintf(stderr, "Unsupported device %s\n", hdr.devName);
+		return NULL;
+	}
+
+	// Sizes are whole pages and every section lies within the file
+	pages = le32toh(hdr.cfgDataSize) / XO2_FLASH_PAGE_SIZE + le32toh(hdr.ufmDataSize) / XO2_FLASH_PAGE_SIZE;
+	if (le32toh(hdr.cfgDataSize) % XO2_FLASH_PAGE_SIZE || le32toh(hdr.ufmDataSize) % XO2_FLASH_PAGE_SIZE ||
+		le32toh(hdr.cfgDataSize) > XO2_FLASH_PAGES_LEN((unsigned)XO2DevList[dev].Cfgpages) ||
+		le32toh(hdr.ufmDataSize) > XO2_FLASH_PAGES_LEN((unsigned)XO2DevList[dev].UFMpages) ||
+		(hdr.cfgOffset && (uint64_t)le32toh(hdr.cfgOffset) + le32toh(hdr.cfgDataSize) > len) ||
+		(hdr.ufmOffset && (uint64_t)le32toh(hdr.ufmOffset) + le32toh(hdr.ufmDataSize) > len) ||
+		le32toh(hdr.mapSize) != (pages + 7) / 8 ||
+		(uint64_t)le32toh(hdr.mapOffset) + le32toh(hdr.mapSize) > len) {
+		fprintf(stderr, "Corrupt xo2img header\n");
+		return NULL;
+	}
+
+	jedec = jedec_alloc(buf, mapLen);
+	if (!jedec)
+		return NULL;
+	jedec->devID = dev;
+	jedec->pageCnt = le32toh(hdr.pageCnt);
+	jedec->CfgDataSize = le32toh(hdr.cfgDataSize);
+	jedec->UFMDataSize = le32toh(hdr.ufmDataSize);
+	jedec->UserCode = le32toh(hdr.userCode);
+	jedec->SecurityFuses = le32toh(hdr.securityFuses);
+	jedec->pCfgData = hdr.cfgOffset ? img + le32toh(hdr.cfgOffset) : NULL;
+	jedec->pUFMData = hdr.ufmOffset ? img + le32toh(hdr.ufmOffset) : NULL;
+	jedec->pPageMap = img + le32toh(hdr.mapOffset);
+	jedec->CfgDigest = le32toh(hdr.cfgDigest);
+	jedec->UFMDigest = le32toh(hdr.ufmDigest);
+	jedec->digestValid = true;
+	memcpy(jedec->pFeatureRow.feature, hdr.feature, sizeof(hdr.feature));
+	memcpy(jedec->pFeatureRow.feabits, hdr.feabits, sizeof(hdr.feabits));
+
+	return jedec;
+}
+
+/**
+ * Write a JEDEC as image.  The file is written next to path and renamed when
+ * complete.
+ *
+ * @param path image file to write
+ * @param jedec parsed JEDEC
+ * @return 0 on success, -1 on error with errno set
+ */
+int xo2img_write(const char *path, const XO2_JEDEC_t *jedec)
+{
+	char tmpPath[4096];
+	xo2img_hdr_t hdr;
+	size_t cfgOffset = 0, ufmOffset = 0, mapOffset, size;
+	unsigned cfgPgs, ufmPgs;
+	uint8_t *img;
+	FILE *out;
+	int ret = -1;
+
+	if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	cfgPgs = jedec->pCfgData ? jedec->CfgDataSize / XO2_FLASH_PAGE_SIZE : 0;
+	ufmPgs = jedec->pUFMData ? jedec->UFMDataSize / XO2_FLASH_PAGE_SIZE : 0;
+
+	size = sizeof(hdr);
+	if (jedec->pCfgData) {
+		cfgOffset = align_up(size);
+		size = cfgOffset + XO2_FLASH_PAGES_LEN(cfgPgs);
+	}
+	if (jedec->pUFMData) {
+		ufmOffset = align_up(size);
+		size = ufmOffset + XO2_FLASH_PAGES_LEN(ufmPgs);
+	}
+	mapOffset = size;
+	size += (cfgPgs + ufmPgs + 7) / 8;
+
+	img = calloc(1, size);
+	if (!img)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, XO2IMG_MAGIC, XO2IMG_MAGIC_LEN);
+	hdr.version = htole32(XO2IMG_VERSION);
+	hdr.hdrSize = htole32(sizeof(hdr));
+	strncpy(hdr.devName, XO2DevList[jedec->devID].pName, sizeof(hdr.devName) - 1);
+	hdr.pageCnt = htole32(jedec->pageCnt);
+	hdr.cfgDataSize = htole32(XO2_FLASH_PAGES_LEN(cfgPgs));
+	hdr.ufmDataSize = htole32(XO2_FLASH_PAGES_LEN(ufmPgs));
+	hdr.userCode = htole32(jedec->UserCode);
+	hdr.securityFuses = htole32(jedec->SecurityFuses);
+	memcpy(hdr.feature, jedec->pFeatureRow.feature, sizeof(hdr.feature));
+	memcpy(hdr.feabits, jedec->pFeatureRow.feabits, sizeof(hdr.feabits));
+	hdr.cfgOffset = htole32(cfgOffset);
+	hdr.ufmOffset = htole32(ufmOffset);
+	hdr.mapOffset = htole32(mapOffset);
+	hdr.mapSize = htole32((cfgPgs + ufmPgs + 7) / 8);
+	hdr.fileSize = htole32(size);
+	hdr.cfgDigest = htole32(cfgPgs ? digest_crc32c(0, jedec->pCfgData, XO2_FLASH_PAGES_LEN(cfgPgs)) : 0);
+	hdr.ufmDigest = htole32(ufmPgs ? digest_crc32c(0, jedec->pUFMData, XO2_FLASH_PAGES_LEN(ufmPgs)) : 0);
+
+	if (cfgPgs)
+		memcpy(img + cfgOffset, jedec->pCfgData, XO2_FLASH_PAGES_LEN(cfgPgs));
+	if (ufmPgs)
+		memcpy(img + ufmOffset, jedec->pUFMData, XO2_FLASH_PAGES_LEN(ufmPgs));
+	if (cfgPgs)
+		map_pages(img + mapOffset, 0, jedec->pCfgData, XO2_FLASH_PAGES_LEN(cfgPgs));
+	if (ufmPgs)
+		map_pages(img + mapOffset, cfgPgs, jedec->pUFMData, XO2_FLASH_PAGES_LEN(ufmPgs));
+
+	memcpy(img, &hdr, sizeof(hdr));
+	hdr.digest = htole32(digest_crc32c(0, img, size));
+	memcpy(img + offsetof(xo2img_hdr_t, digest), &hdr.digest, sizeof(hdr.digest));
+
+	out = fopen(tmpPath, "wb");
+	if (!out)
+		goto done;
+	if (fwrite(img, 1, size, out) != size) {
+		fclose(out);
+		remove(tmpPath);
+		goto done;
+	}
+	if (fclose(out) != 0 || rename(tmpPath, path) != 0) {
+		remove(tmpPath);
+		goto done;
+	}
+	ret = 0;
+
+  done:
+	free(img);
+	return ret;
+}
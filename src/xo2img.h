@@ -0,0 +1,22 @@
+/*
+ *  Copyright (c) 2018-2020 CETITEC GmbH
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#ifndef XO2IMG_H
+#define XO2IMG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "XO2_ECA/XO2_dev.h"
+
+#define XO2IMG_MAGIC "XO2IMG\r\n"   /**< First 8 bytes of an image, \r\n catches text mode transfers */
+#define XO2IMG_MAGIC_LEN 8
+
+bool xo2img_probe(const void *buf, size_t len);
+XO2_JEDEC_t *xo2img_attach(void *buf, size_t len, size_t mapLen);
+int xo2img_write(const char *path, const XO2_JEDEC_t *jedec);
+
+#endif